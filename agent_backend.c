@@ -0,0 +1,341 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "counter_backend.h"
+#include "perf_backend.h"
+#include "agent_ring.h"
+
+/**********
+ * Name: agent_backend
+ * Description: counter backend for spawned commands that reads the samples
+ * pm_agent takes inside the process (see pm_agent.c) instead of reading the
+ * counters itself. attach() creates the agent ring of the child while it
+ * waits in front of exec(), the command is started with the agent in
+ * LD_PRELOAD. read() drains the samples the agent took since the previous
+ * read: the deltas between them are handed out by read_burst(), one record
+ * per agent sample with its own timestamp and interval, and their sum is the
+ * record of the tick. Until the agent runs read() returns zeros. Every read
+ * drains the ring up to its head; the burst buffer holds the samples of two
+ * read periods and grows when a late read finds more, up to the ring size.
+ * The events are one group on the main thread of the command, --multiplex
+ * and attaching to running processes are not supported.
+ * ********/
+
+#ifndef PM_AGENT_PATH
+#define PM_AGENT_PATH "libpm_agent.so"
+#endif
+
+/* burst buffer of a monitor that reads without a pause */
+#define AGENT_BURST_MIN 64
+
+struct agent_backend_priv
+{
+    unsigned int nr_events;
+    struct agent_event events[AGENT_MAX_EVENTS];
+    pid_t pid;
+    char path[64];
+    struct agent_ring *ring;
+    /* totals of the latest sample consumed, the start of the next delta */
+    struct agent_sample last;
+    int have_last;
+    sample_record *burst;
+    unsigned int burst_size;
+    unsigned int nr_burst;
+    unsigned int next_burst;
+};
+
+typedef struct agent_backend_priv agent_backend_priv;
+
+static int agent_backend_init(counter_backend *backend, const PAPI_event *events, unsigned int nr_events)
+{
+    agent_backend_priv *priv = backend->priv;
+
+    if (!backend->enable_on_exec)
+    {
+        printf("ERROR: the agent backend can only monitor commands it spawns\n");
+        return -1;
+    }
+    if (backend->multiplex)
+    {
+        printf("ERROR: the agent counts one event group, --multiplex is not supported\n");
+        return -1;
+    }
+    if (nr_events > AGENT_MAX_EVENTS)
+    {
+        printf("ERROR: the agent counts at most %d events\n", AGENT_MAX_EVENTS);
+        return -1;
+    }
+    if (strchr(backend->preload, '/') != NULL && access(backend->preload, R_OK) != 0)
+    {
+        printf("ERROR: could not find the agent library %s: %s\n", backend->preload, strerror(errno));
+        return -1;
+    }
+    for (unsigned int i = 0; i < nr_events; i++)
+    {
+        struct perf_event_attr attr;
+
+        if (perf_encode_event(events[i].event_name, &attr) != 0)
+        {
+            printf("ERROR: no perf encoding for event %s\n", events[i].event_name);
+            return -1;
+        }
+        priv->events[i].type = attr.type;
+        priv->events[i].config = attr.config;
+        priv->events[i].config1 = attr.config1;
+        priv->events[i].config2 = attr.config2;
+    }
+    priv->nr_events = nr_events;
+    return 0;
+}
+
+/* makes room for size samples in the burst buffer */
+static int agent_burst_reserve(agent_backend_priv *priv, uint64_t size)
+{
+    sample_record *burst;
+
+    if (size <= priv->burst_size)
+    {
+        return 0;
+    }
+    if (size > AGENT_RING_CAPACITY)
+    {
+        size = AGENT_RING_CAPACITY;
+    }
+    burst = realloc(priv->burst, size * sizeof(sample_record));
+    if (burst == NULL)
+    {
+        perror("Could not allocate the agent samples");
+        return -1;
+    }
+    priv->burst = burst;
+    priv->burst_size = size;
+    return 0;
+}
+
+static int agent_backend_attach(counter_backend *backend, pid_t pid)
+{
+    agent_backend_priv *priv = backend->priv;
+    void *mapped;
+    int fd;
+
+    priv->pid = pid;
+    /* twice the samples of a read period leaves room for a read that is late */
+    if (agent_burst_reserve(priv, backend->read_period_ns > 0
+                                      ? 2 * (backend->read_period_ns / backend->sample_period_ns + 1)
+                                      : AGENT_BURST_MIN) != 0)
+    {
+        return -1;
+    }
+    snprintf(priv->path, sizeof(priv->path), AGENT_RING_PATH_FORMAT, pid);
+    /* left behind by a monitor that did not exit cleanly, pids are reused */
+    unlink(priv->path);
+    fd = open(priv->path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        printf("ERROR: could not create agent ring %s: %s\n", priv->path, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(struct agent_ring)) != 0)
+    {
+        printf("ERROR: could not size agent ring %s: %s\n", priv->path, strerror(errno));
+        close(fd);
+        unlink(priv->path);
+        return -1;
+    }
+    mapped = mmap(NULL, sizeof(struct agent_ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        printf("ERROR: could not map agent ring %s: %s\n", priv->path, strerror(errno));
+        unlink(priv->path);
+        return -1;
+    }
+    priv->ring = mapped;
+    priv->ring->version = AGENT_RING_VERSION;
+    priv->ring->nr_events = priv->nr_events;
+    priv->ring->period_ns = backend->sample_period_ns;
+    memcpy(priv->ring->events, priv->events, sizeof(priv->events));
+    __atomic_store_n(&priv->ring->magic, AGENT_RING_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int agent_backend_start(counter_backend *backend)
+{
+    /* the agent starts counting when the command execs */
+    (void)backend;
+    return 0;
+}
+
+/* delta of sample against the previous one into record */
+static void agent_delta(agent_backend_priv *priv, const struct agent_sample *sample, sample_record *record)
+{
+    uint64_t enabled = sample->time_enabled_ns - priv->last.time_enabled_ns;
+    uint64_t running = sample->time_running_ns - priv->last.time_running_ns;
+
+    record->timestamp_ns = sample->timestamp_ns;
+    record->interval_ns = sample->timestamp_ns - priv->last.timestamp_ns;
+    record->lateness_ns = 0;
+    record->missed_deadlines = 0;
+    record->time_enabled_ns = enabled;
+    record->time_running_ns = running;
+    for (unsigned int e = 0; e < priv->nr_events; e++)
+    {
+        record->values[e] = sample->values[e] - priv->last.values[e];
+        record->coverage[e] = enabled > 0 ? (float)running / enabled : 1.0f;
+    }
+}
+
+static int agent_backend_read(counter_backend *backend, sample_record *record)
+{
+    agent_backend_priv *priv = backend->priv;
+    struct agent_ring *ring = priv->ring;
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n(&ring->state, __ATOMIC_ACQUIRE) == AGENT_FAILED)
+    {
+        printf("ERROR: the agent in pid %d could not open its counters: %s\n", priv->pid, strerror(ring->error));
+        return -1;
+    }
+
+    record->time_enabled_ns = 0;
+    record->time_running_ns = 0;
+    for (unsigned int e = 0; e < priv->nr_events; e++)
+    {
+        record->values[e] = 0;
+    }
+    priv->nr_burst = 0;
+    priv->next_burst = 0;
+    /* the agent drops samples rather than overrun the ring, more is a ring it has broken */
+    if (head - tail > AGENT_RING_CAPACITY)
+    {
+        printf("ERROR: the agent ring of pid %d holds %llu samples\n", priv->pid, (unsigned long long)(head - tail));
+        return -1;
+    }
+    if (agent_burst_reserve(priv, head - tail) != 0)
+    {
+        return -1;
+    }
+    for (; tail != head; tail++)
+    {
+        const struct agent_sample *sample = &ring->samples[tail & (AGENT_RING_CAPACITY - 1)];
+        sample_record *burst = &priv->burst[priv->nr_burst];
+
+        /* the agent's first sample is the start of its first interval */
+        if (priv->have_last)
+        {
+            agent_delta(priv, sample, burst);
+            for (unsigned int e = 0; e < priv->nr_events; e++)
+            {
+                record->values[e] += burst->values[e];
+            }
+            record->time_enabled_ns += burst->time_enabled_ns;
+            record->time_running_ns += burst->time_running_ns;
+            priv->nr_burst++;
+        }
+        priv->last = *sample;
+        priv->have_last = 1;
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+    for (unsigned int e = 0; e < priv->nr_events; e++)
+    {
+        record->coverage[e] = record->time_enabled_ns > 0 ? (float)record->time_running_ns / record->time_enabled_ns : 1.0f;
+    }
+    return 0;
+}
+
+static int agent_backend_read_burst(counter_backend *backend, sample_record *record)
+{
+    agent_backend_priv *priv = backend->priv;
+
+    if (priv->next_burst == priv->nr_burst)
+    {
+        return 1;
+    }
+    *record = priv->burst[priv->next_burst++];
+    return 0;
+}
+
+static int agent_backend_stop(counter_backend *backend)
+{
+    agent_backend_priv *priv = backend->priv;
+    struct agent_ring *ring = priv->ring;
+    unsigned long long dropped;
+
+    if (ring == NULL)
+    {
+        return 0;
+    }
+    dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    switch (__atomic_load_n(&ring->state, __ATOMIC_ACQUIRE))
+    {
+    case AGENT_WAITING:
+        printf("Warning: the agent never ran in pid %d, could %s not be preloaded?\n", priv->pid, backend->preload);
+        break;
+    case AGENT_RDPMC:
+        printf("Agent in pid %d read its counters with rdpmc\n", priv->pid);
+        break;
+    case AGENT_READ:
+        printf("Agent in pid %d read its counters with read(), rdpmc is not available for them\n", priv->pid);
+        break;
+    }
+    if (dropped > 0)
+    {
+        printf("Warning: the agent in pid %d dropped %llu samples, the monitor did not drain its ring in time\n",
+               priv->pid, dropped);
+    }
+    return 0;
+}
+
+static int agent_backend_detach(counter_backend *backend)
+{
+    (void)backend;
+    return 0;
+}
+
+static void agent_backend_destroy(counter_backend *backend)
+{
+    agent_backend_priv *priv = backend->priv;
+
+    if (priv->ring != NULL)
+    {
+        munmap(priv->ring, sizeof(struct agent_ring));
+        unlink(priv->path);
+    }
+    free(priv->burst);
+    free(priv);
+    free(backend);
+}
+
+counter_backend *agent_backend_create(void)
+{
+    counter_backend *backend = calloc(1, sizeof(counter_backend));
+    agent_backend_priv *priv = calloc(1, sizeof(agent_backend_priv));
+    const char *library = getenv("PROCESS_MONITOR_AGENT");
+
+    if (backend == NULL || priv == NULL)
+    {
+        free(backend);
+        free(priv);
+        return NULL;
+    }
+
+    backend->name = "agent";
+    backend->sample_period_ns = AGENT_DEFAULT_PERIOD_NS;
+    backend->preload = library != NULL ? library : PM_AGENT_PATH;
+    backend->init = agent_backend_init;
+    backend->attach = agent_backend_attach;
+    backend->start = agent_backend_start;
+    backend->read = agent_backend_read;
+    backend->read_burst = agent_backend_read_burst;
+    backend->stop = agent_backend_stop;
+    backend->detach = agent_backend_detach;
+    backend->destroy = agent_backend_destroy;
+    backend->priv = priv;
+    return backend;
+}
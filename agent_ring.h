@@ -0,0 +1,77 @@
+#ifndef AGENT_RING_H
+#define AGENT_RING_H
+
+#include <stdint.h>
+
+/**********
+ * Name: agent_ring
+ * Description: shared memory between the monitor and pm_agent, the library
+ * preloaded into a spawned command by the agent backend. The monitor creates
+ * the file of the child's pid while the child waits in front of exec(), with
+ * the encoded events and the sampling period, and publishes magic last. The
+ * agent's constructor finds it by its own pid, opens the events on the main
+ * thread and reports in state whether it reads them with rdpmc or read().
+ * Samples are the running totals since the agent opened the events, written
+ * by the agent at head and consumed by the monitor at tail, one producer and
+ * one consumer. A full ring drops the sample and counts it in dropped.
+ * ********/
+
+#define AGENT_RING_MAGIC 0x706d6167
+#define AGENT_RING_VERSION 1
+#define AGENT_MAX_EVENTS 8
+/* power of two */
+#define AGENT_RING_CAPACITY 16384
+#define AGENT_RING_PATH_FORMAT "/dev/shm/process_monitor.agent.%d"
+#define AGENT_DEFAULT_PERIOD_NS 100000
+/* below this the agent's own sampling would take most of the command's time */
+#define AGENT_MIN_PERIOD_NS 1000
+
+enum agent_state
+{
+    /* the agent has not run yet */
+    AGENT_WAITING,
+    /* counters are read in user space with rdpmc */
+    AGENT_RDPMC,
+    /* counters are read with read(), rdpmc is not available for them */
+    AGENT_READ,
+    /* the agent could not set up, error holds the errno */
+    AGENT_FAILED
+};
+
+/* perf_event_attr fields the monitor encoded, the agent fills in the rest */
+struct agent_event
+{
+    uint32_t type;
+    uint32_t pad;
+    uint64_t config;
+    uint64_t config1;
+    uint64_t config2;
+};
+
+struct agent_sample
+{
+    /* CLOCK_MONOTONIC, the clock of the monitor's ticks */
+    uint64_t timestamp_ns;
+    uint64_t time_enabled_ns;
+    uint64_t time_running_ns;
+    uint64_t values[AGENT_MAX_EVENTS];
+};
+
+struct agent_ring
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nr_events;
+    uint32_t state;
+    int32_t error;
+    uint32_t pad;
+    uint64_t period_ns;
+    struct agent_event events[AGENT_MAX_EVENTS];
+    uint64_t dropped;
+    /* separate cache lines for the producer and the consumer */
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail __attribute__((aligned(64)));
+    struct agent_sample samples[AGENT_RING_CAPACITY] __attribute__((aligned(64)));
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+/**********
+ * Name: instructionloop
+ * Description: retires a fixed number of user space instructions, for
+ * checking that the instruction counts of the monitor are exact and for
+ * measuring how much sampling slows down a purely compute bound process.
+ * ********/
+
+#define DEFAULT_ITERATIONS 200000000ULL
+
+/* instructions retired per loop iteration on x86-64 */
+#define INSTRUCTIONS_PER_ITERATION 6
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long long iterations = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_ITERATIONS;
+    unsigned long long counter = iterations;
+    uint64_t start_ns = monotonic_ns();
+
+    if (iterations == 0)
+    {
+        printf("Usage: %s [iterations (default %llu)]\n", argv[0], DEFAULT_ITERATIONS);
+        return -1;
+    }
+#if defined(__x86_64__)
+    unsigned long long a = 0, b = 0;
+
+    __asm__ volatile(
+        "1:\n\t"
+        "add $1, %1\n\t"
+        "add $1, %2\n\t"
+        "add $1, %1\n\t"
+        "add $1, %2\n\t"
+        "dec %0\n\t"
+        "jnz 1b\n\t"
+        : "+r"(counter), "+r"(a), "+r"(b)
+        :
+        : "cc");
+    printf("payload_instructions=%llu\n", iterations * INSTRUCTIONS_PER_ITERATION);
+#else
+    /* the compiler decides the instructions, only the runtime is comparable */
+    volatile unsigned long long sink = 0;
+
+    while (counter-- > 0)
+    {
+        sink += counter;
+    }
+#endif
+    printf("payload_runtime_ns=%llu\n", (unsigned long long)(monotonic_ns() - start_ns));
+    return 0;
+}
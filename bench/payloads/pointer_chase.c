@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+/**********
+ * Name: pointer_chase
+ * Description: follows a random cyclic chain of pointers through a buffer
+ * much larger than the last level cache, so nearly every step is a dependent
+ * load that misses L3. Exercises the cache miss counters and a payload that
+ * spends its time stalled on memory.
+ * ********/
+
+#define DEFAULT_BUFFER_MB 256
+#define DEFAULT_STEPS 20000000ULL
+
+/* one pointer per cache line, neighbouring slots do not share a line */
+#define LINE_WORDS (64 / sizeof(void *))
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* xorshift, a fixed seed keeps every run on the same chain */
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+int main(int argc, char **argv)
+{
+    size_t buffer_mb = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_BUFFER_MB;
+    unsigned long long steps = argc > 2 ? strtoull(argv[2], NULL, 10) : DEFAULT_STEPS;
+    size_t nr_lines = buffer_mb * 1024 * 1024 / 64;
+    void **buffer = NULL;
+    size_t *order = NULL;
+    uint64_t state = 88172645463325252ULL;
+    uint64_t start_ns;
+    void **cursor;
+
+    if (nr_lines < 2 || steps == 0)
+    {
+        printf("Usage: %s [buffer MB (default %d)] [steps (default %llu)]\n", argv[0], DEFAULT_BUFFER_MB, DEFAULT_STEPS);
+        return -1;
+    }
+    buffer = aligned_alloc(64, nr_lines * 64);
+    order = malloc(nr_lines * sizeof(size_t));
+    if (buffer == NULL || order == NULL)
+    {
+        perror("Could not allocate the chain");
+        return -1;
+    }
+
+    /* Sattolo's shuffle gives a single cycle through every line */
+    for (size_t i = 0; i < nr_lines; i++)
+    {
+        order[i] = i;
+    }
+    for (size_t i = nr_lines - 1; i > 0; i--)
+    {
+        size_t j = next_random(&state) % i;
+        size_t swap = order[i];
+
+        order[i] = order[j];
+        order[j] = swap;
+    }
+    for (size_t i = 0; i < nr_lines; i++)
+    {
+        buffer[order[i] * LINE_WORDS] = &buffer[order[(i + 1) % nr_lines] * LINE_WORDS];
+    }
+    free(order);
+
+    start_ns = monotonic_ns();
+    cursor = &buffer[0];
+    for (unsigned long long i = 0; i < steps; i++)
+    {
+        cursor = *cursor;
+    }
+    printf("payload_runtime_ns=%llu\n", (unsigned long long)(monotonic_ns() - start_ns));
+    /* keeps the chain walk from being optimized away */
+    printf("payload_end=%p\n", (void *)cursor);
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+/**********
+ * Name: stream
+ * Description: STREAM style triad a = b + s * c over arrays larger than the
+ * caches, a bandwidth bound payload whose loads the hardware prefetchers can
+ * predict, in contrast to pointer_chase.
+ * ********/
+
+#define DEFAULT_ARRAY_MB 64
+#define DEFAULT_REPEATS 20
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    size_t array_mb = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ARRAY_MB;
+    unsigned int repeats = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_REPEATS;
+    size_t n = array_mb * 1024 * 1024 / sizeof(double);
+    double *a = malloc(n * sizeof(double));
+    double *b = malloc(n * sizeof(double));
+    double *c = malloc(n * sizeof(double));
+    double scalar = 3.0;
+    uint64_t start_ns;
+
+    if (n == 0 || repeats == 0)
+    {
+        printf("Usage: %s [array MB (default %d)] [repeats (default %d)]\n", argv[0], DEFAULT_ARRAY_MB, DEFAULT_REPEATS);
+        return -1;
+    }
+    if (a == NULL || b == NULL || c == NULL)
+    {
+        perror("Could not allocate the arrays");
+        return -1;
+    }
+    /* touch every page before timing */
+    for (size_t i = 0; i < n; i++)
+    {
+        a[i] = 0.0;
+        b[i] = 1.0;
+        c[i] = 2.0;
+    }
+
+    start_ns = monotonic_ns();
+    for (unsigned int r = 0; r < repeats; r++)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            a[i] = b[i] + scalar * c[i];
+        }
+    }
+    printf("payload_runtime_ns=%llu\n", (unsigned long long)(monotonic_ns() - start_ns));
+    printf("payload_bytes=%llu\n", (unsigned long long)repeats * n * 3 * sizeof(double));
+    printf("payload_check=%g\n", a[n / 2]);
+    free(a);
+    free(b);
+    free(c);
+    return 0;
+}
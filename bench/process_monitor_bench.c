@@ -0,0 +1,565 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/**********
+ * Name: process_monitor_bench
+ * Description: overhead and jitter suite of the monitor. Runs the bundled
+ * payloads on their own and under process_monitor, and reads the overhead
+ * file every monitored run leaves behind:
+ *  - perturbation: payload runtime with and without the monitor
+ *  - jitter: lateness of the samples against their deadlines
+ *  - cost: time of one counter read and CPU time of the monitor
+ *  - scaling: samples per second and deadlines missed as targets are added
+ * Every result is one CSV row suite,payload,targets,metric,value on stdout
+ * or in the file given with --output, so runs can be compared over time.
+ * ********/
+
+#ifndef PROCESS_MONITOR_PATH
+#define PROCESS_MONITOR_PATH "./process_monitor"
+#endif
+#ifndef PAYLOAD_DIR
+#define PAYLOAD_DIR "."
+#endif
+
+#define DEFAULT_RUNS 5
+#define DEFAULT_MAX_TARGETS 16
+#define DEFAULT_INTERVAL_MS 10
+
+/* iterations of the scaling payload, long enough to see a few hundred ticks */
+#define SCALING_ITERATIONS "500000000"
+
+#define MAX_ARGS 256
+#define MAX_OVERHEAD_METRICS 64
+#define MAX_RUNS 64
+
+struct payload
+{
+    const char *name;
+    /* arguments after the executable, NULL terminated */
+    const char *args[4];
+};
+
+typedef struct payload payload;
+
+static const payload payloads[] = {
+    {"instructionloop", {"400000000", NULL}},
+    {"pointer_chase", {"256", "10000000", NULL}},
+    {"stream", {"64", "10", NULL}},
+};
+
+#define NR_PAYLOADS (sizeof(payloads) / sizeof(payloads[0]))
+
+/* metric,value rows of the overhead file of one run */
+struct overhead_file
+{
+    unsigned int nr_metrics;
+    char names[MAX_OVERHEAD_METRICS][64];
+    double values[MAX_OVERHEAD_METRICS];
+};
+
+typedef struct overhead_file overhead_file;
+
+struct bench_config
+{
+    const char *monitor_path;
+    const char *payload_dir;
+    unsigned int runs;
+    unsigned int max_targets;
+    unsigned int interval_ms;
+    /* options passed through to every monitor run */
+    char **monitor_args;
+    int nr_monitor_args;
+    FILE *results;
+    char work_dir[64];
+};
+
+typedef struct bench_config bench_config;
+
+static void print_help(void)
+{
+    printf("***** Process monitor benchmark *****\n");
+    printf("Usage: ./process_monitor_bench [options] [-- monitor options]\n");
+    printf("Options: \n");
+    printf(" --monitor <path> \t\t: process_monitor executable (default %s) \n", PROCESS_MONITOR_PATH);
+    printf(" --payloads <dir> \t\t: directory of the payload executables (default %s) \n", PAYLOAD_DIR);
+    printf(" --runs <n> \t\t\t: runs per payload and mode, the median is reported (default %d) \n", DEFAULT_RUNS);
+    printf(" --max-targets <n> \t\t: largest number of monitored processes in the scaling suite (default %d) \n", DEFAULT_MAX_TARGETS);
+    printf(" --interval <ms> \t\t: sampling interval of the monitor (default %d) \n", DEFAULT_INTERVAL_MS);
+    printf(" --output <path> \t\t: write the CSV results to a file instead of stdout \n");
+    printf("Monitor options after -- are passed to every monitored run, e.g. -- --backend perf -e instructions,cycles\n");
+}
+
+static void result(const bench_config *config, const char *suite, const char *name, unsigned int nr_targets,
+                   const char *metric, double value)
+{
+    fprintf(config->results, "%s,%s,%u,%s,%.6g\n", suite, name, nr_targets, metric, value);
+    fflush(config->results);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double median(double *values, unsigned int count)
+{
+    qsort(values, count, sizeof(double), compare_double);
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+/* looks for "payload_runtime_ns=" at the start of every line the process prints */
+static void scan_output(const char *line, uint64_t *payload_runtime_ns)
+{
+    const char *key = "payload_runtime_ns=";
+
+    if (strncmp(line, key, strlen(key)) == 0)
+    {
+        *payload_runtime_ns = strtoull(line + strlen(key), NULL, 10);
+    }
+}
+
+/* runs argv in the work directory and waits for it, returns its exit status or -1 */
+static int run_process(const bench_config *config, char **argv, uint64_t *payload_runtime_ns)
+{
+    char buffer[4096];
+    size_t used = 0;
+    int pipe_fds[2];
+    int status;
+    pid_t pid;
+
+    *payload_runtime_ns = 0;
+    if (pipe(pipe_fds) != 0)
+    {
+        perror("pipe");
+        return -1;
+    }
+    pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return -1;
+    }
+    if (pid == 0)
+    {
+        dup2(pipe_fds[1], STDOUT_FILENO);
+        dup2(pipe_fds[1], STDERR_FILENO);
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        if (chdir(config->work_dir) != 0)
+        {
+            _exit(127);
+        }
+        execv(argv[0], argv);
+        printf("ERROR: could not execute %s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+    close(pipe_fds[1]);
+
+    /* line by line, a line longer than the buffer is cut */
+    for (;;)
+    {
+        ssize_t nr_read = read(pipe_fds[0], buffer + used, sizeof(buffer) - 1 - used);
+        char *line = buffer;
+        char *end;
+
+        if (nr_read < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (nr_read <= 0)
+        {
+            break;
+        }
+        used += nr_read;
+        buffer[used] = '\0';
+        while ((end = strchr(line, '\n')) != NULL)
+        {
+            *end = '\0';
+            scan_output(line, payload_runtime_ns);
+            line = end + 1;
+        }
+        used -= line - buffer;
+        memmove(buffer, line, used);
+        if (used == sizeof(buffer) - 1)
+        {
+            used = 0;
+        }
+    }
+    close(pipe_fds[0]);
+
+    while (waitpid(pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+        {
+            perror("waitpid");
+            return -1;
+        }
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/* removes the output and overhead files of the previous run */
+static void clean_work_dir(const bench_config *config)
+{
+    DIR *dir = opendir(config->work_dir);
+    struct dirent *entry;
+
+    while (dir != NULL && (entry = readdir(dir)) != NULL)
+    {
+        char path[sizeof(config->work_dir) + 256 + 2];
+
+        if (entry->d_name[0] != '.')
+        {
+            snprintf(path, sizeof(path), "%s/%s", config->work_dir, entry->d_name);
+            unlink(path);
+        }
+    }
+    if (dir != NULL)
+    {
+        closedir(dir);
+    }
+}
+
+static int read_overhead_file(const char *path, overhead_file *overhead)
+{
+    FILE *fp = fopen(path, "r");
+    char line[128];
+
+    if (fp == NULL)
+    {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL && overhead->nr_metrics < MAX_OVERHEAD_METRICS)
+    {
+        char *comma = strchr(line, ',');
+
+        if (comma == NULL || strncmp(line, "metric,", 7) == 0)
+        {
+            continue;
+        }
+        *comma = '\0';
+        snprintf(overhead->names[overhead->nr_metrics], sizeof(overhead->names[0]), "%.*s",
+                 (int)sizeof(overhead->names[0]) - 1, line);
+        overhead->values[overhead->nr_metrics++] = strtod(comma + 1, NULL);
+    }
+    fclose(fp);
+    return 0;
+}
+
+/* reads the overhead file a monitor run left in the work directory, then empties it */
+static int collect_overhead_file(const bench_config *config, overhead_file *overhead)
+{
+    DIR *dir = opendir(config->work_dir);
+    struct dirent *entry;
+    int found = 0;
+
+    overhead->nr_metrics = 0;
+    if (dir == NULL)
+    {
+        perror("Could not open the work directory");
+        return -1;
+    }
+    while (!found && (entry = readdir(dir)) != NULL)
+    {
+        char path[sizeof(config->work_dir) + 256 + 2];
+
+        if (strstr(entry->d_name, "overhead.csv") != NULL)
+        {
+            snprintf(path, sizeof(path), "%s/%s", config->work_dir, entry->d_name);
+            found = read_overhead_file(path, overhead) == 0;
+        }
+    }
+    closedir(dir);
+    clean_work_dir(config);
+    if (!found)
+    {
+        printf("ERROR: the monitor wrote no overhead file\n");
+        return -1;
+    }
+    return 0;
+}
+
+static double overhead_value(const overhead_file *overhead, const char *name)
+{
+    for (unsigned int i = 0; i < overhead->nr_metrics; i++)
+    {
+        if (strcmp(overhead->names[i], name) == 0)
+        {
+            return overhead->values[i];
+        }
+    }
+    return 0.0;
+}
+
+/* process_monitor and its options, the caller adds --cmd targets and then the positionals */
+static int monitor_options(const bench_config *config, char **argv)
+{
+    int argc = 0;
+
+    argv[argc++] = (char *)config->monitor_path;
+    /* console output is not measured, print as little as possible */
+    argv[argc++] = "--print-interval";
+    argv[argc++] = "3600000";
+    for (int i = 0; i < config->nr_monitor_args && argc < MAX_ARGS / 2; i++)
+    {
+        argv[argc++] = config->monitor_args[i];
+    }
+    return argc;
+}
+
+/* until every target exits, at the configured interval, writing the output and overhead files */
+static int monitor_positionals(char **argv, int argc, char *interval, const bench_config *config)
+{
+    snprintf(interval, 16, "%u", config->interval_ms);
+    argv[argc++] = "0";
+    argv[argc++] = interval;
+    argv[argc++] = "0";
+    return argc;
+}
+
+static void payload_path(const bench_config *config, const char *name, char *path, size_t size)
+{
+    snprintf(path, size, "%s/%s", config->payload_dir, name);
+}
+
+/* runtime of every payload alone and under the monitor, plus the jitter and cost of those runs */
+static int perturbation_suite(const bench_config *config)
+{
+    for (size_t p = 0; p < NR_PAYLOADS; p++)
+    {
+        const payload *payload = &payloads[p];
+        char path[512];
+        char interval[16];
+        char *argv[MAX_ARGS];
+        int argc = 0;
+        double alone[MAX_RUNS], monitored[MAX_RUNS], lateness_p99[MAX_RUNS], lateness_max[MAX_RUNS];
+        double read_mean[MAX_RUNS], read_p99[MAX_RUNS], monitor_cpu[MAX_RUNS];
+        double missed = 0;
+        uint64_t runtime_ns;
+
+        payload_path(config, payload->name, path, sizeof(path));
+        argv[argc++] = path;
+        for (int a = 0; payload->args[a] != NULL; a++)
+        {
+            argv[argc++] = (char *)payload->args[a];
+        }
+        argv[argc] = NULL;
+        for (unsigned int r = 0; r < config->runs; r++)
+        {
+            if (run_process(config, argv, &runtime_ns) != 0 || runtime_ns == 0)
+            {
+                printf("ERROR: payload %s failed\n", path);
+                return -1;
+            }
+            alone[r] = runtime_ns;
+        }
+
+        argc = monitor_options(config, argv);
+        argc = monitor_positionals(argv, argc, interval, config);
+        argv[argc++] = path;
+        for (int a = 0; payload->args[a] != NULL; a++)
+        {
+            argv[argc++] = (char *)payload->args[a];
+        }
+        argv[argc] = NULL;
+        for (unsigned int r = 0; r < config->runs; r++)
+        {
+            overhead_file overhead;
+
+            if (run_process(config, argv, &runtime_ns) != 0 || runtime_ns == 0 ||
+                collect_overhead_file(config, &overhead) != 0)
+            {
+                printf("ERROR: monitored run of %s failed\n", path);
+                return -1;
+            }
+            monitored[r] = runtime_ns;
+            lateness_p99[r] = overhead_value(&overhead, "lateness_p99_ns");
+            lateness_max[r] = overhead_value(&overhead, "lateness_max_ns");
+            read_mean[r] = overhead_value(&overhead, "read_latency_mean_ns");
+            read_p99[r] = overhead_value(&overhead, "read_latency_p99_ns");
+            monitor_cpu[r] = overhead_value(&overhead, "cpu_user_s") + overhead_value(&overhead, "cpu_system_s");
+            missed += overhead_value(&overhead, "missed_deadlines");
+        }
+
+        double runtime_alone = median(alone, config->runs);
+        double runtime_monitored = median(monitored, config->runs);
+
+        result(config, "perturbation", payload->name, 1, "runtime_alone_ns", runtime_alone);
+        result(config, "perturbation", payload->name, 1, "runtime_monitored_ns", runtime_monitored);
+        result(config, "perturbation", payload->name, 1, "slowdown_percent", 100.0 * (runtime_monitored - runtime_alone) / runtime_alone);
+        result(config, "jitter", payload->name, 1, "lateness_p99_ns", median(lateness_p99, config->runs));
+        result(config, "jitter", payload->name, 1, "lateness_max_ns", median(lateness_max, config->runs));
+        result(config, "jitter", payload->name, 1, "missed_deadlines", missed / config->runs);
+        result(config, "cost", payload->name, 1, "read_latency_mean_ns", median(read_mean, config->runs));
+        result(config, "cost", payload->name, 1, "read_latency_p99_ns", median(read_p99, config->runs));
+        result(config, "cost", payload->name, 1, "monitor_cpu_s", median(monitor_cpu, config->runs));
+    }
+    return 0;
+}
+
+/* one monitor over 1, 2, 4 ... max_targets copies of the instruction loop */
+static int scaling_suite(const bench_config *config)
+{
+    char path[512];
+    char command[600];
+
+    payload_path(config, "instructionloop", path, sizeof(path));
+    snprintf(command, sizeof(command), "%s %s", path, SCALING_ITERATIONS);
+
+    for (unsigned int nr_targets = 1; nr_targets <= config->max_targets; nr_targets *= 2)
+    {
+        char interval[16];
+        char *argv[MAX_ARGS];
+        int argc = monitor_options(config, argv);
+        overhead_file overhead;
+        uint64_t runtime_ns;
+        double wall_s;
+
+        for (unsigned int t = 0; t < nr_targets && argc < MAX_ARGS - 8; t++)
+        {
+            argv[argc++] = "--cmd";
+            argv[argc++] = command;
+        }
+        argc = monitor_positionals(argv, argc, interval, config);
+        argv[argc] = NULL;
+
+        if (run_process(config, argv, &runtime_ns) != 0 || collect_overhead_file(config, &overhead) != 0)
+        {
+            printf("ERROR: monitored run with %u targets failed\n", nr_targets);
+            return -1;
+        }
+        wall_s = overhead_value(&overhead, "wall_s");
+        result(config, "scaling", "instructionloop", nr_targets, "samples_per_s",
+               wall_s > 0 ? overhead_value(&overhead, "records_written") / wall_s : 0.0);
+        result(config, "scaling", "instructionloop", nr_targets, "read_latency_p99_ns", overhead_value(&overhead, "read_latency_p99_ns"));
+        result(config, "scaling", "instructionloop", nr_targets, "lateness_p99_ns", overhead_value(&overhead, "lateness_p99_ns"));
+        result(config, "scaling", "instructionloop", nr_targets, "missed_deadlines", overhead_value(&overhead, "missed_deadlines"));
+        result(config, "scaling", "instructionloop", nr_targets, "monitor_cpu_percent",
+               wall_s > 0 ? 100.0 * (overhead_value(&overhead, "cpu_user_s") + overhead_value(&overhead, "cpu_system_s")) / wall_s : 0.0);
+        result(config, "scaling", "instructionloop", nr_targets, "dropped_samples", overhead_value(&overhead, "dropped_samples"));
+    }
+    return 0;
+}
+
+enum bench_option
+{
+    OPT_MONITOR = 256,
+    OPT_PAYLOADS,
+    OPT_RUNS,
+    OPT_MAX_TARGETS,
+    OPT_INTERVAL,
+    OPT_OUTPUT
+};
+
+int main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        {"monitor", required_argument, NULL, OPT_MONITOR},
+        {"payloads", required_argument, NULL, OPT_PAYLOADS},
+        {"runs", required_argument, NULL, OPT_RUNS},
+        {"max-targets", required_argument, NULL, OPT_MAX_TARGETS},
+        {"interval", required_argument, NULL, OPT_INTERVAL},
+        {"output", required_argument, NULL, OPT_OUTPUT},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    bench_config config;
+    int option;
+    int return_code = 0;
+
+    memset(&config, 0, sizeof(config));
+    config.monitor_path = PROCESS_MONITOR_PATH;
+    config.payload_dir = PAYLOAD_DIR;
+    config.runs = DEFAULT_RUNS;
+    config.max_targets = DEFAULT_MAX_TARGETS;
+    config.interval_ms = DEFAULT_INTERVAL_MS;
+    config.results = stdout;
+
+    while ((option = getopt_long(argc, argv, "h", long_options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case OPT_MONITOR:
+            config.monitor_path = optarg;
+            break;
+        case OPT_PAYLOADS:
+            config.payload_dir = optarg;
+            break;
+        case OPT_RUNS:
+            config.runs = atoi(optarg);
+            break;
+        case OPT_MAX_TARGETS:
+            config.max_targets = atoi(optarg);
+            break;
+        case OPT_INTERVAL:
+            config.interval_ms = atoi(optarg);
+            break;
+        case OPT_OUTPUT:
+            config.results = fopen(optarg, "w");
+            if (config.results == NULL)
+            {
+                printf("ERROR: could not create %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'h':
+            print_help();
+            return 0;
+        default:
+            print_help();
+            return -1;
+        }
+    }
+    config.monitor_args = argv + optind;
+    config.nr_monitor_args = argc - optind;
+    if (config.runs == 0 || config.runs > MAX_RUNS || config.max_targets == 0 || config.interval_ms == 0)
+    {
+        printf("ERROR: runs must be between 1 and %d, max targets and interval above 0\n", MAX_RUNS);
+        return -1;
+    }
+
+    /* runs start in the work directory, relative paths would no longer resolve */
+    config.monitor_path = realpath(config.monitor_path, NULL);
+    config.payload_dir = realpath(config.payload_dir, NULL);
+    if (config.monitor_path == NULL || config.payload_dir == NULL)
+    {
+        printf("ERROR: monitor or payload directory not found, see --monitor and --payloads\n");
+        return -1;
+    }
+
+    /* the monitor writes its files into the current directory, give it one of its own */
+    strcpy(config.work_dir, "/tmp/process_monitor_bench.XXXXXX");
+    if (mkdtemp(config.work_dir) == NULL)
+    {
+        perror("Could not create a work directory");
+        return -1;
+    }
+
+    fprintf(config.results, "suite,payload,targets,metric,value\n");
+    if (perturbation_suite(&config) != 0 || scaling_suite(&config) != 0)
+    {
+        return_code = -1;
+    }
+
+    clean_work_dir(&config);
+    rmdir(config.work_dir);
+    if (config.results != stdout)
+    {
+        fclose(config.results);
+    }
+    return return_code;
+}
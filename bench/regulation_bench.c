@@ -0,0 +1,182 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "counter_backend.h"
+#include "regulator.h"
+#include "scheduler.h"
+
+/**********
+ * Name: regulation_bench
+ * Description: control-loop latency of the regulation mode. A spinning child
+ * is counted with the perf backend and regulated with a budget of one
+ * event, so every period alternates between throttling it and letting it
+ * go. Each period takes the same steps as a sampler: read the counters,
+ * then regulator_update(). The report gives the time of the read, the time
+ * until the throttle call returned, and with signals the time until the
+ * child is seen stopped or running again, all measured from the period end.
+ * ********/
+
+#define DEFAULT_PERIODS 2000
+#define DEFAULT_PERIOD_US 1000
+#define DEFAULT_EVENT "task-clock"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void print_row(const char *step, uint64_t *latencies, unsigned int count)
+{
+    if (count == 0)
+    {
+        printf("%s\t-\n", step);
+        return;
+    }
+    qsort(latencies, count, sizeof(uint64_t), compare_u64);
+    printf("%s\t%u\t%.2f\t\t%.2f\t\t%.2f\n", step, count, latencies[count / 2] / 1000.0,
+           latencies[count * 99 / 100] / 1000.0, latencies[count - 1] / 1000.0);
+}
+
+/* waits until the child has stopped or continued, as the period's decision asked */
+static int wait_for_effect(pid_t pid, uint32_t throttle)
+{
+    siginfo_t info;
+    int options = throttle == THROTTLE_STOPPED ? WSTOPPED : WCONTINUED;
+
+    memset(&info, 0, sizeof(info));
+    return waitid(P_PID, pid, &info, options);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int periods = argc > 1 ? atoi(argv[1]) : DEFAULT_PERIODS;
+    unsigned int period_us = argc > 2 ? atoi(argv[2]) : DEFAULT_PERIOD_US;
+    const char *throttle = argc > 3 ? argv[3] : "signal";
+    enum throttle_method method = strcmp(throttle, "signal") == 0 ? THROTTLE_SIGNAL : THROTTLE_CGROUP;
+    PAPI_event event = {0, DEFAULT_EVENT};
+    counter_backend *backend = NULL;
+    regulator *regulator = NULL;
+    uint64_t *reads = malloc(periods * sizeof(uint64_t));
+    uint64_t *decisions = malloc(periods * sizeof(uint64_t));
+    uint64_t *stops = malloc(periods * sizeof(uint64_t));
+    uint64_t *resumes = malloc(periods * sizeof(uint64_t));
+    unsigned int nr_stops = 0;
+    unsigned int nr_resumes = 0;
+    struct timespec sleep_time;
+    sample_record record;
+    int return_code = 0;
+    int pidfd;
+    pid_t pid;
+
+    if (argc > 4 || periods == 0 || period_us == 0 || reads == NULL || decisions == NULL || stops == NULL || resumes == NULL ||
+        (method == THROTTLE_CGROUP && strncmp(throttle, "cgroup:", strlen("cgroup:")) != 0))
+    {
+        printf("Usage: %s [periods (default %d)] [period us (default %d)] [signal|cgroup:<dir> (default signal)]\n",
+               argv[0], DEFAULT_PERIODS, DEFAULT_PERIOD_US);
+        return -1;
+    }
+
+    pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0)
+    {
+        for (;;)
+        {
+        }
+    }
+
+    pidfd = syscall(SYS_pidfd_open, pid, 0);
+    backend = perf_backend_create();
+    regulator = regulator_create(method, method == THROTTLE_CGROUP ? throttle + strlen("cgroup:") : NULL, 0, 1);
+    if (backend == NULL || regulator == NULL || backend->init(backend, &event, 1) != 0 ||
+        backend->attach(backend, pid) != 0 || backend->start(backend) != 0 || regulator_attach(regulator, pid, pidfd) != 0)
+    {
+        return_code = -1;
+    }
+
+    sleep_time.tv_sec = period_us / 1000000;
+    sleep_time.tv_nsec = (period_us % 1000000) * 1000L;
+    for (unsigned int i = 0; return_code == 0 && i < periods; i++)
+    {
+        uint64_t period_end_ns;
+
+        nanosleep(&sleep_time, NULL);
+        period_end_ns = monotonic_ns();
+        if (backend->read(backend, &record) != 0)
+        {
+            return_code = -1;
+            break;
+        }
+        reads[i] = monotonic_ns() - period_end_ns;
+        regulator_update(regulator, &record, period_end_ns);
+        decisions[i] = monotonic_ns() - period_end_ns;
+        if (method != THROTTLE_SIGNAL || record.throttle == THROTTLE_NONE)
+        {
+            continue;
+        }
+        if (wait_for_effect(pid, record.throttle) != 0)
+        {
+            perror("waitid");
+            return_code = -1;
+            break;
+        }
+        if (record.throttle == THROTTLE_STOPPED)
+        {
+            stops[nr_stops++] = monotonic_ns() - period_end_ns;
+        }
+        else
+        {
+            resumes[nr_resumes++] = monotonic_ns() - period_end_ns;
+        }
+    }
+
+    if (return_code == 0)
+    {
+        printf("throttle with %s, %u periods of %u us, %llu throttled\n", throttle, periods, period_us,
+               (unsigned long long)regulator->nr_throttled);
+        printf("step\t\tcount\tp50 us\t\tp99 us\t\tmax us\n");
+        print_row("read\t", reads, periods);
+        print_row("read+throttle", decisions, periods);
+        print_row("stopped\t", stops, nr_stops);
+        print_row("running\t", resumes, nr_resumes);
+    }
+
+    if (regulator != NULL)
+    {
+        regulator_release(regulator);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    if (backend != NULL)
+    {
+        backend->destroy(backend);
+    }
+    regulator_destroy(regulator, 0);
+    if (pidfd >= 0)
+    {
+        close(pidfd);
+    }
+    free(reads);
+    free(decisions);
+    free(stops);
+    free(resumes);
+    return return_code;
+}
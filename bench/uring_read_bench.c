@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "counter_backend.h"
+#include "scheduler.h"
+#include "uring_reader.h"
+
+/**********
+ * Name: uring_read_bench
+ * Description: compares one read() per event group with a batch issued through
+ * io_uring, the two ways a sampler can read its targets on a tick. For a
+ * growing number of targets, every one an idle child process with its own
+ * perf event group, it reports the syscalls and the latency of a tick.
+ * ********/
+
+#define DEFAULT_MAX_TARGETS 512
+#define DEFAULT_TICKS 2000
+#define DEFAULT_EVENTS "task-clock,page-faults"
+
+struct bench_target
+{
+    pid_t pid;
+    counter_backend *backend;
+    sample_record record;
+};
+
+typedef struct bench_target bench_target;
+
+static int batch_failed;
+
+static void count_failure(void *context, uint64_t user_data, int result)
+{
+    (void)context;
+    if (result != (int)user_data)
+    {
+        batch_failed = 1;
+    }
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int read_loop_tick(bench_target *targets, unsigned int nr_targets, unsigned long long *syscalls)
+{
+    for (unsigned int t = 0; t < nr_targets; t++)
+    {
+        counter_read reads[MAX_COUNTERS];
+        int nr_reads = targets[t].backend->read_requests(targets[t].backend, reads);
+
+        /* the same reads perf_backend's read() does */
+        for (int i = 0; i < nr_reads; i++)
+        {
+            if (read(reads[i].fd, reads[i].buffer, reads[i].size) != (ssize_t)reads[i].size)
+            {
+                return -1;
+            }
+        }
+        *syscalls += nr_reads;
+        targets[t].backend->read_complete(targets[t].backend, &targets[t].record);
+    }
+    return 0;
+}
+
+static int uring_tick(uring_reader *reader, bench_target *targets, unsigned int nr_targets)
+{
+    for (unsigned int t = 0; t < nr_targets; t++)
+    {
+        counter_read reads[MAX_COUNTERS];
+        int nr_reads = targets[t].backend->read_requests(targets[t].backend, reads);
+
+        for (int i = 0; i < nr_reads; i++)
+        {
+            if (uring_reader_queue(reader, reads[i].fd, reads[i].buffer, reads[i].size, reads[i].size) != 0)
+            {
+                return -1;
+            }
+        }
+    }
+    if (uring_reader_submit(reader) != 0 || batch_failed)
+    {
+        return -1;
+    }
+    for (unsigned int t = 0; t < nr_targets; t++)
+    {
+        targets[t].backend->read_complete(targets[t].backend, &targets[t].record);
+    }
+    return 0;
+}
+
+static void print_row(unsigned int nr_targets, const char *mode, unsigned long long syscalls, uint64_t *latencies, unsigned int ticks)
+{
+    qsort(latencies, ticks, sizeof(uint64_t), compare_u64);
+    printf("%u\t%s\t%.1f\t\t%.2f\t\t%.2f\t\t%.2f\n", nr_targets, mode, (double)syscalls / ticks,
+           latencies[ticks / 2] / 1000.0, latencies[ticks * 99 / 100] / 1000.0, latencies[ticks - 1] / 1000.0);
+}
+
+static int run(bench_target *targets, unsigned int nr_targets, unsigned int ticks, uint64_t *latencies)
+{
+    uring_reader reader;
+    unsigned long long syscalls = 0;
+    counter_read reads[MAX_COUNTERS];
+    unsigned int nr_reads = 0;
+
+    for (unsigned int i = 0; i < ticks; i++)
+    {
+        uint64_t start_ns = monotonic_ns();
+
+        if (read_loop_tick(targets, nr_targets, &syscalls) != 0)
+        {
+            perror("read");
+            return -1;
+        }
+        latencies[i] = monotonic_ns() - start_ns;
+    }
+    print_row(nr_targets, "read()", syscalls, latencies, ticks);
+
+    for (unsigned int t = 0; t < nr_targets; t++)
+    {
+        nr_reads += targets[t].backend->read_requests(targets[t].backend, reads);
+    }
+    if (uring_reader_init(&reader, nr_reads, count_failure, NULL) != 0)
+    {
+        return -1;
+    }
+    for (unsigned int i = 0; i < ticks; i++)
+    {
+        uint64_t start_ns = monotonic_ns();
+
+        if (uring_tick(&reader, targets, nr_targets) != 0)
+        {
+            printf("ERROR: batched read failed\n");
+            uring_reader_destroy(&reader);
+            return -1;
+        }
+        latencies[i] = monotonic_ns() - start_ns;
+    }
+    print_row(nr_targets, "io_uring", reader.nr_enter_calls, latencies, ticks);
+    uring_reader_destroy(&reader);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int max_targets = argc > 1 ? atoi(argv[1]) : DEFAULT_MAX_TARGETS;
+    unsigned int ticks = argc > 2 ? atoi(argv[2]) : DEFAULT_TICKS;
+    char *spec = strdup(argc > 3 ? argv[3] : DEFAULT_EVENTS);
+    PAPI_event events[MAX_COUNTERS];
+    unsigned int nr_events = 0;
+    bench_target *targets = calloc(max_targets, sizeof(bench_target));
+    uint64_t *latencies = malloc(ticks * sizeof(uint64_t));
+    unsigned int nr_started = 0;
+    int return_code = 0;
+
+    if (argc > 4 || max_targets == 0 || ticks == 0 || spec == NULL || targets == NULL || latencies == NULL)
+    {
+        printf("Usage: %s [max targets (default %d)] [ticks (default %d)] [events (default %s)]\n",
+               argv[0], DEFAULT_MAX_TARGETS, DEFAULT_TICKS, DEFAULT_EVENTS);
+        return -1;
+    }
+    for (char *name = strtok(spec, ","); name != NULL && nr_events < MAX_COUNTERS; name = strtok(NULL, ","))
+    {
+        events[nr_events].event = 0;
+        events[nr_events].event_name = name;
+        nr_events++;
+    }
+
+    for (; nr_started < max_targets; nr_started++)
+    {
+        bench_target *target = &targets[nr_started];
+
+        target->pid = fork();
+        if (target->pid < 0)
+        {
+            perror("fork");
+            return_code = -1;
+            break;
+        }
+        if (target->pid == 0)
+        {
+            pause();
+            _exit(0);
+        }
+        target->backend = perf_backend_create();
+        if (target->backend == NULL || target->backend->init(target->backend, events, nr_events) != 0 ||
+            target->backend->attach(target->backend, target->pid) != 0 || target->backend->start(target->backend) != 0)
+        {
+            nr_started++;
+            return_code = -1;
+            break;
+        }
+    }
+
+    if (return_code == 0)
+    {
+        printf("targets\tmode\t\tsyscalls/tick\tp50 tick us\tp99 tick us\tmax tick us\n");
+        for (unsigned int nr_targets = 1; nr_targets <= max_targets; nr_targets *= 2)
+        {
+            if (run(targets, nr_targets, ticks, latencies) != 0)
+            {
+                return_code = -1;
+                break;
+            }
+        }
+    }
+
+    for (unsigned int t = 0; t < nr_started; t++)
+    {
+        if (targets[t].backend != NULL)
+        {
+            targets[t].backend->destroy(targets[t].backend);
+        }
+        kill(targets[t].pid, SIGKILL);
+        waitpid(targets[t].pid, NULL, 0);
+    }
+    free(targets);
+    free(latencies);
+    free(spec);
+    return return_code;
+}
@@ -0,0 +1,27 @@
+#include <string.h>
+#include "counter_backend.h"
+
+counter_backend *counter_backend_create(const char *name)
+{
+    if (strcmp(name, "papi") == 0)
+    {
+        return papi_backend_create();
+    }
+    if (strcmp(name, "perf") == 0)
+    {
+        return perf_backend_create();
+    }
+    if (strcmp(name, "synthetic") == 0)
+    {
+        return synthetic_backend_create();
+    }
+    if (strcmp(name, "agent") == 0)
+    {
+        return agent_backend_create();
+    }
+    if (strncmp(name, "replay:", strlen("replay:")) == 0)
+    {
+        return replay_backend_create(name + strlen("replay:"));
+    }
+    return NULL;
+}
@@ -0,0 +1,83 @@
+#ifndef COUNTER_BACKEND_H
+#define COUNTER_BACKEND_H
+
+#include <sys/types.h>
+#include "events.h"
+#include "sample.h"
+
+/**********
+ * Name: counter_backend
+ * Description: source of counter values for the sampling loop. read() fills
+ * values, time_enabled_ns and time_running_ns of the record with the deltas
+ * since the previous read (or since start) and the coverage of every event,
+ * the fraction of the interval it was actually counted.
+ * Every callback returns 0 on success and -1 on failure after printing the reason;
+ * read() of a recorded source returns 1 once it has no more samples.
+ * ********/
+
+typedef struct counter_backend counter_backend;
+
+/* one read() of a counter fd */
+struct counter_read
+{
+    int fd;
+    void *buffer;
+    size_t size;
+};
+
+typedef struct counter_read counter_read;
+
+struct counter_backend
+{
+    const char *name;
+    /* set before init() to spread more events than hardware counters over time */
+    int multiplex;
+    /* set before init() to count only the attached thread, not the threads it creates */
+    int single_thread;
+    /* set before init() when the attached process has not exec'd yet: counting starts at its
+       exec() where the kernel supports it, otherwise start() starts it right away */
+    int enable_on_exec;
+    /* set by the backend when read() fills interval_ns itself, e.g. from a recording */
+    int own_interval;
+    /* set before attach() for backends that take samples on their own, their period */
+    uint64_t sample_period_ns;
+    /* set before attach(): interval between two read()s, 0 if they follow each other without a pause */
+    uint64_t read_period_ns;
+    /* set by the backend: shared library a spawned command has to preload, NULL if none */
+    const char *preload;
+    int (*init)(counter_backend *backend, const PAPI_event *events, unsigned int nr_events);
+    /* optional, instead of init(): takes over the events that init() of template, a backend of the
+       same kind, has already checked. Prints nothing and opens no counters, so the threads a sampler
+       finds can be added on its thread. The flags are set before as for init(). NULL if not supported */
+    int (*init_from)(counter_backend *backend, const counter_backend *template);
+    int (*attach)(counter_backend *backend, pid_t pid);
+    int (*start)(counter_backend *backend);
+    int (*read)(counter_backend *backend, sample_record *record);
+    /* optional split of read() for callers that batch the syscalls: read_requests() lists the
+       at most MAX_COUNTERS reads into reads and returns their number, once the caller has done
+       all of them read_complete() turns the buffers into the record. NULL if not supported */
+    int (*read_requests)(counter_backend *backend, counter_read *reads);
+    int (*read_complete)(counter_backend *backend, sample_record *record);
+    /* optional, the samples the backend took on its own within the interval of the latest read(),
+       one per call with its timestamp_ns and interval_ns; returns 1 when there are no more.
+       NULL if not supported */
+    int (*read_burst)(counter_backend *backend, sample_record *record);
+    int (*stop)(counter_backend *backend);
+    /* releases the counters of the attached process without affecting it */
+    int (*detach)(counter_backend *backend);
+    void (*destroy)(counter_backend *backend);
+    void *priv;
+};
+
+counter_backend *papi_backend_create(void);
+counter_backend *perf_backend_create(void);
+counter_backend *synthetic_backend_create(void);
+/* plays back a CSV or pmcol output file of the monitor */
+counter_backend *replay_backend_create(const char *path);
+/* reads the samples of pm_agent, preloaded into the spawned command */
+counter_backend *agent_backend_create(void);
+
+/* papi, perf, synthetic, agent or replay:<recording>; returns NULL if no backend with the given name exists */
+counter_backend *counter_backend_create(const char *name);
+
+#endif
@@ -0,0 +1,172 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "counter_stats.h"
+
+static unsigned int bucket_index(uint64_t value)
+{
+    unsigned int exponent, shift;
+
+    if (value < HDR_SUB_BUCKETS)
+    {
+        return value;
+    }
+    exponent = 63 - __builtin_clzll(value);
+    shift = exponent - HDR_SUB_BITS;
+    return (shift + 1) * HDR_SUB_BUCKETS + ((value >> shift) & (HDR_SUB_BUCKETS - 1));
+}
+
+/* midpoint of the values that map to the bucket */
+static uint64_t bucket_value(unsigned int index)
+{
+    unsigned int shift;
+
+    if (index < HDR_SUB_BUCKETS)
+    {
+        return index;
+    }
+    shift = index / HDR_SUB_BUCKETS - 1;
+    return ((uint64_t)(HDR_SUB_BUCKETS + index % HDR_SUB_BUCKETS) << shift) + ((1ULL << shift) >> 1);
+}
+
+void counter_stats_init(counter_stats *stats, double scale)
+{
+    memset(stats, 0, sizeof(counter_stats));
+    stats->scale = scale;
+}
+
+/* counts of the group, allocated on first use; NULL if that failed */
+static uint64_t *bucket_group(counter_stats *stats, unsigned int group)
+{
+    if (stats->groups[group] == NULL)
+    {
+        stats->groups[group] = calloc(HDR_SUB_BUCKETS, sizeof(uint64_t));
+    }
+    return stats->groups[group];
+}
+
+void counter_stats_add(counter_stats *stats, double value)
+{
+    double delta = value - stats->mean;
+    double scaled = value * stats->scale;
+    unsigned int index;
+    uint64_t *group;
+
+    if (isnan(value))
+    {
+        return;
+    }
+
+    stats->count++;
+    stats->mean += delta / stats->count;
+    stats->m2 += delta * (value - stats->mean);
+
+    if (stats->count == 1 || value < stats->min)
+    {
+        stats->min = value;
+    }
+    if (stats->count == 1 || value > stats->max)
+    {
+        stats->max = value;
+    }
+    index = bucket_index(scaled < 0 ? 0 : scaled >= 0x1p63 ? INT64_MAX : (uint64_t)scaled);
+    group = bucket_group(stats, index / HDR_SUB_BUCKETS);
+    if (group != NULL)
+    {
+        group[index % HDR_SUB_BUCKETS]++;
+        stats->nr_bucketed++;
+    }
+}
+
+void counter_stats_destroy(counter_stats *stats)
+{
+    for (unsigned int i = 0; i < HDR_NR_GROUPS; i++)
+    {
+        free(stats->groups[i]);
+        stats->groups[i] = NULL;
+    }
+}
+
+void counter_stats_merge(counter_stats *stats, const counter_stats *from)
+{
+    uint64_t count = stats->count + from->count;
+    double delta = from->mean - stats->mean;
+
+    if (from->count == 0)
+    {
+        return;
+    }
+    if (stats->count == 0 || from->min < stats->min)
+    {
+        stats->min = from->min;
+    }
+    if (stats->count == 0 || from->max > stats->max)
+    {
+        stats->max = from->max;
+    }
+    /* Chan et al., the pairwise form of Welford's update */
+    stats->m2 += from->m2 + delta * delta * stats->count * from->count / count;
+    stats->mean += delta * from->count / count;
+    stats->count = count;
+    for (unsigned int i = 0; i < HDR_NR_GROUPS; i++)
+    {
+        uint64_t *group = from->groups[i] != NULL ? bucket_group(stats, i) : NULL;
+
+        for (unsigned int j = 0; group != NULL && j < HDR_SUB_BUCKETS; j++)
+        {
+            group[j] += from->groups[i][j];
+            stats->nr_bucketed += from->groups[i][j];
+        }
+    }
+}
+
+double counter_stats_variance(const counter_stats *stats)
+{
+    return stats->count > 1 ? stats->m2 / (stats->count - 1) : 0.0;
+}
+
+double counter_stats_stddev(const counter_stats *stats)
+{
+    return sqrt(counter_stats_variance(stats));
+}
+
+double counter_stats_percentile(const counter_stats *stats, double percentile)
+{
+    uint64_t target, seen = 0;
+
+    if (stats->count == 0)
+    {
+        return 0;
+    }
+    target = (uint64_t)ceil(percentile / 100.0 * stats->nr_bucketed);
+    if (target == 0)
+    {
+        target = 1;
+    }
+
+    for (unsigned int i = 0; i < HDR_NR_BUCKETS; i++)
+    {
+        if (stats->groups[i / HDR_SUB_BUCKETS] == NULL)
+        {
+            i += HDR_SUB_BUCKETS - 1;
+            continue;
+        }
+        seen += stats->groups[i / HDR_SUB_BUCKETS][i % HDR_SUB_BUCKETS];
+        if (seen >= target)
+        {
+            double value = (double)bucket_value(i) / stats->scale;
+
+            /* the bucket midpoint can lie outside of the observed range */
+            if (value > stats->max)
+            {
+                value = stats->max;
+            }
+            if (value < stats->min)
+            {
+                value = stats->min;
+            }
+            return value;
+        }
+    }
+    return stats->max;
+}
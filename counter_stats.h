@@ -0,0 +1,58 @@
+#ifndef COUNTER_STATS_H
+#define COUNTER_STATS_H
+
+#include <stdint.h>
+
+/* sub-buckets per power of two, values are kept within 1/2^HDR_SUB_BITS relative error */
+#define HDR_SUB_BITS 7
+#define HDR_SUB_BUCKETS (1 << HDR_SUB_BITS)
+/* one group of HDR_SUB_BUCKETS per power of two, the first also holds the values below HDR_SUB_BUCKETS */
+#define HDR_NR_GROUPS (64 - HDR_SUB_BITS + 1)
+#define HDR_NR_BUCKETS (HDR_NR_GROUPS * HDR_SUB_BUCKETS)
+
+/**********
+ * Name: counter_stats
+ * Description: streaming statistics of one series. Mean and variance are kept
+ * with Welford's method, percentiles come from a log-linear (HDR style)
+ * histogram. Every update is O(1) and every query can be made at any point
+ * of the run. The buckets of a power of two are allocated when its first
+ * value arrives, so a series pays for the range it spans: a few KB instead of
+ * the whole 64 bit range. A value whose group could not be allocated is left
+ * out of the percentiles only. The histogram stores value * scale as an
+ * integer, so a scale of 1000 keeps three decimals of fractional series such
+ * as derived metrics. Negative values are counted as 0 in the histogram and
+ * NaN values are ignored.
+ * ********/
+
+struct counter_stats
+{
+    uint64_t count;
+    double mean;
+    double m2;
+    double min;
+    double max;
+    double scale;
+    /* values in the histogram, count less the ones without a group */
+    uint64_t nr_bucketed;
+    /* HDR_SUB_BUCKETS counts each, NULL until the group is used */
+    uint64_t *groups[HDR_NR_GROUPS];
+};
+
+typedef struct counter_stats counter_stats;
+
+void counter_stats_init(counter_stats *stats, double scale);
+void counter_stats_add(counter_stats *stats, double value);
+
+/* frees the buckets, stats can be initialized again */
+void counter_stats_destroy(counter_stats *stats);
+
+/* adds the series of from to stats, both must have the same scale */
+void counter_stats_merge(counter_stats *stats, const counter_stats *from);
+
+double counter_stats_variance(const counter_stats *stats);
+double counter_stats_stddev(const counter_stats *stats);
+
+/* percentile in [0, 100], e.g. 99.9 */
+double counter_stats_percentile(const counter_stats *stats, double percentile);
+
+#endif
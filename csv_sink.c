@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "output_sink.h"
+
+/**********
+ * Name: csv_sink
+ * Description: writes samples as CSV rows, one line per sample. The column line
+ * is written when the sink is opened.
+ * ********/
+
+static int csv_sink_write(output_sink *sink, const sample_record *records, size_t nr_records)
+{
+    FILE *fp = sink->priv;
+    const output_columns *columns = &sink->columns;
+    long start = ftell(fp);
+
+    /* write captured events */
+    for (size_t i = 0; i < nr_records; i++)
+    {
+        const sample_record *record = &records[i];
+
+        if (columns->nr_targets > 1)
+        {
+            fprintf(fp, "%u,", record->target);
+        }
+        if (columns->per_thread)
+        {
+            fprintf(fp, "%d,", record->tid);
+        }
+        if (columns->regions)
+        {
+            fprintf(fp, "%u,%u,", record->region, record->region_changed);
+        }
+        if (columns->regulation)
+        {
+            fprintf(fp, "%u,%.4f,", record->throttle, record->budget_used);
+        }
+        fprintf(fp, "%llu,%llu,%llu,%llu,", (unsigned long long)record->timestamp_ns, (unsigned long long)record->interval_ns,
+                (unsigned long long)record->time_enabled_ns, (unsigned long long)record->time_running_ns);
+        for(size_t j = 0; j < columns->nr_counters; j++)
+        {
+            fprintf(fp, "%llu,", record->values[j]);
+            if (columns->rates)
+            {
+                fprintf(fp, "%.0f,", sample_counter_rate(record, j));
+            }
+            if (columns->coverage)
+            {
+                fprintf(fp, "%.4f,", record->coverage[j]);
+            }
+        }
+        for (size_t j = 0; columns->metrics != NULL && j < columns->metrics->nr_metrics; j++)
+        {
+            fprintf(fp, "%.6g,", record->metrics[j]);
+        }
+        fprintf(fp, "\n");
+    }
+    sink->bytes_written += ftell(fp) - start;
+    return ferror(fp) ? -1 : 0;
+}
+
+static int csv_sink_close(output_sink *sink)
+{
+    return fclose(sink->priv) == 0 ? 0 : -1;
+}
+
+output_sink *csv_sink_open(const char *path, const output_columns *columns)
+{
+    output_sink *sink = calloc(1, sizeof(output_sink));
+    FILE *fp = fopen(path, "w");
+
+    if (sink == NULL || fp == NULL)
+    {
+        perror("Could not open output file");
+        free(sink);
+        if (fp != NULL)
+        {
+            fclose(fp);
+        }
+        return NULL;
+    }
+
+    /* write column line */
+    if (columns->nr_targets > 1)
+    {
+        fprintf(fp, "target,");
+    }
+    if (columns->per_thread)
+    {
+        fprintf(fp, "tid,");
+    }
+    if (columns->regions)
+    {
+        fprintf(fp, "region,region_changed,");
+    }
+    if (columns->regulation)
+    {
+        fprintf(fp, "throttle,budget_used,");
+    }
+    fprintf(fp, "timestamp_ns,interval_ns,time_enabled_ns,time_running_ns,");
+    for (size_t i = 0; i < columns->nr_counters; i++)
+    {
+        fprintf(fp, "%s,", columns->events[i].event_name);
+        if (columns->rates)
+        {
+            fprintf(fp, "%s/s,", columns->events[i].event_name);
+        }
+        if (columns->coverage)
+        {
+            fprintf(fp, "%s:coverage,", columns->events[i].event_name);
+        }
+    }
+    for (size_t i = 0; columns->metrics != NULL && i < columns->metrics->nr_metrics; i++)
+    {
+        fprintf(fp, "%s,", columns->metrics->metrics[i].name);
+    }
+    fprintf(fp, "\n");
+
+    sink->path = path;
+    sink->columns = *columns;
+    sink->bytes_written = ftell(fp);
+    sink->write = csv_sink_write;
+    sink->close = csv_sink_close;
+    sink->priv = fp;
+    return sink;
+}
@@ -0,0 +1,338 @@
+#include <elf.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "elf_symbols.h"
+
+static int compare_symbols(const void *a, const void *b)
+{
+    const elf_symbol *left = a;
+    const elf_symbol *right = b;
+
+    if (left->start != right->start)
+    {
+        return left->start < right->start ? -1 : 1;
+    }
+    /* of aliases keep the sized one first */
+    return left->size > right->size ? -1 : left->size < right->size;
+}
+
+static int in_image(const elf_symbols *elf, uint64_t offset, uint64_t size)
+{
+    return offset <= elf->image_size && size <= elf->image_size - offset;
+}
+
+/* the function symbols of one symbol table section, appended to elf->symbols */
+static int add_symbol_table(elf_symbols *elf, const Elf64_Shdr *sections, unsigned int nr_sections, const Elf64_Shdr *table)
+{
+    const Elf64_Shdr *strings;
+    const Elf64_Sym *symbols;
+    size_t nr_symbols;
+    elf_symbol *grown;
+
+    if (table->sh_link >= nr_sections || table->sh_entsize != sizeof(Elf64_Sym) ||
+        !in_image(elf, table->sh_offset, table->sh_size))
+    {
+        return 0;
+    }
+    strings = &sections[table->sh_link];
+    if (!in_image(elf, strings->sh_offset, strings->sh_size) || strings->sh_size == 0)
+    {
+        return 0;
+    }
+    symbols = (const Elf64_Sym *)((const char *)elf->image + table->sh_offset);
+    nr_symbols = table->sh_size / sizeof(Elf64_Sym);
+
+    grown = realloc(elf->symbols, (elf->nr_symbols + nr_symbols) * sizeof(elf_symbol));
+    if (grown == NULL)
+    {
+        perror("Could not allocate symbols");
+        return -1;
+    }
+    elf->symbols = grown;
+    for (size_t s = 0; s < nr_symbols; s++)
+    {
+        unsigned int type = ELF64_ST_TYPE(symbols[s].st_info);
+
+        if ((type != STT_FUNC && type != STT_GNU_IFUNC) || symbols[s].st_shndx == SHN_UNDEF ||
+            symbols[s].st_value == 0 || symbols[s].st_name >= strings->sh_size)
+        {
+            continue;
+        }
+        elf->symbols[elf->nr_symbols].start = symbols[s].st_value;
+        elf->symbols[elf->nr_symbols].size = symbols[s].st_size;
+        /* symbols without a size, like _init, cover the rest of their section */
+        if (symbols[s].st_size == 0 && symbols[s].st_shndx < nr_sections)
+        {
+            const Elf64_Shdr *section = &sections[symbols[s].st_shndx];
+
+            if (symbols[s].st_value >= section->sh_addr && symbols[s].st_value - section->sh_addr < section->sh_size)
+            {
+                elf->symbols[elf->nr_symbols].size = section->sh_addr + section->sh_size - symbols[s].st_value;
+            }
+        }
+        elf->symbols[elf->nr_symbols].name = (const char *)elf->image + strings->sh_offset + symbols[s].st_name;
+        elf->nr_symbols++;
+    }
+    return 0;
+}
+
+static int load_segments(elf_symbols *elf, const Elf64_Ehdr *header)
+{
+    const Elf64_Phdr *program_headers;
+
+    if (header->e_phentsize != sizeof(Elf64_Phdr) ||
+        !in_image(elf, header->e_phoff, (uint64_t)header->e_phnum * sizeof(Elf64_Phdr)))
+    {
+        return -1;
+    }
+    program_headers = (const Elf64_Phdr *)((const char *)elf->image + header->e_phoff);
+    elf->segments = calloc(header->e_phnum ? header->e_phnum : 1, sizeof(elf_segment));
+    if (elf->segments == NULL)
+    {
+        perror("Could not allocate segments");
+        return -1;
+    }
+    for (unsigned int p = 0; p < header->e_phnum; p++)
+    {
+        if (program_headers[p].p_type != PT_LOAD)
+        {
+            continue;
+        }
+        elf->segments[elf->nr_segments].offset = program_headers[p].p_offset;
+        elf->segments[elf->nr_segments].file_size = program_headers[p].p_filesz;
+        elf->segments[elf->nr_segments].vaddr = program_headers[p].p_vaddr;
+        elf->nr_segments++;
+    }
+    return 0;
+}
+
+static int load_symbols(elf_symbols *elf)
+{
+    const Elf64_Ehdr *header = elf->image;
+    const Elf64_Shdr *sections;
+    const Elf64_Shdr *symtab = NULL;
+    const Elf64_Shdr *dynsym = NULL;
+    size_t kept = 0;
+
+    if (elf->image_size < sizeof(Elf64_Ehdr) || memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 ||
+        header->e_ident[EI_CLASS] != ELFCLASS64 || header->e_ident[EI_DATA] != ELFDATA2LSB)
+    {
+        return -1;
+    }
+    if (load_segments(elf, header) != 0)
+    {
+        return -1;
+    }
+    if (header->e_shentsize != sizeof(Elf64_Shdr) ||
+        !in_image(elf, header->e_shoff, (uint64_t)header->e_shnum * sizeof(Elf64_Shdr)))
+    {
+        return -1;
+    }
+    sections = (const Elf64_Shdr *)((const char *)elf->image + header->e_shoff);
+    for (unsigned int s = 0; s < header->e_shnum; s++)
+    {
+        if (sections[s].sh_type == SHT_SYMTAB)
+        {
+            symtab = &sections[s];
+        }
+        else if (sections[s].sh_type == SHT_DYNSYM)
+        {
+            dynsym = &sections[s];
+        }
+    }
+    /* stripped files only have the exported functions of .dynsym */
+    if (symtab != NULL && add_symbol_table(elf, sections, header->e_shnum, symtab) != 0)
+    {
+        return -1;
+    }
+    if (elf->nr_symbols == 0 && dynsym != NULL && add_symbol_table(elf, sections, header->e_shnum, dynsym) != 0)
+    {
+        return -1;
+    }
+
+    qsort(elf->symbols, elf->nr_symbols, sizeof(elf_symbol), compare_symbols);
+    for (size_t s = 0; s < elf->nr_symbols; s++)
+    {
+        if (kept > 0 && elf->symbols[kept - 1].start == elf->symbols[s].start)
+        {
+            continue;
+        }
+        elf->symbols[kept++] = elf->symbols[s];
+    }
+    elf->nr_symbols = kept;
+    return 0;
+}
+
+static void elf_symbols_free(elf_symbols *elf)
+{
+    if (elf->image != NULL)
+    {
+        munmap(elf->image, elf->image_size);
+    }
+    free(elf->symbols);
+    free(elf->segments);
+    free(elf->path);
+    free(elf);
+}
+
+static elf_symbols *elf_symbols_open(const char *path)
+{
+    elf_symbols *elf = calloc(1, sizeof(elf_symbols));
+    struct stat status;
+    int fd;
+
+    if (elf == NULL || (elf->path = strdup(path)) == NULL)
+    {
+        free(elf);
+        return NULL;
+    }
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        elf_symbols_free(elf);
+        return NULL;
+    }
+    if (fstat(fd, &status) != 0 || !S_ISREG(status.st_mode) || status.st_size == 0)
+    {
+        close(fd);
+        elf_symbols_free(elf);
+        return NULL;
+    }
+    elf->image_size = status.st_size;
+    elf->image = mmap(NULL, elf->image_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (elf->image == MAP_FAILED)
+    {
+        elf->image = NULL;
+        elf_symbols_free(elf);
+        return NULL;
+    }
+    if (load_symbols(elf) != 0)
+    {
+        elf_symbols_free(elf);
+        return NULL;
+    }
+    return elf;
+}
+
+static int append_path(char ***paths, unsigned int *nr_paths, const char *path)
+{
+    char **grown = realloc(*paths, (*nr_paths + 1) * sizeof(char *));
+
+    if (grown == NULL)
+    {
+        return -1;
+    }
+    *paths = grown;
+    if ((grown[*nr_paths] = strdup(path)) == NULL)
+    {
+        return -1;
+    }
+    (*nr_paths)++;
+    return 0;
+}
+
+elf_symbols *symbol_cache_get(symbol_cache *cache, const char *path)
+{
+    elf_symbols *elf;
+    elf_symbols **grown;
+
+    for (unsigned int f = 0; f < cache->nr_files; f++)
+    {
+        if (strcmp(cache->files[f]->path, path) == 0)
+        {
+            return cache->files[f];
+        }
+    }
+    for (unsigned int f = 0; f < cache->nr_failed; f++)
+    {
+        if (strcmp(cache->failed[f], path) == 0)
+        {
+            return NULL;
+        }
+    }
+
+    elf = elf_symbols_open(path);
+    if (elf == NULL)
+    {
+        append_path(&cache->failed, &cache->nr_failed, path);
+        return NULL;
+    }
+    grown = realloc(cache->files, (cache->nr_files + 1) * sizeof(elf_symbols *));
+    if (grown == NULL)
+    {
+        elf_symbols_free(elf);
+        return NULL;
+    }
+    cache->files = grown;
+    cache->files[cache->nr_files++] = elf;
+    return elf;
+}
+
+void symbol_cache_free(symbol_cache *cache)
+{
+    for (unsigned int f = 0; f < cache->nr_files; f++)
+    {
+        elf_symbols_free(cache->files[f]);
+    }
+    for (unsigned int f = 0; f < cache->nr_failed; f++)
+    {
+        free(cache->failed[f]);
+    }
+    free(cache->files);
+    free(cache->failed);
+    memset(cache, 0, sizeof(symbol_cache));
+}
+
+const elf_symbol *elf_symbols_lookup(const elf_symbols *elf, uint64_t file_offset)
+{
+    uint64_t address = 0;
+    int in_segment = 0;
+    size_t low = 0;
+    size_t high = elf->nr_symbols;
+
+    for (unsigned int s = 0; s < elf->nr_segments; s++)
+    {
+        const elf_segment *segment = &elf->segments[s];
+
+        if (file_offset >= segment->offset && file_offset - segment->offset < segment->file_size)
+        {
+            address = file_offset - segment->offset + segment->vaddr;
+            in_segment = 1;
+            break;
+        }
+    }
+    if (!in_segment)
+    {
+        return NULL;
+    }
+
+    /* last symbol starting at or below the address */
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+
+        if (elf->symbols[middle].start <= address)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    if (low == 0)
+    {
+        return NULL;
+    }
+    if (address - elf->symbols[low - 1].start >= elf->symbols[low - 1].size)
+    {
+        return NULL;
+    }
+    return &elf->symbols[low - 1];
+}
@@ -0,0 +1,71 @@
+#ifndef ELF_SYMBOLS_H
+#define ELF_SYMBOLS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**********
+ * Name: elf_symbols
+ * Description: function symbols of one ELF file, for turning sampled
+ * instruction pointers into function names. The file is mapped read-only,
+ * .symtab is used when present and .dynsym otherwise, and the functions are
+ * kept sorted by address so a lookup is a binary search. Lookups take a file
+ * offset, which the PT_LOAD segments translate into the address the symbols
+ * use, so the load address of the mapping does not matter.
+ * A symbol_cache parses every file once and hands out the same table for
+ * every mapping of it. Functions return NULL for files that are missing or
+ * not ELF; symbols are then reported by file name only.
+ * ********/
+
+struct elf_symbol
+{
+    uint64_t start;
+    uint64_t size;
+    /* points into the mapped file */
+    const char *name;
+};
+
+typedef struct elf_symbol elf_symbol;
+
+struct elf_segment
+{
+    uint64_t offset;
+    uint64_t file_size;
+    uint64_t vaddr;
+};
+
+typedef struct elf_segment elf_segment;
+
+struct elf_symbols
+{
+    char *path;
+    void *image;
+    size_t image_size;
+    elf_symbol *symbols;
+    size_t nr_symbols;
+    elf_segment *segments;
+    unsigned int nr_segments;
+};
+
+typedef struct elf_symbols elf_symbols;
+
+struct symbol_cache
+{
+    elf_symbols **files;
+    unsigned int nr_files;
+    /* paths that could not be parsed, not retried */
+    char **failed;
+    unsigned int nr_failed;
+};
+
+typedef struct symbol_cache symbol_cache;
+
+/* the cached table of path, parsed on first use */
+elf_symbols *symbol_cache_get(symbol_cache *cache, const char *path);
+
+void symbol_cache_free(symbol_cache *cache);
+
+/* function containing the byte at file_offset of the file, NULL if none does */
+const elf_symbol *elf_symbols_lookup(const elf_symbols *elf, uint64_t file_offset);
+
+#endif
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "events.h"
+#include "sample.h"
+
+int event_list_add(event_list *list, const char *name)
+{
+    PAPI_event *events;
+
+    if (list->nr_events >= MAX_COUNTERS)
+    {
+        printf("ERROR: too many events, at most %d are supported\n", MAX_COUNTERS);
+        return -1;
+    }
+    for (unsigned int i = 0; i < list->nr_events; i++)
+    {
+        if (strcmp(list->events[i].event_name, name) == 0)
+        {
+            printf("ERROR: event %s is listed twice\n", name);
+            return -1;
+        }
+    }
+
+    events = realloc(list->events, (list->nr_events + 1) * sizeof(PAPI_event));
+    if (events == NULL)
+    {
+        perror("Could not grow event list");
+        return -1;
+    }
+    list->events = events;
+    list->events[list->nr_events].event = 0;
+    list->events[list->nr_events].event_name = strdup(name);
+    if (list->events[list->nr_events].event_name == NULL)
+    {
+        perror("Could not grow event list");
+        return -1;
+    }
+    list->nr_events++;
+    return 0;
+}
+
+/* trims whitespace in place */
+static char *trim(char *text)
+{
+    char *end;
+
+    while (isspace((unsigned char)*text))
+    {
+        text++;
+    }
+    end = text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1]))
+    {
+        *--end = '\0';
+    }
+    return text;
+}
+
+int event_list_parse(event_list *list, const char *spec)
+{
+    char *copy = strdup(spec);
+    char *saveptr = NULL;
+    int return_code = 0;
+
+    if (copy == NULL)
+    {
+        perror("Could not parse event list");
+        return -1;
+    }
+    for (char *token = strtok_r(copy, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr))
+    {
+        token = trim(token);
+        if (*token != '\0' && event_list_add(list, token) != 0)
+        {
+            return_code = -1;
+            break;
+        }
+    }
+    free(copy);
+    return return_code;
+}
+
+int event_list_load(event_list *list, const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    char line[256];
+
+    if (fp == NULL)
+    {
+        perror("Could not open event file");
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        char *comment = strchr(line, '#');
+        char *name;
+
+        if (comment != NULL)
+        {
+            *comment = '\0';
+        }
+        name = trim(line);
+        if (*name != '\0' && event_list_parse(list, name) != 0)
+        {
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+void event_list_free(event_list *list)
+{
+    for (unsigned int i = 0; i < list->nr_events; i++)
+    {
+        free(list->events[i].event_name);
+    }
+    free(list->events);
+    list->events = NULL;
+    list->nr_events = 0;
+}
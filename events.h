@@ -0,0 +1,37 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+struct PAPI_event
+{
+    int event;
+    char *event_name;
+};
+
+typedef struct PAPI_event PAPI_event;
+
+/**********
+ * Name: event_list
+ * Description: event set chosen at runtime. Only names are stored here, every
+ * counter backend resolves and validates them in its init(). Functions
+ * return 0 on success and -1 after printing the reason.
+ * ********/
+
+struct event_list
+{
+    PAPI_event *events;
+    unsigned int nr_events;
+};
+
+typedef struct event_list event_list;
+
+int event_list_add(event_list *list, const char *name);
+
+/* comma separated list of event names */
+int event_list_parse(event_list *list, const char *spec);
+
+/* one event name per line, '#' starts a comment */
+int event_list_load(event_list *list, const char *path);
+
+void event_list_free(event_list *list);
+
+#endif
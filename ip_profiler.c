@@ -0,0 +1,883 @@
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/perf_event.h>
+#include "ip_profiler.h"
+#include "perf_backend.h"
+
+#define MAX_RECORD_SIZE 65536
+#define UNKNOWN_MODULE "[unknown]"
+
+/* layouts of the records with sample_id_all unset */
+struct sample_event
+{
+    struct perf_event_header header;
+    uint64_t ip;
+    uint32_t pid;
+    uint32_t tid;
+    /* with PERF_SAMPLE_CALLCHAIN, innermost frame first */
+    uint64_t nr_ips;
+    uint64_t ips[];
+};
+
+struct mmap2_event
+{
+    struct perf_event_header header;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t addr;
+    uint64_t len;
+    uint64_t pgoff;
+    uint32_t maj;
+    uint32_t min;
+    uint64_t ino;
+    uint64_t ino_generation;
+    uint32_t prot;
+    uint32_t flags;
+    char filename[];
+};
+
+struct comm_event
+{
+    struct perf_event_header header;
+    uint32_t pid;
+    uint32_t tid;
+    char comm[];
+};
+
+struct lost_event
+{
+    struct perf_event_header header;
+    uint64_t id;
+    uint64_t lost;
+};
+
+/* data pages for the samples of two intervals, see ip_profiler */
+static unsigned int buffer_pages(uint64_t period, int callchain, uint64_t interval_ns, size_t page_size)
+{
+    uint64_t samples = period > 0 ? interval_ns / period + 1 : 1;
+    uint64_t bytes = 2 * samples * (callchain ? PROFILER_CALLCHAIN_SAMPLE_BYTES : PROFILER_SAMPLE_BYTES);
+    unsigned int pages = PROFILER_MIN_BUFFER_PAGES;
+
+    while (pages < PROFILER_MAX_BUFFER_PAGES && (uint64_t)pages * page_size < bytes)
+    {
+        pages *= 2;
+    }
+    return pages;
+}
+
+ip_profiler *ip_profiler_create(const char *event_name, uint64_t period, int callchain, uint64_t interval_ns)
+{
+    ip_profiler *profiler = calloc(1, sizeof(ip_profiler));
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    unsigned int pages = buffer_pages(period, callchain, interval_ns, page_size);
+    uint64_t pending_size = PROFILER_PENDING_SIZE;
+
+    while (pending_size < 2 * (uint64_t)pages * page_size)
+    {
+        pending_size *= 2;
+    }
+    if (profiler == NULL || (profiler->record_copy = malloc(MAX_RECORD_SIZE)) == NULL ||
+        (profiler->pending = malloc(pending_size)) == NULL)
+    {
+        perror("Could not allocate the profiler");
+        if (profiler != NULL)
+        {
+            free(profiler->record_copy);
+        }
+        free(profiler);
+        return NULL;
+    }
+    if (callchain && ((profiler->frames = malloc(MAX_CALLCHAIN_FRAMES * sizeof(stack_frame))) == NULL ||
+                      stack_trie_init(&profiler->stacks) != 0))
+    {
+        perror("Could not allocate the profiler");
+        free(profiler->frames);
+        free(profiler->record_copy);
+        free(profiler->pending);
+        free(profiler);
+        return NULL;
+    }
+    profiler->event_name = event_name;
+    profiler->period = period;
+    profiler->callchain = callchain;
+    profiler->page_size = page_size;
+    profiler->buffer_pages = pages;
+    profiler->pending_size = pending_size;
+    return profiler;
+}
+
+/* module names are kept for the whole run, hotspots refer to them after an exec dropped their mappings */
+static const char *intern_module(ip_profiler *profiler, const char *path)
+{
+    char **grown;
+
+    for (unsigned int m = 0; m < profiler->nr_modules; m++)
+    {
+        if (strcmp(profiler->modules[m], path) == 0)
+        {
+            return profiler->modules[m];
+        }
+    }
+    grown = realloc(profiler->modules, (profiler->nr_modules + 1) * sizeof(char *));
+    if (grown == NULL)
+    {
+        return NULL;
+    }
+    profiler->modules = grown;
+    if ((grown[profiler->nr_modules] = strdup(path)) == NULL)
+    {
+        return NULL;
+    }
+    return grown[profiler->nr_modules++];
+}
+
+static void add_mapping(ip_profiler *profiler, pid_t pid, uint64_t start, uint64_t end, uint64_t file_offset, const char *path)
+{
+    profiler_mapping *mapping;
+    const char *module;
+
+    /* the maps read at the attach and the mmap records may both list a mapping */
+    for (unsigned int m = 0; m < profiler->nr_mappings; m++)
+    {
+        mapping = &profiler->mappings[m];
+        if (mapping->pid == pid && mapping->start == start && mapping->end == end &&
+            mapping->file_offset == file_offset && strcmp(mapping->module, path) == 0)
+        {
+            return;
+        }
+    }
+    if (profiler->nr_mappings == profiler->mappings_capacity)
+    {
+        unsigned int capacity = profiler->mappings_capacity ? 2 * profiler->mappings_capacity : 64;
+        profiler_mapping *mappings = realloc(profiler->mappings, capacity * sizeof(profiler_mapping));
+
+        if (mappings == NULL)
+        {
+            return;
+        }
+        profiler->mappings = mappings;
+        profiler->mappings_capacity = capacity;
+    }
+    module = intern_module(profiler, path);
+    if (module == NULL)
+    {
+        return;
+    }
+    mapping = &profiler->mappings[profiler->nr_mappings++];
+    mapping->pid = pid;
+    mapping->start = start;
+    mapping->end = end;
+    mapping->file_offset = file_offset;
+    mapping->module = module;
+    mapping->elf = NULL;
+    mapping->elf_looked_up = 0;
+}
+
+/* after an exec the old image is gone */
+static void drop_mappings(ip_profiler *profiler, pid_t pid)
+{
+    unsigned int kept = 0;
+
+    for (unsigned int m = 0; m < profiler->nr_mappings; m++)
+    {
+        if (profiler->mappings[m].pid != pid)
+        {
+            profiler->mappings[kept++] = profiler->mappings[m];
+        }
+    }
+    profiler->nr_mappings = kept;
+    profiler->last_mapping = 0;
+}
+
+static int maps_read(const ip_profiler *profiler, pid_t pid)
+{
+    for (unsigned int p = 0; p < profiler->nr_maps_read; p++)
+    {
+        if (profiler->maps_read[p] == pid)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* the executable mappings of /proc/<pid>/maps, read once per process */
+static void read_proc_maps(ip_profiler *profiler, pid_t pid)
+{
+    char path[64];
+    char *line = NULL;
+    size_t line_size = 0;
+    pid_t *grown;
+    FILE *fp;
+
+    grown = realloc(profiler->maps_read, (profiler->nr_maps_read + 1) * sizeof(pid_t));
+    if (grown == NULL)
+    {
+        return;
+    }
+    profiler->maps_read = grown;
+    profiler->maps_read[profiler->nr_maps_read++] = pid;
+
+    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+    fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        return;
+    }
+    while (getline(&line, &line_size, fp) >= 0)
+    {
+        unsigned long long start;
+        unsigned long long end;
+        unsigned long long offset;
+        char permissions[8];
+        int path_start = 0;
+
+        if (sscanf(line, "%llx-%llx %7s %llx %*s %*u %n", &start, &end, permissions, &offset, &path_start) < 4 ||
+            path_start == 0 || permissions[2] != 'x')
+        {
+            continue;
+        }
+        line[strcspn(line, "\n")] = '\0';
+        if (line[path_start] != '\0')
+        {
+            add_mapping(profiler, pid, start, end, offset, line + path_start);
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+static profiler_mapping *find_mapping(ip_profiler *profiler, pid_t pid, uint64_t ip)
+{
+    profiler_mapping *mapping;
+
+    if (profiler->last_mapping < profiler->nr_mappings)
+    {
+        mapping = &profiler->mappings[profiler->last_mapping];
+        if (mapping->pid == pid && ip >= mapping->start && ip < mapping->end)
+        {
+            return mapping;
+        }
+    }
+    /* newest first, a later mapping replaces what it overlaps */
+    for (unsigned int m = profiler->nr_mappings; m-- > 0;)
+    {
+        mapping = &profiler->mappings[m];
+        if (mapping->pid == pid && ip >= mapping->start && ip < mapping->end)
+        {
+            profiler->last_mapping = m;
+            return mapping;
+        }
+    }
+    return NULL;
+}
+
+static size_t hotspot_slot(const hotspot *hotspots, size_t capacity, const elf_symbol *symbol, const char *module)
+{
+    uint64_t hash = ((uintptr_t)symbol ^ ((uintptr_t)module << 7)) * 0x9e3779b97f4a7c15ULL;
+    size_t slot = (hash >> 32) & (capacity - 1);
+
+    while (hotspots[slot].module != NULL && (hotspots[slot].symbol != symbol || hotspots[slot].module != module))
+    {
+        slot = (slot + 1) & (capacity - 1);
+    }
+    return slot;
+}
+
+static int grow_hotspots(ip_profiler *profiler)
+{
+    size_t capacity = profiler->hotspots_capacity ? 2 * profiler->hotspots_capacity : 256;
+    hotspot *hotspots = calloc(capacity, sizeof(hotspot));
+
+    if (hotspots == NULL)
+    {
+        return -1;
+    }
+    for (size_t h = 0; h < profiler->hotspots_capacity; h++)
+    {
+        const hotspot *old = &profiler->hotspots[h];
+
+        if (old->module != NULL)
+        {
+            hotspots[hotspot_slot(hotspots, capacity, old->symbol, old->module)] = *old;
+        }
+    }
+    free(profiler->hotspots);
+    profiler->hotspots = hotspots;
+    profiler->hotspots_capacity = capacity;
+    return 0;
+}
+
+static void count_sample(ip_profiler *profiler, const elf_symbol *symbol, const char *module)
+{
+    size_t slot;
+
+    profiler->nr_samples++;
+    if (2 * (profiler->nr_hotspots + 1) > profiler->hotspots_capacity && grow_hotspots(profiler) != 0)
+    {
+        return;
+    }
+    slot = hotspot_slot(profiler->hotspots, profiler->hotspots_capacity, symbol, module);
+    if (profiler->hotspots[slot].module == NULL)
+    {
+        profiler->hotspots[slot].symbol = symbol;
+        profiler->hotspots[slot].module = module;
+        profiler->nr_hotspots++;
+    }
+    profiler->hotspots[slot].samples++;
+}
+
+static void resolve_frame(ip_profiler *profiler, pid_t pid, uint64_t ip, stack_frame *frame)
+{
+    profiler_mapping *mapping = find_mapping(profiler, pid, ip);
+
+    if (mapping == NULL && !maps_read(profiler, pid))
+    {
+        read_proc_maps(profiler, pid);
+        mapping = find_mapping(profiler, pid, ip);
+    }
+    /* a forked child that has not called exec() still runs the image of the target */
+    if (mapping == NULL && pid != profiler->pid)
+    {
+        mapping = find_mapping(profiler, profiler->pid, ip);
+    }
+    frame->symbol = NULL;
+    frame->module = UNKNOWN_MODULE;
+    if (mapping == NULL)
+    {
+        return;
+    }
+    if (!mapping->elf_looked_up)
+    {
+        /* [vdso] and the like have no file behind them */
+        mapping->elf = mapping->module[0] == '/' ? symbol_cache_get(&profiler->symbols, mapping->module) : NULL;
+        mapping->elf_looked_up = 1;
+    }
+    if (mapping->elf != NULL)
+    {
+        frame->symbol = elf_symbols_lookup(mapping->elf, ip - mapping->start + mapping->file_offset);
+    }
+    frame->module = mapping->module;
+}
+
+/* the callchain turned around, outermost caller first */
+static unsigned int resolve_callchain(ip_profiler *profiler, const struct sample_event *sample)
+{
+    /* the record may be cut short, never read past its end */
+    uint64_t max_ips = (sample->header.size - sizeof(struct sample_event)) / sizeof(uint64_t);
+    uint64_t nr_ips = sample->nr_ips < max_ips ? sample->nr_ips : max_ips;
+    unsigned int nr_frames = 0;
+    int leaf = 1;
+
+    for (uint64_t i = 0; i < nr_ips && nr_frames < MAX_CALLCHAIN_FRAMES; i++)
+    {
+        uint64_t ip = sample->ips[i];
+
+        /* PERF_CONTEXT_USER and the other markers between the parts of a chain */
+        if (ip >= (uint64_t)PERF_CONTEXT_MAX)
+        {
+            continue;
+        }
+        /* callers are return addresses, step back into the call instruction */
+        resolve_frame(profiler, sample->pid, leaf ? ip : ip - 1, &profiler->frames[nr_frames++]);
+        leaf = 0;
+    }
+    for (unsigned int f = 0; f < nr_frames / 2; f++)
+    {
+        stack_frame frame = profiler->frames[f];
+
+        profiler->frames[f] = profiler->frames[nr_frames - 1 - f];
+        profiler->frames[nr_frames - 1 - f] = frame;
+    }
+    return nr_frames;
+}
+
+static void resolve_sample(ip_profiler *profiler, const struct sample_event *sample)
+{
+    stack_frame frame;
+
+    resolve_frame(profiler, sample->pid, sample->ip, &frame);
+    count_sample(profiler, frame.symbol, frame.module);
+    if (profiler->callchain && sample->header.size >= sizeof(struct sample_event))
+    {
+        stack_trie_add(&profiler->stacks, profiler->frames, resolve_callchain(profiler, sample));
+    }
+}
+
+static void handle_record(ip_profiler *profiler, const struct perf_event_header *header, int samples_pass)
+{
+    if (!samples_pass)
+    {
+        if (header->type == PERF_RECORD_MMAP2)
+        {
+            const struct mmap2_event *mmap_event = (const struct mmap2_event *)header;
+
+            add_mapping(profiler, mmap_event->pid, mmap_event->addr, mmap_event->addr + mmap_event->len,
+                        mmap_event->pgoff, mmap_event->filename);
+        }
+        else if (header->type == PERF_RECORD_COMM && (header->misc & PERF_RECORD_MISC_COMM_EXEC))
+        {
+            drop_mappings(profiler, ((const struct comm_event *)header)->pid);
+        }
+        return;
+    }
+    if (header->type == PERF_RECORD_SAMPLE)
+    {
+        const struct sample_event *sample = (const struct sample_event *)header;
+
+        resolve_sample(profiler, sample);
+    }
+    else if (header->type == PERF_RECORD_LOST)
+    {
+        profiler->nr_lost += ((const struct lost_event *)header)->lost;
+    }
+}
+
+/* copies size bytes at offset of a ring of ring_size bytes into to, across the end of the ring */
+static void copy_from_ring(char *to, const char *ring, uint64_t ring_size, uint64_t offset, uint64_t size)
+{
+    uint64_t first = ring_size - offset < size ? ring_size - offset : size;
+
+    memcpy(to, ring + offset, first);
+    memcpy(to + first, ring, size - first);
+}
+
+static void copy_to_ring(char *ring, uint64_t ring_size, uint64_t offset, const char *from, uint64_t size)
+{
+    uint64_t first = ring_size - offset < size ? ring_size - offset : size;
+
+    memcpy(ring + offset, from, first);
+    memcpy(ring, from + first, size - first);
+}
+
+/* moves the whole records of a buffer that fit into the pending ring, returns the new pending head */
+static uint64_t collect_buffer(ip_profiler *profiler, profiler_buffer *buffer, uint64_t pending_head, uint64_t pending_tail)
+{
+    struct perf_event_mmap_page *meta = buffer->base;
+    const char *data = (const char *)buffer->base + profiler->page_size;
+    uint64_t data_size = buffer->data_size;
+    uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = meta->data_tail;
+
+    while (tail < head)
+    {
+        /* records are 8 byte aligned, a header never wraps */
+        const struct perf_event_header *header = (const struct perf_event_header *)(data + (tail & (data_size - 1)));
+
+        if (header->size < sizeof(struct perf_event_header))
+        {
+            tail = head;
+            break;
+        }
+        if (profiler->pending_size - (pending_head - pending_tail) < header->size)
+        {
+            break;
+        }
+        copy_from_ring(profiler->record_copy, data, data_size, tail & (data_size - 1), header->size);
+        copy_to_ring(profiler->pending, profiler->pending_size, pending_head & (profiler->pending_size - 1),
+                     profiler->record_copy, header->size);
+        pending_head += header->size;
+        tail += header->size;
+    }
+    __atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+    return pending_head;
+}
+
+void ip_profiler_collect(ip_profiler *profiler)
+{
+    uint64_t pending_tail = __atomic_load_n(&profiler->pending_tail, __ATOMIC_ACQUIRE);
+    uint64_t pending_head = profiler->pending_head;
+
+    for (unsigned int b = 0; b < profiler->nr_buffers; b++)
+    {
+        pending_head = collect_buffer(profiler, &profiler->buffers[b], pending_head, pending_tail);
+    }
+    __atomic_store_n(&profiler->pending_head, pending_head, __ATOMIC_RELEASE);
+}
+
+/* walks the pending records from tail up to head */
+static void walk_pending(ip_profiler *profiler, uint64_t tail, uint64_t head, int samples_pass)
+{
+    while (tail < head)
+    {
+        uint64_t offset = tail & (profiler->pending_size - 1);
+        const struct perf_event_header *header = (const struct perf_event_header *)(profiler->pending + offset);
+
+        if (offset + header->size > profiler->pending_size)
+        {
+            copy_from_ring(profiler->record_copy, profiler->pending, profiler->pending_size, offset, header->size);
+            header = (const struct perf_event_header *)profiler->record_copy;
+        }
+        tail += header->size;
+        handle_record(profiler, header, samples_pass);
+    }
+}
+
+void ip_profiler_resolve(ip_profiler *profiler)
+{
+    uint64_t head = __atomic_load_n(&profiler->pending_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = profiler->pending_tail;
+
+    /* the mmap record of a library may sit in another CPU's buffer than its first samples,
+       so the mappings of all records are taken before any sample is resolved */
+    walk_pending(profiler, tail, head, 0);
+    walk_pending(profiler, tail, head, 1);
+    __atomic_store_n(&profiler->pending_tail, head, __ATOMIC_RELEASE);
+}
+
+void ip_profiler_drain(ip_profiler *profiler)
+{
+    uint64_t head;
+
+    /* everything fits once the pending ring is empty, unless the kernel keeps writing */
+    do
+    {
+        head = profiler->pending_head;
+        ip_profiler_collect(profiler);
+        ip_profiler_resolve(profiler);
+    } while (profiler->pending_head != head);
+}
+
+/* threads of the process, or only the process itself for a command that has not exec'd yet */
+static pid_t *list_threads(pid_t pid, int all, unsigned int *nr_threads)
+{
+    char path[64];
+    struct dirent *entry;
+    pid_t *tids = malloc(sizeof(pid_t));
+    DIR *dir;
+
+    *nr_threads = 0;
+    if (tids == NULL)
+    {
+        return NULL;
+    }
+    tids[(*nr_threads)++] = pid;
+    if (!all)
+    {
+        return tids;
+    }
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    dir = opendir(path);
+    if (dir == NULL)
+    {
+        return tids;
+    }
+    while ((entry = readdir(dir)) != NULL)
+    {
+        pid_t tid = atoi(entry->d_name);
+        pid_t *grown;
+
+        if (tid <= 0 || tid == pid)
+        {
+            continue;
+        }
+        grown = realloc(tids, (*nr_threads + 1) * sizeof(pid_t));
+        if (grown == NULL)
+        {
+            break;
+        }
+        tids = grown;
+        tids[(*nr_threads)++] = tid;
+    }
+    closedir(dir);
+    return tids;
+}
+
+static int add_fd(ip_profiler *profiler, int fd)
+{
+    int *fds = realloc(profiler->fds, (profiler->nr_fds + 1) * sizeof(int));
+
+    if (fds == NULL)
+    {
+        perror("Could not allocate the profiler events");
+        return -1;
+    }
+    profiler->fds = fds;
+    profiler->fds[profiler->nr_fds++] = fd;
+    return 0;
+}
+
+static int map_buffer(ip_profiler *profiler, int fd)
+{
+    uint64_t data_size = (uint64_t)profiler->buffer_pages * profiler->page_size;
+    void *base = mmap(NULL, data_size + profiler->page_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    /* over the locked memory limit, later buffers start from the smaller size */
+    while (base == MAP_FAILED && errno == EPERM && profiler->buffer_pages > PROFILER_MIN_BUFFER_PAGES)
+    {
+        profiler->buffer_pages /= 2;
+        data_size = (uint64_t)profiler->buffer_pages * profiler->page_size;
+        base = mmap(NULL, data_size + profiler->page_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base != MAP_FAILED)
+        {
+            printf("Warning: the locked memory limit allows sample buffers of %u pages, samples may be lost\n",
+                   profiler->buffer_pages);
+        }
+    }
+    if (base == MAP_FAILED)
+    {
+        perror("Could not map the sample buffer");
+        return -1;
+    }
+    profiler->buffers[profiler->nr_buffers].fd = fd;
+    profiler->buffers[profiler->nr_buffers].base = base;
+    profiler->buffers[profiler->nr_buffers].data_size = data_size;
+    profiler->nr_buffers++;
+    return 0;
+}
+
+int ip_profiler_attach(ip_profiler *profiler, pid_t pid, int enable_on_exec)
+{
+    struct perf_event_attr attr;
+    long nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    unsigned int nr_threads;
+    pid_t *tids;
+
+    memset(&attr, 0, sizeof(attr));
+    if (perf_encode_event(profiler->event_name, &attr) != 0)
+    {
+        printf("ERROR: %s cannot be sampled, it has no perf encoding\n", profiler->event_name);
+        return -1;
+    }
+    attr.size = sizeof(attr);
+    attr.sample_period = profiler->period;
+    attr.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID;
+    if (profiler->callchain)
+    {
+        attr.sample_type |= PERF_SAMPLE_CALLCHAIN;
+        attr.exclude_callchain_kernel = 1;
+    }
+    attr.disabled = 1;
+    attr.enable_on_exec = enable_on_exec;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.mmap = 1;
+    attr.mmap2 = 1;
+    attr.comm = 1;
+    attr.comm_exec = 1;
+
+    profiler->pid = pid;
+    profiler->enable_on_exec = enable_on_exec;
+    profiler->buffers = calloc(nr_cpus, sizeof(profiler_buffer));
+    tids = list_threads(pid, !enable_on_exec, &nr_threads);
+    if (profiler->buffers == NULL || tids == NULL)
+    {
+        perror("Could not allocate the profiler");
+        free(tids);
+        return -1;
+    }
+
+    for (long cpu = 0; cpu < nr_cpus; cpu++)
+    {
+        int leader = -1;
+
+        for (unsigned int t = 0; t < nr_threads; t++)
+        {
+            int fd = sys_perf_event_open(&attr, tids[t], cpu, -1, PERF_FLAG_FD_CLOEXEC);
+
+            if (fd < 0)
+            {
+                /* offline CPUs and threads that exited in between */
+                if ((t == 0 && errno == ENODEV) || (t > 0 && errno == ESRCH))
+                {
+                    break;
+                }
+                printf("ERROR: could not open sampling event %s on pid %d: %s\n", profiler->event_name, tids[t], strerror(errno));
+                free(tids);
+                return -1;
+            }
+            if (add_fd(profiler, fd) != 0)
+            {
+                close(fd);
+                free(tids);
+                return -1;
+            }
+            if (leader < 0)
+            {
+                if (map_buffer(profiler, fd) != 0)
+                {
+                    free(tids);
+                    return -1;
+                }
+                leader = fd;
+            }
+            else if (ioctl(fd, PERF_EVENT_IOC_SET_OUTPUT, leader) != 0)
+            {
+                printf("ERROR: could not share the sample buffer of cpu %ld: %s\n", cpu, strerror(errno));
+                free(tids);
+                return -1;
+            }
+        }
+    }
+    free(tids);
+    if (profiler->nr_buffers == 0)
+    {
+        printf("ERROR: no CPU to sample pid %d on\n", pid);
+        return -1;
+    }
+    /* a running process will not report the mappings it already has */
+    if (!enable_on_exec)
+    {
+        read_proc_maps(profiler, pid);
+    }
+    return 0;
+}
+
+int ip_profiler_start(ip_profiler *profiler)
+{
+    if (profiler->enable_on_exec)
+    {
+        return 0;
+    }
+    for (unsigned int f = 0; f < profiler->nr_fds; f++)
+    {
+        if (ioctl(profiler->fds[f], PERF_EVENT_IOC_ENABLE, 0) != 0)
+        {
+            perror("Could not start sampling");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void ip_profiler_stop(ip_profiler *profiler)
+{
+    for (unsigned int f = 0; f < profiler->nr_fds; f++)
+    {
+        ioctl(profiler->fds[f], PERF_EVENT_IOC_DISABLE, 0);
+    }
+}
+
+static int compare_hotspots(const void *a, const void *b)
+{
+    const hotspot *left = a;
+    const hotspot *right = b;
+
+    return (left->samples < right->samples) - (left->samples > right->samples);
+}
+
+/* the used slots ordered by samples, NULL if there are none */
+static hotspot *ranked_hotspots(const ip_profiler *profiler)
+{
+    hotspot *ranked;
+    size_t n = 0;
+
+    if (profiler->nr_hotspots == 0 || (ranked = malloc(profiler->nr_hotspots * sizeof(hotspot))) == NULL)
+    {
+        return NULL;
+    }
+    for (size_t h = 0; h < profiler->hotspots_capacity; h++)
+    {
+        if (profiler->hotspots[h].module != NULL)
+        {
+            ranked[n++] = profiler->hotspots[h];
+        }
+    }
+    qsort(ranked, n, sizeof(hotspot), compare_hotspots);
+    return ranked;
+}
+
+static const char *function_name(const hotspot *hotspot)
+{
+    return hotspot->symbol != NULL ? hotspot->symbol->name : "[unknown]";
+}
+
+void ip_profiler_print(const ip_profiler *profiler, const char *label)
+{
+    hotspot *ranked = ranked_hotspots(profiler);
+    size_t nr_lines = profiler->nr_hotspots < HOTSPOT_REPORT_LINES ? profiler->nr_hotspots : HOTSPOT_REPORT_LINES;
+
+    printf("***** Hotspots of %s *****\n", label);
+    printf("one sample every %llu %s, %llu samples", (unsigned long long)profiler->period, profiler->event_name,
+           (unsigned long long)profiler->nr_samples);
+    if (profiler->nr_lost > 0)
+    {
+        printf(", %llu lost", (unsigned long long)profiler->nr_lost);
+    }
+    if (profiler->callchain)
+    {
+        printf(", %u distinct call paths", profiler->stacks.nr_nodes - 1);
+        if (profiler->stacks.nr_truncated > 0)
+        {
+            printf(" (%llu samples cut short, the stack trie is full)", (unsigned long long)profiler->stacks.nr_truncated);
+        }
+    }
+    printf("\n");
+    if (ranked == NULL)
+    {
+        printf("\n");
+        return;
+    }
+    printf("%10s %8s  %-40s %s\n", "samples", "percent", "function", "module");
+    for (size_t h = 0; h < nr_lines; h++)
+    {
+        const char *slash = strrchr(ranked[h].module, '/');
+
+        printf("%10llu %7.2f%%  %-40s %s\n", (unsigned long long)ranked[h].samples,
+               100.0 * ranked[h].samples / profiler->nr_samples, function_name(&ranked[h]),
+               slash != NULL ? slash + 1 : ranked[h].module);
+    }
+    printf("\n");
+    free(ranked);
+}
+
+void ip_profiler_write(const ip_profiler *profiler, unsigned int target_index, FILE *fp)
+{
+    hotspot *ranked = ranked_hotspots(profiler);
+
+    for (size_t h = 0; ranked != NULL && h < profiler->nr_hotspots; h++)
+    {
+        fprintf(fp, "%u,%s,%s,%llu,%.4f\n", target_index, function_name(&ranked[h]), ranked[h].module,
+                (unsigned long long)ranked[h].samples, 100.0 * ranked[h].samples / profiler->nr_samples);
+    }
+    free(ranked);
+}
+
+void ip_profiler_write_folded(const ip_profiler *profiler, const char *root, FILE *fp)
+{
+    if (profiler->callchain)
+    {
+        stack_trie_write_folded(&profiler->stacks, root, profiler->period, fp);
+    }
+}
+
+void ip_profiler_destroy(ip_profiler *profiler)
+{
+    if (profiler == NULL)
+    {
+        return;
+    }
+    for (unsigned int b = 0; b < profiler->nr_buffers; b++)
+    {
+        munmap(profiler->buffers[b].base, profiler->buffers[b].data_size + profiler->page_size);
+    }
+    for (unsigned int f = 0; f < profiler->nr_fds; f++)
+    {
+        close(profiler->fds[f]);
+    }
+    for (unsigned int m = 0; m < profiler->nr_modules; m++)
+    {
+        free(profiler->modules[m]);
+    }
+    symbol_cache_free(&profiler->symbols);
+    free(profiler->buffers);
+    free(profiler->fds);
+    free(profiler->mappings);
+    free(profiler->maps_read);
+    free(profiler->modules);
+    free(profiler->hotspots);
+    if (profiler->callchain)
+    {
+        stack_trie_free(&profiler->stacks);
+    }
+    free(profiler->frames);
+    free(profiler->record_copy);
+    free(profiler->pending);
+    free(profiler);
+}
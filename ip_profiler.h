@@ -0,0 +1,166 @@
+#ifndef IP_PROFILER_H
+#define IP_PROFILER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "elf_symbols.h"
+#include "stack_trie.h"
+
+#define DEFAULT_PROFILE_PERIOD 100000
+/* bounds of the data pages of the sample buffer of every CPU, powers of two */
+#define PROFILER_MIN_BUFFER_PAGES 16
+#define PROFILER_MAX_BUFFER_PAGES 1024
+/* bytes of a sample record, with a callchain of the kernel's default 127 frames */
+#define PROFILER_SAMPLE_BYTES 32
+#define PROFILER_CALLCHAIN_SAMPLE_BYTES (PROFILER_SAMPLE_BYTES + 8 + 127 * 8)
+/* smallest ring of raw records between the sampler and the writer, a power of two above the largest record */
+#define PROFILER_PENDING_SIZE (1024 * 1024)
+/* functions listed per target in the console report */
+#define HOTSPOT_REPORT_LINES 20
+/* frames kept of a callchain, the kernel's default limit is 127 */
+#define MAX_CALLCHAIN_FRAMES 256
+
+/**********
+ * Name: ip_profiler
+ * Description: overflow sampling of one target. A perf event counts the
+ * chosen event and writes the instruction pointer of the child into a ring
+ * buffer every period occurrences, e.g. one sample every 10000 PAPI_L3_TCM.
+ * The event follows the threads and children the process creates after
+ * the attach. The kernel does not allow one buffer to be shared by inherited
+ * per-task events, so there is an event and a buffer per CPU, and with an
+ * attached process every thread it already has gets an event per CPU whose
+ * output goes to that CPU's buffer.
+ * The buffers are emptied once per tick, so they are sized for the samples
+ * of two ticks, assuming the event occurs once per nanosecond of CPU time
+ * as the clock events do, at the full record size; a buffer the locked
+ * memory limit (perf_event_mlock_kb) does not allow is halved until it fits.
+ * The sampler owning the target only copies the raw records out of the
+ * buffers after each read, into a pending ring twice the size of a buffer
+ * and at least PROFILER_PENDING_SIZE bytes, and hands the space back to the
+ * kernel; what does not fit stays in the buffers for the next tick. The writer thread resolves the records from
+ * that ring while the process and its mappings still exist: the executable
+ * mappings come from /proc/<pid>/maps and from the mmap records the kernel
+ * adds to the buffers, an exec drops the mappings of the process, and the
+ * symbols of every mapped file are parsed once into a symbol cache. Samples
+ * are counted per function and the report ranks the functions by samples.
+ * With callchains every sample also carries the user stack the kernel
+ * walked along the frame pointers; the stacks are merged by function in a
+ * stack trie and written as folded stacks weighted by the period. Code
+ * built without frame pointers gives truncated chains.
+ * Functions return 0 on success and -1 after printing the reason.
+ * ********/
+
+struct profiler_mapping
+{
+    pid_t pid;
+    uint64_t start;
+    uint64_t end;
+    uint64_t file_offset;
+    /* interned, lives as long as the profiler */
+    const char *module;
+    /* NULL until looked up, and if the file has no symbols */
+    elf_symbols *elf;
+    int elf_looked_up;
+};
+
+typedef struct profiler_mapping profiler_mapping;
+
+struct hotspot
+{
+    /* NULL for samples in a module without a matching symbol */
+    const elf_symbol *symbol;
+    /* NULL marks a free slot */
+    const char *module;
+    uint64_t samples;
+};
+
+typedef struct hotspot hotspot;
+
+struct profiler_buffer
+{
+    int fd;
+    void *base;
+    /* bytes behind the meta page */
+    uint64_t data_size;
+};
+
+typedef struct profiler_buffer profiler_buffer;
+
+struct ip_profiler
+{
+    const char *event_name;
+    uint64_t period;
+    int callchain;
+    pid_t pid;
+    int enable_on_exec;
+    int *fds;
+    unsigned int nr_fds;
+    profiler_buffer *buffers;
+    unsigned int nr_buffers;
+    size_t page_size;
+    /* data pages each buffer is mapped with, unless the memory limit halved it */
+    unsigned int buffer_pages;
+    /* raw records, head is advanced by the sampler and tail by the writer */
+    char *pending;
+    uint64_t pending_size;
+    uint64_t pending_head;
+    uint64_t pending_tail;
+
+    profiler_mapping *mappings;
+    unsigned int nr_mappings;
+    unsigned int mappings_capacity;
+    /* last mapping a sample was found in */
+    unsigned int last_mapping;
+    /* processes whose /proc/<pid>/maps has been read */
+    pid_t *maps_read;
+    unsigned int nr_maps_read;
+    char **modules;
+    unsigned int nr_modules;
+    symbol_cache symbols;
+
+    /* open addressing on symbol and module */
+    hotspot *hotspots;
+    size_t hotspots_capacity;
+    size_t nr_hotspots;
+    uint64_t nr_samples;
+    uint64_t nr_lost;
+    stack_trie stacks;
+    stack_frame *frames;
+    /* a record that wraps around the end of a buffer is copied here */
+    char *record_copy;
+};
+
+typedef struct ip_profiler ip_profiler;
+
+/* event is any name perf_encode_event() accepts, the buffers are emptied every interval_ns */
+ip_profiler *ip_profiler_create(const char *event_name, uint64_t period, int callchain, uint64_t interval_ns);
+
+/* opens the sampling events on a process; for commands held in front of
+   exec() sampling starts with the exec, otherwise with ip_profiler_start() */
+int ip_profiler_attach(ip_profiler *profiler, pid_t pid, int enable_on_exec);
+
+int ip_profiler_start(ip_profiler *profiler);
+
+/* copies the records taken since the previous collect, by the sampler owning the target */
+void ip_profiler_collect(ip_profiler *profiler);
+
+/* counts the samples collected so far, by the writer thread */
+void ip_profiler_resolve(ip_profiler *profiler);
+
+/* collects and resolves everything left, once the samplers and the writer have finished */
+void ip_profiler_drain(ip_profiler *profiler);
+
+void ip_profiler_stop(ip_profiler *profiler);
+
+void ip_profiler_print(const ip_profiler *profiler, const char *label);
+
+/* appends the functions of one target as target,function,module,samples,percent rows */
+void ip_profiler_write(const ip_profiler *profiler, unsigned int target_index, FILE *fp);
+
+/* appends the stacks of one target in folded format, each sample weighs one period */
+void ip_profiler_write_folded(const ip_profiler *profiler, const char *root, FILE *fp);
+
+void ip_profiler_destroy(ip_profiler *profiler);
+
+#endif
@@ -16,22 +16,55 @@
 #include <sys/time.h>
 #include <sched.h>
 #include <assert.h>
-#include <signal.h>
-#include <papi.h>n
-
-/**********
- * Name: write_measurements_to_csv_file
- * Description: stores all measurements to a file with the provided output filename
- * ********/
-
-struct PAPI_event
+#include <getopt.h>
+#include <papi.h>
+#include "events.h"
+#include "counter_backend.h"
+#include "sample.h"
+#include "sample_ring.h"
+#include "sample_writer.h"
+#include "scheduler.h"
+#include "metrics.h"
+#include "target.h"
+#include "sampler_pool.h"
+#include "monitor_overhead.h"
+#include "agent_ring.h"
+#include "perf_backend.h"
+
+#define SAMPLE_RING_CAPACITY 4096
+/* every thread adds a record per tick */
+#define PER_THREAD_RING_CAPACITY 16384
+/* threads listed per process in the final breakdown */
+#define BREAKDOWN_THREADS 10
+#define DEFAULT_PRINT_INTERVAL_MS 100
+
+enum long_only_options
 {
-    int event;
-    char *event_name;
+    OPT_PRINT_INTERVAL = 256,
+    OPT_RATES,
+    OPT_FORMAT,
+    OPT_EVENT_FILE,
+    OPT_MULTIPLEX,
+    OPT_METRIC_FILE,
+    OPT_CMD,
+    OPT_PID,
+    OPT_THREADS,
+    OPT_PER_THREAD,
+    OPT_SAMPLERS,
+    OPT_SAMPLER_CPUS,
+    OPT_REALTIME,
+    OPT_URING,
+    OPT_PROFILE,
+    OPT_PROFILE_PERIOD,
+    OPT_CALLCHAIN,
+    OPT_REGIONS,
+    OPT_AGENT_PERIOD,
+    OPT_REGULATE,
+    OPT_REGULATE_EVENT,
+    OPT_THROTTLE
 };
 
-typedef struct PAPI_event PAPI_event;
-
+/* event set used when none is given on the command line */
 PAPI_event PAPI_events[] = {
     {PAPI_TOT_INS, "PAPI_TOT_INS"},
     {PAPI_L2_TCM, "PAPI_L2_TCM"},
@@ -40,257 +73,775 @@ PAPI_event PAPI_events[] = {
     {PAPI_L3_TCM, "PAPI_L3_TCM"}
 };
 
-int write_measurements_to_csv_file(unsigned int nr_counters, long long (*measurements)[nr_counters], unsigned int num_measurements, char *output_filename)
+void print_help()
+{
+    printf("\n");
+    printf("***** Process monitor *****\n");
+    printf("Usage: ./process_monitor [options] <number of measurements> <interval in milliseconds> <write to file> [path to executable to be monitored] \n");
+    printf("Options: \n");
+    printf(" -b, --backend <papi|perf> \t: counter backend, perf reads the whole event group with one read() (default papi) \n");
+    printf(" \t\t\t\t  perf encodes the L2 presets only when built with libpfm4, otherwise pass -e with e.g. PAPI_L3_TCM, cycles \n");
+    printf(" \t\t\t\t  synthetic: deterministic counts without a PMU, replay:<file>: play back a .csv or .pmcol output file \n");
+    printf(" \t\t\t\t  one sample per tick, -e names the recorded events, a shorter interval replays faster \n");
+    printf(" \t\t\t\t  agent: the spawned command reads its own main thread's counters with rdpmc (read() where not \n");
+    printf(" \t\t\t\t  available) through a preloaded library, every agent sample goes to the output file as tid <pid> \n");
+    printf(" --agent-period <ns> \t\t: interval of the agent's samples (default %d, at least %d), signals interrupt sleeps of the \n", AGENT_DEFAULT_PERIOD_NS,
+           AGENT_MIN_PERIOD_NS);
+    printf(" \t\t\t\t  command \n");
+    printf(" -e, --events <name,name,...> \t: PAPI preset or native event names to count (default");
+    for (size_t i = 0; i < NELEMS(PAPI_events); i++)
+    {
+        printf(" %s", PAPI_events[i].event_name);
+    }
+    printf(") \n");
+    printf(" --event-file <path> \t\t: read event names from a file, one per line, '#' starts a comment \n");
+    printf(" -m, --metric <name = expr> \t: derived metric evaluated per sample, e.g. \"l3_mpki = PAPI_L3_TCM / PAPI_TOT_INS * 1000\" \n");
+    printf(" \t\t\t\t  operators + - * / ( ), event names, earlier metrics, interval_s, {name} for names with '-' \n");
+    printf(" --metric-file <path> \t\t: read metric definitions from a file, one per line \n");
+    printf(" --cmd <\"path args...\"> \t: spawn and monitor one more process, may be repeated \n");
+    printf(" --pid <pid> \t\t\t: attach to an already running process, may be repeated; it is detached, never terminated \n");
+    printf(" --threads \t\t\t: with --pid also attach to the threads the process already has, counts are summed per process \n");
+    printf(" --per-thread \t\t\t: count every thread separately, follows new and exiting threads; the output file gets a series per tid \n");
+    printf(" --samplers <n> \t\t: sampler threads sharing the targets, rebalanced by read cost (default 1, at most %d) \n", MAX_SAMPLERS);
+    printf(" --sampler-cpus <list> \t\t: pin the samplers round-robin to these housekeeping CPUs, e.g. 0,2-3 \n");
+    printf(" --realtime \t\t\t: run the samplers at SCHED_FIFO and lock the monitor's memory \n");
+    printf(" --uring \t\t\t: issue the counter reads of each sampler with one io_uring_enter per tick (perf backend); the kernel may hand the reads to worker threads, compare with uring_read_bench first \n");
+    printf(" --profile <event> \t\t: sample the instruction pointer every period occurrences of a PAPI preset or perf event, \n");
+    printf(" \t\t\t\t  e.g. PAPI_L3_TCM, and rank the functions by samples at the end; hotspots go to <pid>hotspots.csv \n");
+    printf(" --profile-period <n> \t\t: events per instruction pointer sample (default %d) \n", DEFAULT_PROFILE_PERIOD);
+    printf(" --callchain \t\t\t: with --profile also take the user call stack of every sample (frame pointers), \n");
+    printf(" \t\t\t\t  merged stacks go to <pid>stacks.folded weighted by event count, for flame graphs \n");
+    printf(" --regions \t\t\t: attribute the counts to the code regions the payload marks with pm_region.h, \n");
+    printf(" \t\t\t\t  per-region totals are printed and written to <pid>regions.csv; an interval counts for the region \n");
+    printf(" \t\t\t\t  it ends in, changed_time is the share of intervals in which the region changed \n");
+    printf(" --regulate <budget> \t\t: MemGuard style regulation, a process whose regulated event exceeds budget within one \n");
+    printf(" \t\t\t\t  interval is throttled for the next one; the output gets throttle and budget_used columns \n");
+    printf(" --regulate-event <name> \t: regulated event, one of the counted events (default %s) \n", DEFAULT_REGULATED_EVENT);
+    printf(" --throttle <signal|cgroup:<dir>> : throttle with SIGSTOP/SIGCONT (default) or with the cpu.max of a cgroup \n");
+    printf(" \t\t\t\t  the monitor creates for every process below the cgroup v2 directory dir \n");
+    printf(" --multiplex \t\t\t: time-share more events than hardware counters, values are scaled estimates with a coverage fraction \n");
+    printf(" --print-interval <ms> \t\t: print at most one sample per interval to the console, 0 prints all (default %d) \n", DEFAULT_PRINT_INTERVAL_MS);
+    printf(" --rates \t\t\t: add per-second rate columns next to the raw counter deltas \n");
+    printf(" --format <csv|binary> \t\t: output file format, binary streams columnar blocks to <pid>output.pmcol (default csv) \n");
+    printf("Params: \n");
+    printf(" number of measurements \t <int> \t: number of measurements the monitor will perform before terminating, 0 runs until the process exits \n");
+    printf(" interval in nanoseconds \t <int> \t: with which interval the monitor will take measurements of application \n");
+    printf(" write to file \t <int> \t \t: write measurements to CSV file (0 for yes, 1 for no), the monitor's own costs go to <pid>overhead.csv \n");
+    printf(" path to executable \t <string> <space seperated argument list> \t: path to the executable that the process monitor will spawn with the provided arguments, optional with --cmd or --pid\n");
+    printf("\n");
+    printf("Send SIGUSR1 to the monitor to print the statistics collected so far.\n");
+    printf("SIGINT or SIGTERM end the measurement early, attached processes keep running.\n");
+    printf("\n");
+    printf("Example: ./process_monitor 100 10000000 1 /home/janne/asm/instructionloop\n");
+    printf("Example: ./process_monitor 200 1 1 /home/janne/payloads/Palloc_program/Matmult/matmult 512 0 0\n");
+    printf("Example: ./process_monitor --backend perf -e PAPI_TOT_INS,PAPI_TOT_CYC,PAPI_L3_TCA,PAPI_L3_TCM 200 1 1 /home/janne/asm/instructionloop\n");
+    printf("Example: ./process_monitor --backend replay:4242output.csv -e PAPI_TOT_INS,PAPI_L3_TCM --pid $$ 0 1 0\n");
+    printf("Example: ./process_monitor -e PAPI_TOT_INS,PAPI_TOT_CYC,PAPI_L3_TCM 200 1 1 /home/janne/asm/instructionloop\n");
+    printf("Example: ./process_monitor --profile PAPI_L3_TCM --profile-period 10000 0 10 0 /home/janne/payloads/Palloc_program/Matmult/matmult 512 0 0\n");
+    printf("Example: ./process_monitor --backend agent --agent-period 20000 -e PAPI_TOT_INS,PAPI_L3_TCM 0 10 0 /home/janne/asm/instructionloop\n");
+    printf("Example: ./process_monitor --regulate 100000 --throttle cgroup:/sys/fs/cgroup/bench 0 1 0 /home/janne/payloads/Palloc_program/Matmult/matmult 512 0 0\n");
+    printf("Example: ./process_monitor --cmd \"/home/janne/asm/instructionloop\" --pid 4242 0 10 0\n");
+    printf("\n");
+    return;
+}
+
+
+/* writer of the running measurement, for the SIGUSR1 statistics report */
+static sample_writer *active_writer = NULL;
+
+static void report_signal_handler(int signal_number)
+{
+    (void)signal_number;
+
+    if (active_writer != NULL)
+    {
+        sample_writer_request_report(active_writer);
+    }
+}
+
+static int compare_thread_totals(const void *a, const void *b)
 {
-    FILE *fp = fopen(output_filename, "w");
+    const thread_totals *left = a;
+    const thread_totals *right = b;
 
-    /* write column line */
-    for (size_t i = 0; i < nr_counters; i++)
+    return (left->values[0] < right->values[0]) - (left->values[0] > right->values[0]);
+}
+
+/* threads of the process with the highest counts of the first event, exited ones included */
+void print_thread_breakdown(const target *target, const PAPI_event *events)
+{
+    unsigned int nr_threads = target->nr_threads + target->nr_retired;
+    thread_totals *threads = malloc(nr_threads * sizeof(thread_totals));
+
+    if (threads == NULL)
+    {
+        return;
+    }
+    for (unsigned int i = 0; i < target->nr_threads; i++)
+    {
+        threads[i] = target->threads[i].totals;
+    }
+    memcpy(&threads[target->nr_threads], target->retired, target->nr_retired * sizeof(thread_totals));
+    qsort(threads, nr_threads, sizeof(thread_totals), compare_thread_totals);
+
+    printf("***** Threads of %s by %s (%u seen) *****\n", target->label, events[0].event_name, nr_threads);
+    printf("tid\t");
+    for (size_t j = 0; j < target->nr_events; j++)
     {
-        fprintf(fp, "%s,", PAPI_events[i].event_name);
+        printf("%s\t", events[j].event_name);
     }
-    fprintf(fp, "\n");
-    
-    /* write captured events */
-    for (size_t i = 0; i < num_measurements; i++)
+    printf("\n");
+    for (unsigned int i = 0; i < nr_threads && i < BREAKDOWN_THREADS; i++)
     {
-        for(size_t j = 0; j < nr_counters; j++)
+        printf("%d\t", threads[i].tid);
+        for (size_t j = 0; j < target->nr_events; j++)
         {
-            fprintf(fp, "%llu,", measurements[i][j]);
+            printf("%lld\t", threads[i].values[j]);
         }
-        fprintf(fp, "\n");
+        printf("\n");
     }
-    fclose(fp);
-    return 0;
+    printf("\n");
+    free(threads);
 }
 
-void print_header(int nr_counters)
+void print_child_exit(const target *target)
 {
-    printf("<-- PAPI Counters -->\n");
-    for(size_t i = 0; i < nr_counters; i++)
+    const child_exit *exit_info = &target->exit;
+
+    printf("***** Monitored process %s *****\n", target->label);
+    if (!exit_info->reaped)
+    {
+        /* not a child of the monitor, the exit status is not available */
+        printf("pid %d exited\n", exit_info->pid);
+        printf("\n");
+        return;
+    }
+
+    double cpu_time = exit_info->rusage.ru_utime.tv_sec + exit_info->rusage.ru_stime.tv_sec +
+                      (exit_info->rusage.ru_utime.tv_usec + exit_info->rusage.ru_stime.tv_usec) / 1e6;
+
+    if (WIFEXITED(exit_info->status))
     {
-        printf("%s\t", PAPI_events[i].event_name);
+        printf("pid %d exited with status %d\n", exit_info->pid, WEXITSTATUS(exit_info->status));
     }
+    else if (WIFSIGNALED(exit_info->status))
+    {
+        printf("pid %d was killed by signal %d\n", exit_info->pid, WTERMSIG(exit_info->status));
+    }
+    printf("runtime:\t %.3f s\n", (double)(exit_info->exit_ns - target->start_ns) / 1e9);
+    printf("cpu time:\t %.3f s\n", cpu_time);
     printf("\n");
-    return;
 }
 
-long long calculate_counter_average(long long (*measurements), unsigned int num_measurements)
+/* the stacks of every target in one file, under a frame per target when there are several */
+void write_folded_stacks(const target_list *targets)
 {
-    long long sum = 0;
+    char file_name[48];
+    FILE *fp;
 
-    for(size_t i = 0; i < num_measurements; i++)
+    sprintf(file_name, "%dstacks.folded", targets->targets[0].pid);
+    fp = fopen(file_name, "w");
+    if (fp == NULL)
     {
-        sum += measurements[i];
+        printf("ERROR: could not create stack file %s\n", file_name);
+        return;
     }
+    for (unsigned int t = 0; t < targets->nr_targets; t++)
+    {
+        const target *target = &targets->targets[t];
 
-    return (sum/num_measurements);
+        ip_profiler_write_folded(target->profiler, targets->nr_targets > 1 ? target->label : NULL, fp);
+    }
+    if (fclose(fp) != 0)
+    {
+        printf("ERROR: could not write stack file %s\n", file_name);
+        return;
+    }
+    printf("Wrote the call stacks to %s\n", file_name);
 }
 
-void print_counter_averages(unsigned int nr_counters, long long (*measurements)[nr_counters], unsigned int num_measurements)
+/* prints the hotspots of every target and writes them all to <pid>hotspots.csv */
+void report_hotspots(const target_list *targets, int write_file)
 {
-    printf("\n");
-    printf("***** Average of captured metrics *****\n");
-    for (size_t i = 0; i < nr_counters; i++)
+    char file_name[48];
+    FILE *fp;
+
+    for (unsigned int t = 0; t < targets->nr_targets; t++)
     {
-        printf("%s:\t %lld\n", PAPI_events[i].event_name, calculate_counter_average(measurements[i], num_measurements));
+        ip_profiler_print(targets->targets[t].profiler, targets->targets[t].label);
+    }
+    if (!write_file)
+    {
+        return;
+    }
+    sprintf(file_name, "%dhotspots.csv", targets->targets[0].pid);
+    fp = fopen(file_name, "w");
+    if (fp == NULL)
+    {
+        printf("ERROR: could not create hotspot file %s\n", file_name);
+        return;
+    }
+    fprintf(fp, "target,function,module,samples,percent\n");
+    for (unsigned int t = 0; t < targets->nr_targets; t++)
+    {
+        ip_profiler_write(targets->targets[t].profiler, t, fp);
+    }
+    if (fclose(fp) != 0)
+    {
+        printf("ERROR: could not write hotspot file %s\n", file_name);
+        return;
+    }
+    printf("Wrote the hotspots to %s\n", file_name);
+    if (targets->targets[0].profiler->callchain)
+    {
+        write_folded_stacks(targets);
     }
-    printf("\n");
 }
 
-void print_help()
+int main(int argc, char const **argv)
 {
-    printf("\n");
-    printf("***** Process monitor *****\n");
-    printf("Usage: ./process_monitor <number of measurements> <interval in milliseconds> <write to file> <path to executable to be monitored> \n");
-    printf("Params: \n");
-    printf(" number of measurements \t <int> \t: number of measurements the monitor will perform before terminating \n");
-    printf(" interval in nanoseconds \t <int> \t: with which interval the monitor will take measurements of application \n");
-    printf(" write to file \t <int> \t \t: write measurements to CSV file (0 for yes, 1 for no) \n");
-    printf(" path to executable \t <string> <space seperated argument list> \t: path to the executable that the process monitor will spawn with the provided arguments\n");
-    printf("\n");
-    printf("Example: ./process_monitor 100 10000000 1 /home/janne/asm/instructionloop\n");
-    printf("Example: ./process_monitor 200 1 1 /home/janne/payloads/Palloc_program/Matmult/matmult 512 0 0\n");
-    printf("\n");
-    return;
-}
+    const char *backend_name = "papi";
+    unsigned int print_interval_ms = DEFAULT_PRINT_INTERVAL_MS;
+    int rates = 0;
+    enum output_format output_format = OUTPUT_CSV;
+    event_list events = {NULL, 0};
+    int multiplex = 0;
+    static metric_set metrics;
+    target_list targets = {NULL, 0};
+    int all_threads = 0;
+    int per_thread = 0;
+    unsigned int nr_samplers = 1;
+    int pin_samplers = 0;
+    cpu_set_t sampler_cpus;
+    int realtime = 0;
+    int batched_reads = 0;
+    const char *profile_event = NULL;
+    uint64_t profile_period = DEFAULT_PROFILE_PERIOD;
+    int callchain = 0;
+    int regions = 0;
+    uint64_t agent_period = 0;
+    int agent_samples;
+    long long budget = 0;
+    const char *regulated_event = DEFAULT_REGULATED_EVENT;
+    int regulated_index = -1;
+    enum throttle_method throttle_method = THROTTLE_SIGNAL;
+    const char *throttle_cgroup = NULL;
+    sampler_pool_config pool_config;
+    sigset_t stop_signals;
+    static const struct option long_options[] = {
+        {"backend", required_argument, NULL, 'b'},
+        {"events", required_argument, NULL, 'e'},
+        {"event-file", required_argument, NULL, OPT_EVENT_FILE},
+        {"multiplex", no_argument, NULL, OPT_MULTIPLEX},
+        {"metric", required_argument, NULL, 'm'},
+        {"metric-file", required_argument, NULL, OPT_METRIC_FILE},
+        {"cmd", required_argument, NULL, OPT_CMD},
+        {"pid", required_argument, NULL, OPT_PID},
+        {"threads", no_argument, NULL, OPT_THREADS},
+        {"per-thread", no_argument, NULL, OPT_PER_THREAD},
+        {"samplers", required_argument, NULL, OPT_SAMPLERS},
+        {"sampler-cpus", required_argument, NULL, OPT_SAMPLER_CPUS},
+        {"realtime", no_argument, NULL, OPT_REALTIME},
+        {"uring", no_argument, NULL, OPT_URING},
+        {"profile", required_argument, NULL, OPT_PROFILE},
+        {"profile-period", required_argument, NULL, OPT_PROFILE_PERIOD},
+        {"callchain", no_argument, NULL, OPT_CALLCHAIN},
+        {"regions", no_argument, NULL, OPT_REGIONS},
+        {"agent-period", required_argument, NULL, OPT_AGENT_PERIOD},
+        {"regulate", required_argument, NULL, OPT_REGULATE},
+        {"regulate-event", required_argument, NULL, OPT_REGULATE_EVENT},
+        {"throttle", required_argument, NULL, OPT_THROTTLE},
+        {"print-interval", required_argument, NULL, OPT_PRINT_INTERVAL},
+        {"rates", no_argument, NULL, OPT_RATES},
+        {"format", required_argument, NULL, OPT_FORMAT},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt_char;
+
+    /* '+' stops at the first positional so the arguments of the monitored executable are left alone */
+    while ((opt_char = getopt_long(argc, (char * const *)argv, "+b:e:m:h", long_options, NULL)) != -1)
+    {
+        switch (opt_char)
+        {
+        case 'b':
+            backend_name = optarg;
+            break;
+        case 'e':
+            if (event_list_parse(&events, optarg) != 0)
+            {
+                return -1;
+            }
+            break;
+        case OPT_EVENT_FILE:
+            if (event_list_load(&events, optarg) != 0)
+            {
+                return -1;
+            }
+            break;
+        case OPT_MULTIPLEX:
+            multiplex = 1;
+            break;
+        case 'm':
+            if (metric_set_add(&metrics, optarg) != 0)
+            {
+                return -1;
+            }
+            break;
+        case OPT_METRIC_FILE:
+            if (metric_set_load(&metrics, optarg) != 0)
+            {
+                return -1;
+            }
+            break;
+        case OPT_CMD:
+            if (target_list_add_command_line(&targets, optarg) != 0)
+            {
+                return -1;
+            }
+            break;
+        case OPT_PID:
+            if (target_list_add_pid(&targets, atoi(optarg)) != 0)
+            {
+                return -1;
+            }
+            break;
+        case OPT_THREADS:
+            all_threads = 1;
+            break;
+        case OPT_PER_THREAD:
+            per_thread = 1;
+            break;
+        case OPT_SAMPLERS:
+            nr_samplers = atoi(optarg);
+            break;
+        case OPT_SAMPLER_CPUS:
+            if (parse_cpu_list(optarg, &sampler_cpus) != 0)
+            {
+                return -1;
+            }
+            pin_samplers = 1;
+            break;
+        case OPT_REALTIME:
+            realtime = 1;
+            break;
+        case OPT_URING:
+            batched_reads = 1;
+            break;
+        case OPT_PROFILE:
+            profile_event = optarg;
+            break;
+        case OPT_PROFILE_PERIOD:
+            profile_period = strtoull(optarg, NULL, 10);
+            if (profile_period == 0)
+            {
+                printf("Error: the profile period must be at least 1\n");
+                return -1;
+            }
+            break;
+        case OPT_CALLCHAIN:
+            callchain = 1;
+            break;
+        case OPT_REGIONS:
+            regions = 1;
+            break;
+        case OPT_AGENT_PERIOD:
+            agent_period = strtoull(optarg, NULL, 10);
+            if (agent_period < AGENT_MIN_PERIOD_NS)
+            {
+                printf("Error: the agent period must be at least %d ns\n", AGENT_MIN_PERIOD_NS);
+                return -1;
+            }
+            break;
+        case OPT_REGULATE:
+            budget = atoll(optarg);
+            if (budget <= 0)
+            {
+                printf("Error: the regulation budget must be at least 1\n");
+                return -1;
+            }
+            break;
+        case OPT_REGULATE_EVENT:
+            regulated_event = optarg;
+            break;
+        case OPT_THROTTLE:
+            if (strcmp(optarg, "signal") == 0)
+            {
+                throttle_method = THROTTLE_SIGNAL;
+            }
+            else if (strncmp(optarg, "cgroup:", strlen("cgroup:")) == 0 && optarg[strlen("cgroup:")] != '\0')
+            {
+                throttle_method = THROTTLE_CGROUP;
+                throttle_cgroup = optarg + strlen("cgroup:");
+            }
+            else
+            {
+                printf("Error: unknown throttle method %s\n", optarg);
+                print_help();
+                return -1;
+            }
+            break;
+        case OPT_PRINT_INTERVAL:
+            print_interval_ms = atoi(optarg);
+            break;
+        case OPT_RATES:
+            rates = 1;
+            break;
+        case OPT_FORMAT:
+            if (strcmp(optarg, "csv") == 0)
+            {
+                output_format = OUTPUT_CSV;
+            }
+            else if (strcmp(optarg, "binary") == 0)
+            {
+                output_format = OUTPUT_BINARY;
+            }
+            else
+            {
+                printf("Error: unknown output format %s\n", optarg);
+                print_help();
+                return -1;
+            }
+            break;
+        case 'h':
+            print_help();
+            return 0;
+        default:
+            print_help();
+            return -1;
+        }
+    }
 
+    if (callchain && profile_event == NULL)
+    {
+        printf("Error: --callchain needs --profile\n");
+        return -1;
+    }
+    if (agent_period != 0 && strcmp(backend_name, "agent") != 0)
+    {
+        printf("Error: --agent-period needs --backend agent\n");
+        return -1;
+    }
+    if ((per_thread || all_threads) && strcmp(backend_name, "agent") == 0)
+    {
+        printf("Error: the agent backend counts the main thread, --per-thread and --threads are not supported\n");
+        return -1;
+    }
+    /* the L2 presets of the default set have no generic perf event, only libpfm4 can encode them */
+    for (size_t i = 0; events.nr_events == 0 && (strcmp(backend_name, "perf") == 0 || strcmp(backend_name, "agent") == 0) &&
+                       i < NELEMS(PAPI_events); i++)
+    {
+        struct perf_event_attr attr;
 
-int main(int argc, char const **argv)
-{
-    if (argc < 4)
+        if (perf_encode_event(PAPI_events[i].event_name, &attr) != 0)
+        {
+            printf("Error: the %s backend cannot encode the default event %s without libpfm4 at build time; "
+                   "name the events with -e, e.g. -e PAPI_TOT_INS,PAPI_TOT_CYC,PAPI_L3_TCM\n",
+                   backend_name, PAPI_events[i].event_name);
+            return -1;
+        }
+    }
+    if (argc - optind < 3 || (argc - optind == 3 && targets.nr_targets == 0))
     {
         printf("Error: too few arguments.\n");
         print_help();
         return -1;
     }
   
-    int num_measurements = atoi(argv[1]);
-    int PAPI_eventset = PAPI_NULL;
-    int sleep_time = (1000 * atoi(argv[2])); 
-    int write_to_file = atoi(argv[3]);
-    int return_code = 0;
-    char executable_path[256];
-    char *test = malloc(128);
+    int num_measurements = atoi(argv[optind]);
+    int sleep_time = (1000 * atoi(argv[optind + 1])); 
+    int write_to_file = atoi(argv[optind + 2]);
     char outputfile_name[64] = "output.csv";
-    char **spawn_args = (char**)malloc(512 * sizeof(char *));
 
-    for (size_t i = 0; i < argc; i++)
+    /* the executable and its arguments after the positionals are one more target */
+    if (argc - optind > 3 &&
+        target_list_add_command(&targets, argv + optind + 3, argc - optind - 3) != 0)
     {
-        spawn_args[i] = (char *)malloc(256 * sizeof(char));
-    }
-    
-    /* copy the executable path */
-    strcpy(executable_path, argv[4]);
-    executable_path[255] = '\0';
-
-    /* assign executable path to the first cmd-line argument */
-    spawn_args[0] = executable_path;
-
-    /* store command lines arguments for provided executable to argument array */
-    int j = 1;
-    for (size_t i = 5; i < argc; i++)
-    {
-        sprintf(spawn_args[j], "%s", argv[i]);
-        j++;
+        return -1;
     }
-    spawn_args[++j] = NULL;
 
     /* sanity check */    
     assert(sleep_time >= 0);
-    assert(num_measurements > 0);
-
-    int nr_counters = NELEMS(PAPI_events);
-    long long values[nr_counters];
-    long long values_storage[num_measurements][nr_counters];
-    PAPI_option_t opt;
+    assert(num_measurements >= 0);
+    if (strcmp(backend_name, "agent") == 0 &&
+        (uint64_t)sleep_time * 1000 / (agent_period != 0 ? agent_period : AGENT_DEFAULT_PERIOD_NS) > AGENT_RING_CAPACITY)
+    {
+        printf("Warning: the agent ring holds %d samples, fewer than the agent takes per interval; it will drop samples\n",
+               AGENT_RING_CAPACITY);
+    }
 
-    printf("PAPI Version: %d\n", PAPI_VER_CURRENT);
-    printf("Performing %d measurements with %d ms intervals\n", num_measurements, sleep_time/1000);
+    if (events.nr_events == 0)
+    {
+        for (size_t i = 0; i < NELEMS(PAPI_events); i++)
+        {
+            event_list_add(&events, PAPI_events[i].event_name);
+        }
+    }
+    int nr_counters = events.nr_events;
 
-    if (PAPI_library_init(PAPI_VER_CURRENT) != PAPI_VER_CURRENT)
+    if (metric_set_compile(&metrics, events.events, nr_counters) != 0)
     {
-        perror("Could not init PAPI\n");
-        exit(-1);
+        return -1;
     }
-    if (PAPI_create_eventset(&PAPI_eventset) != PAPI_OK)
+    for (int i = 0; budget > 0 && i < nr_counters; i++)
     {
-        perror("Could not create eventset\n");
-        exit(-1);
+        if (strcmp(events.events[i].event_name, regulated_event) == 0)
+        {
+            regulated_index = i;
+        }
+    }
+    if (budget > 0 && regulated_index < 0)
+    {
+        printf("Error: the regulated event %s is not counted, add it with -e\n", regulated_event);
+        return -1;
     }
 
-    memset(&opt, 0x0, sizeof(PAPI_option_t));
-    opt.inherit.inherit = PAPI_INHERIT_ALL;
-    opt.inherit.eventset = PAPI_eventset;
-
-    if (PAPI_assign_eventset_component(PAPI_eventset, 0) != PAPI_OK)
+    static sampler_pool pool;
+    static monitor_overhead overhead;
+    uint64_t end_ns;
+    sample_writer writer;
+    sample_writer_config writer_config;
+    const char *target_names[MAX_TARGETS];
+    static const struct pm_region_page *region_pages[MAX_TARGETS];
+    static ip_profiler *profilers[MAX_TARGETS];
+    char regions_file_name[48];
+    unsigned long long dropped_samples = 0;
+
+    /* every target gets its own event set, events are resolved and checked before any child exists */
+    for (unsigned int t = 0; t < targets.nr_targets; t++)
     {
-        printf("ERROR: PAPI_assign_eventset_component %d: %s\n", return_code, PAPI_strerror(return_code));
-        exit(-1);
+        target *target = &targets.targets[t];
+
+        if (target_init(target, backend_name, multiplex, events.events, nr_counters) != 0)
+        {
+            exit(-1);
+        }
+        target->all_threads = all_threads;
+        target->per_thread = per_thread;
+        target->regions = regions;
+        if (agent_period != 0)
+        {
+            target->backend->sample_period_ns = agent_period;
+        }
+        target->backend->read_period_ns = (uint64_t)sleep_time * 1000;
+        if (budget > 0 &&
+            (target->regulator = regulator_create(throttle_method, throttle_cgroup, regulated_index, budget)) == NULL)
+        {
+            exit(-1);
+        }
+        if (profile_event != NULL && (target->profiler = ip_profiler_create(profile_event, profile_period, callchain,
+                                                                            (uint64_t)sleep_time * 1000)) == NULL)
+        {
+            exit(-1);
+        }
+        target_names[t] = target->label;
     }
 
-    if (PAPI_set_opt(PAPI_INHERIT, &opt) != PAPI_OK)
+    printf("PAPI Version: %d\n", PAPI_VER_CURRENT);
+    printf("Counter backend: %s\n", targets.targets[0].backend->name);
+    if (targets.nr_targets > 1)
     {
-        printf("PAPI_set_opt error %d: %s\n", return_code, PAPI_strerror(return_code));
-        exit(-1);
+        printf("Monitoring %u processes\n", targets.nr_targets);
+    }
+    if (num_measurements == 0)
+    {
+        printf("Measuring with %d ms intervals until the process exits\n", sleep_time/1000);
+    }
+    else
+    {
+        printf("Performing %d measurements with %d ms intervals\n", num_measurements, sleep_time/1000);
     }
 
-    printf("Adding %d PAPI events to eventset\n", nr_counters);
+    /* Spawn the commands held in front of exec and attach a counter backend to every target */
 
-    for(size_t i = 0; i < nr_counters; i++)
+    for (unsigned int t = 0; t < targets.nr_targets; t++)
     {
-        if (PAPI_add_event(PAPI_eventset, PAPI_events[i].event) != PAPI_OK)
+        target *target = &targets.targets[t];
+
+        if (target_spawn(target) != 0)
         {
-            perror("could not add event to eventset\n");
             exit(-1);
         }
+        printf("Attaching to pid %d\n", target->pid);
+        if (target_attach(target) != 0)
+        {
+            exit(-1);
+        }
+        region_pages[t] = target->region_page.page;
+        profilers[t] = target->profiler;
+    }
+
+    /* stop signals are taken from the scheduler's signalfd, every thread started from here on blocks them */
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
+    /* Output is handled by the writer thread, the loop below only samples */
+
+    char file_name[32];
+    if (output_format == OUTPUT_BINARY)
+    {
+        strcpy(outputfile_name, "output.pmcol");
     }
-    
-    pid_t child_pid = fork();
-    if (child_pid < 0)
+    sprintf(file_name, "%d", targets.targets[0].pid);
+    strcat(file_name, outputfile_name);
+
+    memset(&writer_config, 0, sizeof(writer_config));
+    writer_config.events = events.events;
+    writer_config.nr_counters = nr_counters;
+    writer_config.print_interval_ms = print_interval_ms;
+    writer_config.output_filename = write_to_file == 0 ? file_name : NULL;
+    writer_config.format = output_format;
+    writer_config.rates = rates;
+    writer_config.coverage = multiplex;
+    writer_config.metrics = &metrics;
+    writer_config.target_names = target_names;
+    writer_config.nr_targets = targets.nr_targets;
+    /* the samples a backend takes on its own are written as a thread series */
+    agent_samples = targets.targets[0].backend->read_burst != NULL;
+    writer_config.per_thread = per_thread || agent_samples;
+    writer_config.profilers = profile_event != NULL ? profilers : NULL;
+    if (regions)
     {
-        perror("Fork() failed.\n");
-        exit(-1);
+        sprintf(regions_file_name, "%dregions.csv", targets.targets[0].pid);
+        writer_config.region_pages = region_pages;
+        writer_config.regions_filename = write_to_file == 0 ? regions_file_name : NULL;
     }
-    if (child_pid == 0)
+    writer_config.regulation = budget > 0;
+
+    memset(&pool_config, 0, sizeof(pool_config));
+    pool_config.nr_samplers = nr_samplers;
+    pool_config.period_ns = (uint64_t)sleep_time * 1000;
+    pool_config.num_measurements = num_measurements;
+    pool_config.ring_capacity = per_thread || agent_samples ? PER_THREAD_RING_CAPACITY : SAMPLE_RING_CAPACITY;
+    pool_config.pin = pin_samplers;
+    pool_config.cpus = sampler_cpus;
+    pool_config.realtime = realtime;
+    pool_config.batched_reads = batched_reads;
+
+    if (sampler_pool_init(&pool, &targets, &pool_config) != 0 ||
+        sample_writer_start(&writer, pool.rings, nr_samplers, &writer_config) != 0)
     {
-        printf("Started provided executable process with pid: %d\n", getpid());
-        execv(executable_path, spawn_args);
-        perror("Execv failed\n");
         exit(-1);
     }
-    else
-    {
-        /* Parent attaches PAPI to child */
+    active_writer = &writer;
+    signal(SIGUSR1, report_signal_handler);
 
-        printf("Attaching to pid %d\n", child_pid);
-        if (PAPI_attach(PAPI_eventset, child_pid) != PAPI_OK)
+    /* Start counters */
+
+    for (unsigned int t = 0; t < targets.nr_targets; t++)
+    {
+        if (target_start(&targets.targets[t]) != 0)
         {
-            perror("Could not attach PAPI to process");
             exit(-1);
         }
+    }
 
-        /* Start PAPI counters */
+    /* Counters are armed, let the spawned commands exec */
 
-        if (PAPI_start(PAPI_eventset) != PAPI_OK)
+    for (unsigned int t = 0; t < targets.nr_targets; t++)
+    {
+        if (target_release(&targets.targets[t]) != 0)
         {
-            perror("could not start PAPI\n");
             exit(-1);
         }
+    }
 
-        print_header(nr_counters);
-
-        /* Measure for num_measurements */
+    /* Measure for num_measurements on absolute deadlines, all targets on the same tick */
 
-        for (size_t i = 0; i < num_measurements; i++)
-        {
-            usleep(sleep_time);
-            
-            PAPI_read(PAPI_eventset, values);
-            /* Print counter values */
-            for(size_t j = 0; j < nr_counters; j++)
-            {
-                printf("%lld \t\t", values[j]);
-                values_storage[i][j] = values[j];
-            }
-            printf("\n");
-            PAPI_reset(PAPI_eventset);
-            
-            /* check if process still is active */
-            if(kill(child_pid, 0) < 0)
-            {
-                perror("Status check failed");
-                break;   
-            }
-        }
+    if (sampler_pool_start(&pool) != 0)
+    {
+        exit(-1);
+    }
+    sampler_pool_run(&pool, &stop_signals);
+    end_ns = monotonic_ns();
+    dropped_samples = sampler_pool_dropped_samples(&pool);
 
-        /* Stop PAPI counters */
-        PAPI_stop(PAPI_eventset, values);
+    /* Stop counters */
+    for (unsigned int t = 0; t < targets.nr_targets; t++)
+    {
+        target_stop(&targets.targets[t]);
+    }
 
-        /* Print the averages of collected data */
-        print_counter_averages(nr_counters, values_storage, num_measurements);
+    /* Flush the remaining samples, print statistics and write the output file */
+    signal(SIGUSR1, SIG_IGN);
+    active_writer = NULL;
+    sample_writer_finish(&writer);
+    /* the writer resolved the profile samples the samplers collected, the rest is left in the buffers */
+    for (unsigned int t = 0; profile_event != NULL && t < targets.nr_targets; t++)
+    {
+        ip_profiler_drain(targets.targets[t].profiler);
+    }
+    if (dropped_samples > 0)
+    {
+        printf("Warning: %llu samples dropped, writer could not keep up\n", dropped_samples);
+    }
 
-        /* Write output to file is requested */
+    /* What the monitor cost, next to the output file so the run can be judged later */
+    monitor_overhead_collect(&overhead, &pool, &writer, end_ns);
+    monitor_overhead_print(&overhead);
+    if (write_to_file == 0)
+    {
+        char overhead_file_name[48];
 
-        if (write_to_file == 0)
+        sprintf(overhead_file_name, "%doverhead.csv", targets.targets[0].pid);
+        if (monitor_overhead_write(&overhead, overhead_file_name) == 0)
+        {
+            printf("Wrote the monitor overhead to %s\n", overhead_file_name);
+        }
+    }
+    /* Functions ranked by instruction pointer samples, per target */
+    if (profile_event != NULL)
+    {
+        report_hotspots(&targets, write_to_file == 0);
+    }
+    for (unsigned int t = 0; t < targets.nr_targets; t++)
+    {
+        if (targets.targets[t].regulator != NULL)
         {
-            char file_name[32];
-            sprintf(file_name, "%d", child_pid);
-            strcat(file_name, outputfile_name);
-            printf("Writing measurements to output file %s\n", file_name);
-            write_measurements_to_csv_file(nr_counters, values_storage, num_measurements, file_name);
+            regulator_print(targets.targets[t].regulator, targets.targets[t].label, regulated_event);
         }
+        if (per_thread)
+        {
+            print_thread_breakdown(&targets.targets[t], events.events);
+        }
+        if (targets.targets[t].exit.pid != 0)
+        {
+            print_child_exit(&targets.targets[t]);
+        }
+    }
+
+    /* Kill the spawned processes that are still running, attached ones are only detached */
 
-        /* Kill the child process */
+    for (unsigned int t = 0; t < targets.nr_targets; t++)
+    {
+        target *target = &targets.targets[t];
 
-        if(kill(child_pid, SIGTERM) != 0)
+        if (target->exit.pid != 0)
+        {
+            continue;
+        }
+        if (target->kind == TARGET_PID)
+        {
+            target_detach(target);
+            printf("Detached from pid %d\n", target->pid);
+            continue;
+        }
+        if(kill(target->pid, SIGTERM) != 0)
         {
             perror("Could not terminate process.\n");
             exit(-1);
         }
-        printf("Application terminated.\n");
-        
-        PAPI_shutdown();
+        waitpid(target->pid, NULL, 0);
+        printf("Application %d terminated.\n", target->pid);
     }
+
+    monitor_overhead_destroy(&overhead);
+    sample_writer_destroy(&writer);
+    target_list_free(&targets);
+    sampler_pool_destroy(&pool);
+    event_list_free(&events);
+    metric_set_free(&metrics);
     return 0;
-}
\ No newline at end of file
+}
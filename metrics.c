@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "metrics.h"
+
+#define METRIC_IDENTIFIER_LEN 128
+
+/* recursive descent compiler state for one expression */
+struct metric_parser
+{
+    const char *text;
+    const char *position;
+    metric *target;
+    const metric_set *set;
+    unsigned int metric_index;
+    const PAPI_event *events;
+    unsigned int nr_events;
+    int failed;
+};
+
+typedef struct metric_parser metric_parser;
+
+static int parse_expression(metric_parser *parser);
+
+static void parser_error(metric_parser *parser, const char *message)
+{
+    if (!parser->failed)
+    {
+        printf("ERROR: metric %s: %s at \"%s\"\n", parser->target->name, message, parser->position);
+    }
+    parser->failed = 1;
+}
+
+static void skip_space(metric_parser *parser)
+{
+    while (isspace((unsigned char)*parser->position))
+    {
+        parser->position++;
+    }
+}
+
+static int emit(metric_parser *parser, enum metric_opcode opcode, unsigned int index, double constant)
+{
+    metric *target = parser->target;
+
+    if (target->nr_ops >= MAX_METRIC_OPS)
+    {
+        parser_error(parser, "expression is too long");
+        return -1;
+    }
+    target->program[target->nr_ops].opcode = opcode;
+    target->program[target->nr_ops].index = index;
+    target->program[target->nr_ops].constant = constant;
+    target->nr_ops++;
+    return 0;
+}
+
+static int emit_identifier(metric_parser *parser, const char *name)
+{
+    for (unsigned int i = 0; i < parser->nr_events; i++)
+    {
+        if (strcmp(parser->events[i].event_name, name) == 0)
+        {
+            return emit(parser, METRIC_OP_COUNTER, i, 0.0);
+        }
+    }
+    for (unsigned int i = 0; i < parser->metric_index; i++)
+    {
+        if (strcmp(parser->set->metrics[i].name, name) == 0)
+        {
+            return emit(parser, METRIC_OP_METRIC, i, 0.0);
+        }
+    }
+    if (strcmp(name, "interval_ns") == 0)
+    {
+        return emit(parser, METRIC_OP_INTERVAL_NS, 0, 0.0);
+    }
+    if (strcmp(name, "interval_s") == 0)
+    {
+        return emit(parser, METRIC_OP_INTERVAL_NS, 0, 0.0) || emit(parser, METRIC_OP_CONST, 0, 1e-9) ||
+               emit(parser, METRIC_OP_MUL, 0, 0.0);
+    }
+    parser_error(parser, "unknown event or metric");
+    return -1;
+}
+
+static int parse_primary(metric_parser *parser)
+{
+    char name[METRIC_IDENTIFIER_LEN];
+    size_t length = 0;
+
+    skip_space(parser);
+
+    if (*parser->position == '(')
+    {
+        parser->position++;
+        if (parse_expression(parser) != 0)
+        {
+            return -1;
+        }
+        skip_space(parser);
+        if (*parser->position != ')')
+        {
+            parser_error(parser, "expected ')'");
+            return -1;
+        }
+        parser->position++;
+        return 0;
+    }
+
+    if (isdigit((unsigned char)*parser->position) || *parser->position == '.')
+    {
+        char *end;
+        double constant = strtod(parser->position, &end);
+
+        parser->position = end;
+        return emit(parser, METRIC_OP_CONST, 0, constant);
+    }
+
+    /* {name} allows event names with characters that are operators otherwise */
+    if (*parser->position == '{')
+    {
+        const char *end = strchr(parser->position, '}');
+
+        if (end == NULL || (size_t)(end - parser->position - 1) >= sizeof(name))
+        {
+            parser_error(parser, "unterminated '{'");
+            return -1;
+        }
+        length = end - parser->position - 1;
+        memcpy(name, parser->position + 1, length);
+        name[length] = '\0';
+        parser->position = end + 1;
+        return emit_identifier(parser, name);
+    }
+
+    while (isalnum((unsigned char)parser->position[length]) || parser->position[length] == '_' ||
+           parser->position[length] == ':' || parser->position[length] == '.')
+    {
+        length++;
+    }
+    if (length == 0 || length >= sizeof(name))
+    {
+        parser_error(parser, "expected a number, a name or '('");
+        return -1;
+    }
+    memcpy(name, parser->position, length);
+    name[length] = '\0';
+    parser->position += length;
+    return emit_identifier(parser, name);
+}
+
+static int parse_unary(metric_parser *parser)
+{
+    skip_space(parser);
+    if (*parser->position == '-')
+    {
+        parser->position++;
+        return parse_unary(parser) || emit(parser, METRIC_OP_NEG, 0, 0.0);
+    }
+    return parse_primary(parser);
+}
+
+static int parse_term(metric_parser *parser)
+{
+    if (parse_unary(parser) != 0)
+    {
+        return -1;
+    }
+    for (;;)
+    {
+        char op;
+
+        skip_space(parser);
+        op = *parser->position;
+        if (op != '*' && op != '/')
+        {
+            return 0;
+        }
+        parser->position++;
+        if (parse_unary(parser) != 0 || emit(parser, op == '*' ? METRIC_OP_MUL : METRIC_OP_DIV, 0, 0.0) != 0)
+        {
+            return -1;
+        }
+    }
+}
+
+static int parse_expression(metric_parser *parser)
+{
+    if (parse_term(parser) != 0)
+    {
+        return -1;
+    }
+    for (;;)
+    {
+        char op;
+
+        skip_space(parser);
+        op = *parser->position;
+        if (op != '+' && op != '-')
+        {
+            return 0;
+        }
+        parser->position++;
+        if (parse_term(parser) != 0 || emit(parser, op == '+' ? METRIC_OP_ADD : METRIC_OP_SUB, 0, 0.0) != 0)
+        {
+            return -1;
+        }
+    }
+}
+
+int metric_set_add(metric_set *set, const char *definition)
+{
+    const char *equals = strchr(definition, '=');
+    metric *target;
+    size_t length;
+
+    if (set->nr_metrics >= MAX_METRICS)
+    {
+        printf("ERROR: too many metrics, at most %d are supported\n", MAX_METRICS);
+        return -1;
+    }
+    if (equals == NULL)
+    {
+        printf("ERROR: metric \"%s\" is not of the form name = expression\n", definition);
+        return -1;
+    }
+
+    target = &set->metrics[set->nr_metrics];
+    memset(target, 0, sizeof(metric));
+
+    while (isspace((unsigned char)*definition))
+    {
+        definition++;
+    }
+    length = equals - definition;
+    while (length > 0 && isspace((unsigned char)definition[length - 1]))
+    {
+        length--;
+    }
+    if (length == 0 || length >= MAX_METRIC_NAME)
+    {
+        printf("ERROR: metric \"%s\" has no valid name\n", definition);
+        return -1;
+    }
+    memcpy(target->name, definition, length);
+    target->expression = strdup(equals + 1);
+    if (target->expression == NULL)
+    {
+        perror("Could not store metric");
+        return -1;
+    }
+    set->nr_metrics++;
+    return 0;
+}
+
+int metric_set_load(metric_set *set, const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    char line[512];
+
+    if (fp == NULL)
+    {
+        perror("Could not open metric file");
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        char *comment = strchr(line, '#');
+        char *text = line;
+
+        if (comment != NULL)
+        {
+            *comment = '\0';
+        }
+        while (isspace((unsigned char)*text))
+        {
+            text++;
+        }
+        if (*text != '\0' && metric_set_add(set, text) != 0)
+        {
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+int metric_set_compile(metric_set *set, const PAPI_event *events, unsigned int nr_events)
+{
+    for (unsigned int i = 0; i < set->nr_metrics; i++)
+    {
+        metric_parser parser;
+
+        memset(&parser, 0, sizeof(parser));
+        parser.text = set->metrics[i].expression;
+        parser.position = parser.text;
+        parser.target = &set->metrics[i];
+        parser.set = set;
+        parser.metric_index = i;
+        parser.events = events;
+        parser.nr_events = nr_events;
+
+        set->metrics[i].nr_ops = 0;
+        if (parse_expression(&parser) != 0)
+        {
+            return -1;
+        }
+        skip_space(&parser);
+        if (*parser.position != '\0')
+        {
+            parser_error(&parser, "unexpected text");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void metric_set_evaluate(const metric_set *set, sample_record *record)
+{
+    double stack[MAX_METRIC_OPS];
+
+    for (unsigned int i = 0; i < set->nr_metrics; i++)
+    {
+        const metric *current = &set->metrics[i];
+        unsigned int top = 0;
+
+        for (unsigned int pc = 0; pc < current->nr_ops; pc++)
+        {
+            const metric_op *op = &current->program[pc];
+
+            switch (op->opcode)
+            {
+            case METRIC_OP_CONST:
+                stack[top++] = op->constant;
+                break;
+            case METRIC_OP_COUNTER:
+                stack[top++] = (double)record->values[op->index];
+                break;
+            case METRIC_OP_METRIC:
+                stack[top++] = record->metrics[op->index];
+                break;
+            case METRIC_OP_INTERVAL_NS:
+                stack[top++] = (double)record->interval_ns;
+                break;
+            case METRIC_OP_ADD:
+                top--;
+                stack[top - 1] += stack[top];
+                break;
+            case METRIC_OP_SUB:
+                top--;
+                stack[top - 1] -= stack[top];
+                break;
+            case METRIC_OP_MUL:
+                top--;
+                stack[top - 1] *= stack[top];
+                break;
+            case METRIC_OP_DIV:
+                top--;
+                stack[top - 1] = stack[top] != 0.0 ? stack[top - 1] / stack[top] : NAN;
+                break;
+            case METRIC_OP_NEG:
+                stack[top - 1] = -stack[top - 1];
+                break;
+            }
+        }
+        record->metrics[i] = top ? stack[0] : NAN;
+    }
+}
+
+void metric_set_free(metric_set *set)
+{
+    for (unsigned int i = 0; i < set->nr_metrics; i++)
+    {
+        free(set->metrics[i].expression);
+        set->metrics[i].expression = NULL;
+    }
+    set->nr_metrics = 0;
+}
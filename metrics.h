@@ -0,0 +1,75 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include "events.h"
+#include "sample.h"
+
+#define MAX_METRIC_NAME 48
+#define MAX_METRIC_OPS 64
+
+/**********
+ * Name: metric_set
+ * Description: derived metrics such as "ipc = PAPI_TOT_INS / PAPI_TOT_CYC".
+ * Expressions support + - * / unary minus, parentheses, numbers, event names,
+ * earlier metrics and interval_s / interval_ns. Names that contain '-' are
+ * written in braces, e.g. {task-clock}. Each expression is compiled once into
+ * a flat postfix program that is run on a small value stack per sample.
+ * Division by zero yields NaN. Functions return 0 on success, -1 after printing the reason.
+ * ********/
+
+enum metric_opcode
+{
+    METRIC_OP_CONST,
+    METRIC_OP_COUNTER,
+    METRIC_OP_METRIC,
+    METRIC_OP_INTERVAL_NS,
+    METRIC_OP_ADD,
+    METRIC_OP_SUB,
+    METRIC_OP_MUL,
+    METRIC_OP_DIV,
+    METRIC_OP_NEG
+};
+
+struct metric_op
+{
+    enum metric_opcode opcode;
+    unsigned int index;
+    double constant;
+};
+
+typedef struct metric_op metric_op;
+
+struct metric
+{
+    char name[MAX_METRIC_NAME];
+    char *expression;
+    metric_op program[MAX_METRIC_OPS];
+    unsigned int nr_ops;
+};
+
+typedef struct metric metric;
+
+struct metric_set
+{
+    metric metrics[MAX_METRICS];
+    unsigned int nr_metrics;
+};
+
+typedef struct metric_set metric_set;
+
+/* "name = expression", compiled later by metric_set_compile */
+int metric_set_add(metric_set *set, const char *definition);
+
+/* one definition per line, '#' starts a comment */
+int metric_set_load(metric_set *set, const char *path);
+
+/* resolves the names against the event set and compiles every expression */
+int metric_set_compile(metric_set *set, const PAPI_event *events, unsigned int nr_events);
+
+/* fills record->metrics from the counter values of the record */
+void metric_set_evaluate(const metric_set *set, sample_record *record);
+
+void metric_set_free(metric_set *set);
+
+#endif
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <string.h>
+#include "monitor_overhead.h"
+
+static double timeval_s(const struct timeval *time)
+{
+    return time->tv_sec + time->tv_usec / 1e6;
+}
+
+static double cpu_s(const struct rusage *rusage)
+{
+    return timeval_s(&rusage->ru_utime) + timeval_s(&rusage->ru_stime);
+}
+
+void monitor_overhead_collect(monitor_overhead *overhead, const sampler_pool *pool, const sample_writer *writer, uint64_t end_ns)
+{
+    memset(overhead, 0, sizeof(monitor_overhead));
+    overhead->wall_ns = end_ns - pool->start_ns;
+    getrusage(RUSAGE_SELF, &overhead->rusage);
+
+    counter_stats_init(&overhead->read_latency, 1.0);
+    sampler_pool_read_latency(pool, &overhead->read_latency);
+    overhead->nr_rings = pool->config.nr_samplers;
+    for (unsigned int s = 0; s < overhead->nr_rings; s++)
+    {
+        overhead->sampler_cpu_s += cpu_s(&pool->shards[s].rusage);
+        overhead->ring_high_water[s] = pool->shards[s].ring->high_water;
+    }
+    overhead->ring_capacity = pool->shards[0].ring->mask + 1;
+    overhead->dropped_samples = sampler_pool_dropped_samples(pool);
+
+    overhead->lateness = &writer->lateness;
+    overhead->missed_deadlines = writer->missed_deadlines;
+    overhead->nr_ticks = writer->nr_ticks;
+    overhead->nr_records = writer->nr_records;
+    overhead->bytes_written = writer->bytes_written;
+}
+
+static size_t fullest_ring(const monitor_overhead *overhead)
+{
+    size_t fullest = 0;
+
+    for (unsigned int s = 0; s < overhead->nr_rings; s++)
+    {
+        fullest = overhead->ring_high_water[s] > fullest ? overhead->ring_high_water[s] : fullest;
+    }
+    return fullest;
+}
+
+void monitor_overhead_print(const monitor_overhead *overhead)
+{
+    const counter_stats *read_latency = &overhead->read_latency;
+    double wall_s = overhead->wall_ns / 1e9;
+    double monitor_cpu_s = cpu_s(&overhead->rusage);
+
+    printf("***** Monitor overhead *****\n");
+    printf("cpu time:\t %.3f s user, %.3f s system (%.1f%% of one CPU over %.3f s)\n",
+           timeval_s(&overhead->rusage.ru_utime), timeval_s(&overhead->rusage.ru_stime),
+           wall_s > 0 ? 100.0 * monitor_cpu_s / wall_s : 0.0, wall_s);
+    printf("sampler cpu time:\t %.3f s\n", overhead->sampler_cpu_s);
+    printf("context switches:\t %ld voluntary, %ld involuntary\n", overhead->rusage.ru_nvcsw, overhead->rusage.ru_nivcsw);
+    printf("read latency:\t mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us (%llu reads)\n",
+           read_latency->mean / 1000, counter_stats_percentile(read_latency, 50.0) / 1000,
+           counter_stats_percentile(read_latency, 99.0) / 1000, read_latency->max / 1000,
+           (unsigned long long)read_latency->count);
+    printf("ring high-water:\t %zu of %zu records\n", fullest_ring(overhead), overhead->ring_capacity);
+    printf("dropped samples:\t %llu\n", overhead->dropped_samples);
+    printf("output bytes:\t %llu\n", (unsigned long long)overhead->bytes_written);
+    printf("\n");
+}
+
+int monitor_overhead_write(const monitor_overhead *overhead, const char *path)
+{
+    const counter_stats *read_latency = &overhead->read_latency;
+    FILE *fp = fopen(path, "w");
+    int failed;
+
+    if (fp == NULL)
+    {
+        printf("ERROR: could not create overhead file %s\n", path);
+        return -1;
+    }
+    fprintf(fp, "metric,value\n");
+    fprintf(fp, "wall_s,%.6f\n", overhead->wall_ns / 1e9);
+    fprintf(fp, "cpu_user_s,%.6f\n", timeval_s(&overhead->rusage.ru_utime));
+    fprintf(fp, "cpu_system_s,%.6f\n", timeval_s(&overhead->rusage.ru_stime));
+    fprintf(fp, "sampler_cpu_s,%.6f\n", overhead->sampler_cpu_s);
+    fprintf(fp, "voluntary_context_switches,%ld\n", overhead->rusage.ru_nvcsw);
+    fprintf(fp, "involuntary_context_switches,%ld\n", overhead->rusage.ru_nivcsw);
+    fprintf(fp, "max_rss_kb,%ld\n", overhead->rusage.ru_maxrss);
+    fprintf(fp, "reads,%llu\n", (unsigned long long)read_latency->count);
+    fprintf(fp, "read_latency_mean_ns,%.0f\n", read_latency->mean);
+    fprintf(fp, "read_latency_stddev_ns,%.0f\n", counter_stats_stddev(read_latency));
+    fprintf(fp, "read_latency_p50_ns,%.0f\n", counter_stats_percentile(read_latency, 50.0));
+    fprintf(fp, "read_latency_p90_ns,%.0f\n", counter_stats_percentile(read_latency, 90.0));
+    fprintf(fp, "read_latency_p99_ns,%.0f\n", counter_stats_percentile(read_latency, 99.0));
+    fprintf(fp, "read_latency_p99.9_ns,%.0f\n", counter_stats_percentile(read_latency, 99.9));
+    fprintf(fp, "read_latency_max_ns,%.0f\n", read_latency->max);
+    fprintf(fp, "ticks,%zu\n", overhead->nr_ticks);
+    fprintf(fp, "missed_deadlines,%llu\n", overhead->missed_deadlines);
+    fprintf(fp, "lateness_mean_ns,%.0f\n", overhead->lateness->mean);
+    fprintf(fp, "lateness_p99_ns,%.0f\n", counter_stats_percentile(overhead->lateness, 99.0));
+    fprintf(fp, "lateness_max_ns,%.0f\n", overhead->lateness->max);
+    fprintf(fp, "ring_capacity,%zu\n", overhead->ring_capacity);
+    for (unsigned int s = 0; s < overhead->nr_rings; s++)
+    {
+        fprintf(fp, "ring_high_water_%u,%zu\n", s, overhead->ring_high_water[s]);
+    }
+    fprintf(fp, "dropped_samples,%llu\n", overhead->dropped_samples);
+    fprintf(fp, "records_written,%zu\n", overhead->nr_records);
+    fprintf(fp, "output_bytes,%llu\n", (unsigned long long)overhead->bytes_written);
+
+    failed = ferror(fp);
+    if (fclose(fp) != 0 || failed)
+    {
+        printf("ERROR: could not write overhead file %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+void monitor_overhead_destroy(monitor_overhead *overhead)
+{
+    counter_stats_destroy(&overhead->read_latency);
+}
@@ -0,0 +1,52 @@
+#ifndef MONITOR_OVERHEAD_H
+#define MONITOR_OVERHEAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/resource.h>
+#include "counter_stats.h"
+#include "sample_ring.h"
+#include "sample_writer.h"
+#include "sampler_pool.h"
+
+/**********
+ * Name: monitor_overhead
+ * Description: what the monitor itself cost during a run, so every run states
+ * how much it disturbed the system and how far its samples can be trusted:
+ * CPU time of the monitor and of its samplers, the time each read of a target
+ * took, lateness against the deadlines, the fullest each sample ring got,
+ * dropped samples and the bytes written. Collected after the writer has
+ * finished, printed and optionally written as a sidecar CSV of metric,value rows.
+ * ********/
+
+struct monitor_overhead
+{
+    uint64_t wall_ns;
+    /* the whole monitor: supervisor, samplers and writer */
+    struct rusage rusage;
+    double sampler_cpu_s;
+    counter_stats read_latency;
+    const counter_stats *lateness;
+    unsigned long long missed_deadlines;
+    size_t nr_ticks;
+    unsigned int nr_rings;
+    size_t ring_capacity;
+    size_t ring_high_water[MAX_SAMPLERS];
+    unsigned long long dropped_samples;
+    size_t nr_records;
+    uint64_t bytes_written;
+};
+
+typedef struct monitor_overhead monitor_overhead;
+
+/* after the writer has finished, its lateness statistics are referenced, not copied */
+void monitor_overhead_collect(monitor_overhead *overhead, const sampler_pool *pool, const sample_writer *writer, uint64_t end_ns);
+
+void monitor_overhead_print(const monitor_overhead *overhead);
+
+/* returns 0 on success and -1 after printing the reason */
+int monitor_overhead_write(const monitor_overhead *overhead, const char *path);
+
+void monitor_overhead_destroy(monitor_overhead *overhead);
+
+#endif
@@ -0,0 +1,27 @@
+#include <stdlib.h>
+#include "output_sink.h"
+
+output_sink *output_sink_open(enum output_format format, const char *path, const output_columns *columns)
+{
+    switch (format)
+    {
+    case OUTPUT_CSV:
+        return csv_sink_open(path, columns);
+    case OUTPUT_BINARY:
+        return pmcol_sink_open(path, columns);
+    }
+    return NULL;
+}
+
+int output_sink_close(output_sink *sink, uint64_t *bytes_written)
+{
+    int return_code = sink->close(sink);
+
+    if (bytes_written != NULL)
+    {
+        *bytes_written = sink->bytes_written;
+    }
+
+    free(sink);
+    return return_code;
+}
@@ -0,0 +1,66 @@
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "events.h"
+#include "sample.h"
+#include "metrics.h"
+
+enum output_format
+{
+    OUTPUT_CSV,
+    OUTPUT_BINARY
+};
+
+/**********
+ * Name: output_sink
+ * Description: destination for flushed sample chunks. Sinks write records as
+ * they are handed over and never keep them. write() and close() return 0 on
+ * success and -1 on failure.
+ * ********/
+
+struct output_columns
+{
+    const PAPI_event *events;
+    unsigned int nr_counters;
+    /* add per-second rate columns next to the raw counts */
+    int rates;
+    /* add the scheduled fraction of every counter when multiplexing */
+    int coverage;
+    /* derived metric columns after the counters, may be NULL */
+    const metric_set *metrics;
+    /* a leading target column is added when more than one process is monitored */
+    unsigned int nr_targets;
+    /* add a tid column, 0 marks the record of the whole process */
+    int per_thread;
+    /* add the pm_region id and whether it changed within the interval */
+    int regions;
+    /* add the regulator's throttle decision and the fraction of the budget used */
+    int regulation;
+};
+
+typedef struct output_columns output_columns;
+
+typedef struct output_sink output_sink;
+
+struct output_sink
+{
+    const char *path;
+    output_columns columns;
+    uint64_t bytes_written;
+    int (*write)(output_sink *sink, const sample_record *records, size_t nr_records);
+    int (*close)(output_sink *sink);
+    void *priv;
+};
+
+/* returns NULL if the file cannot be created */
+output_sink *output_sink_open(enum output_format format, const char *path, const output_columns *columns);
+
+output_sink *csv_sink_open(const char *path, const output_columns *columns);
+output_sink *pmcol_sink_open(const char *path, const output_columns *columns);
+
+/* closes and frees the sink, bytes_written receives the final file size if not NULL */
+int output_sink_close(output_sink *sink, uint64_t *bytes_written);
+
+#endif
@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <papi.h>
+#include "counter_backend.h"
+
+/**********
+ * Name: papi_backend
+ * Description: counter backend on top of a PAPI eventset. Every read is a
+ * PAPI_read() followed by a PAPI_reset() so the values are deltas. PAPI does
+ * not expose enabled/running times, the real time between reads is used for both.
+ * With multiplexing PAPI scales the values itself; since it does not report
+ * per-event running times the coverage is estimated as hardware counters / events.
+ * Every monitored process has its own backend and eventset, the library is
+ * shared and only shut down with the last backend. Thread backends built
+ * with init_from() reuse the event codes their template has checked.
+ * ********/
+
+/* live backends sharing the PAPI library, thread backends come and go on the samplers */
+static atomic_uint papi_users = 0;
+
+struct papi_backend_priv
+{
+    int eventset;
+    unsigned int nr_events;
+    int *codes;
+    long long *stop_values;
+    long long previous_ns;
+    float coverage;
+    /* counted in papi_users */
+    int library_user;
+};
+
+typedef struct papi_backend_priv papi_backend_priv;
+
+/* eventset of the checked codes, scoped by the flags of the backend */
+static int papi_backend_eventset(counter_backend *backend)
+{
+    papi_backend_priv *priv = backend->priv;
+    PAPI_option_t opt;
+    int return_code = 0;
+
+    if (PAPI_create_eventset(&priv->eventset) != PAPI_OK)
+    {
+        perror("Could not create eventset\n");
+        return -1;
+    }
+
+    memset(&opt, 0x0, sizeof(PAPI_option_t));
+    opt.inherit.inherit = PAPI_INHERIT_ALL;
+    opt.inherit.eventset = priv->eventset;
+
+    if ((return_code = PAPI_assign_eventset_component(priv->eventset, 0)) != PAPI_OK)
+    {
+        printf("ERROR: PAPI_assign_eventset_component %d: %s\n", return_code, PAPI_strerror(return_code));
+        return -1;
+    }
+
+    /* a per-thread eventset counts only its own thread */
+    if (!backend->single_thread && (return_code = PAPI_set_opt(PAPI_INHERIT, &opt)) != PAPI_OK)
+    {
+        printf("PAPI_set_opt error %d: %s\n", return_code, PAPI_strerror(return_code));
+        return -1;
+    }
+
+    /* multiplexing has to be enabled before the first event is added */
+    priv->coverage = 1.0f;
+    if (backend->multiplex)
+    {
+        int hardware_counters = PAPI_num_cmp_hwctrs(0);
+
+        if ((return_code = PAPI_set_multiplex(priv->eventset)) != PAPI_OK)
+        {
+            printf("ERROR: PAPI_set_multiplex %d: %s\n", return_code, PAPI_strerror(return_code));
+            return -1;
+        }
+        if (hardware_counters > 0 && (unsigned int)hardware_counters < priv->nr_events)
+        {
+            priv->coverage = (float)hardware_counters / priv->nr_events;
+        }
+    }
+
+    for (size_t i = 0; i < priv->nr_events; i++)
+    {
+        if ((return_code = PAPI_add_event(priv->eventset, priv->codes[i])) != PAPI_OK)
+        {
+            char name[PAPI_MAX_STR_LEN] = "";
+
+            PAPI_event_code_to_name(priv->codes[i], name);
+            printf("ERROR: could not add event %s to eventset: %s\n", name, PAPI_strerror(return_code));
+            if (!backend->multiplex)
+            {
+                printf("The event set may be larger than the number of hardware counters, try --multiplex\n");
+            }
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int papi_backend_alloc(papi_backend_priv *priv, unsigned int nr_events)
+{
+    priv->nr_events = nr_events;
+    priv->codes = calloc(nr_events, sizeof(int));
+    priv->stop_values = calloc(nr_events, sizeof(long long));
+    if (priv->codes == NULL || priv->stop_values == NULL)
+    {
+        perror("Could not allocate PAPI value buffer");
+        return -1;
+    }
+    return 0;
+}
+
+static int papi_backend_init(counter_backend *backend, const PAPI_event *events, unsigned int nr_events)
+{
+    papi_backend_priv *priv = backend->priv;
+    int return_code = 0;
+
+    if (papi_users == 0 && PAPI_library_init(PAPI_VER_CURRENT) != PAPI_VER_CURRENT)
+    {
+        perror("Could not init PAPI\n");
+        return -1;
+    }
+    /* event sets are read from the sampler threads */
+    if (papi_users == 0 && (return_code = PAPI_thread_init((unsigned long (*)(void))pthread_self)) != PAPI_OK)
+    {
+        printf("ERROR: PAPI_thread_init %d: %s\n", return_code, PAPI_strerror(return_code));
+        return -1;
+    }
+    papi_users++;
+    priv->library_user = 1;
+    if (backend->multiplex && papi_users == 1 && (return_code = PAPI_multiplex_init()) != PAPI_OK)
+    {
+        printf("ERROR: PAPI_multiplex_init %d: %s\n", return_code, PAPI_strerror(return_code));
+        return -1;
+    }
+    if (papi_backend_alloc(priv, nr_events) != 0)
+    {
+        return -1;
+    }
+
+    /* resolve every name first so all unusable events are reported at once */
+    int unusable = 0;
+    for (size_t i = 0; i < nr_events; i++)
+    {
+        if (PAPI_event_name_to_code(events[i].event_name, &priv->codes[i]) != PAPI_OK)
+        {
+            printf("ERROR: unknown PAPI event %s\n", events[i].event_name);
+            unusable++;
+        }
+        else if (PAPI_query_event(priv->codes[i]) != PAPI_OK)
+        {
+            printf("ERROR: event %s is not supported on this hardware\n", events[i].event_name);
+            unusable++;
+        }
+    }
+    if (unusable > 0)
+    {
+        return -1;
+    }
+
+    printf("Adding %d PAPI events to eventset\n", nr_events);
+    return papi_backend_eventset(backend);
+}
+
+static int papi_backend_init_from(counter_backend *backend, const counter_backend *template)
+{
+    papi_backend_priv *priv = backend->priv;
+    const papi_backend_priv *from = template->priv;
+
+    /* the template holds the library, it was initialized with it */
+    papi_users++;
+    priv->library_user = 1;
+    if (papi_backend_alloc(priv, from->nr_events) != 0)
+    {
+        return -1;
+    }
+    memcpy(priv->codes, from->codes, from->nr_events * sizeof(int));
+    return papi_backend_eventset(backend);
+}
+
+static int papi_backend_attach(counter_backend *backend, pid_t pid)
+{
+    papi_backend_priv *priv = backend->priv;
+
+    if (PAPI_attach(priv->eventset, pid) != PAPI_OK)
+    {
+        perror("Could not attach PAPI to process");
+        return -1;
+    }
+    return 0;
+}
+
+static int papi_backend_start(counter_backend *backend)
+{
+    papi_backend_priv *priv = backend->priv;
+
+    if (PAPI_start(priv->eventset) != PAPI_OK)
+    {
+        perror("could not start PAPI\n");
+        return -1;
+    }
+    priv->previous_ns = PAPI_get_real_nsec();
+    return 0;
+}
+
+static int papi_backend_read(counter_backend *backend, sample_record *record)
+{
+    papi_backend_priv *priv = backend->priv;
+    long long now;
+
+    if (PAPI_read(priv->eventset, record->values) != PAPI_OK)
+    {
+        return -1;
+    }
+    PAPI_reset(priv->eventset);
+
+    now = PAPI_get_real_nsec();
+    record->time_enabled_ns = now - priv->previous_ns;
+    record->time_running_ns = record->time_enabled_ns;
+    priv->previous_ns = now;
+    for (size_t i = 0; i < priv->nr_events; i++)
+    {
+        record->coverage[i] = priv->coverage;
+    }
+    return 0;
+}
+
+static int papi_backend_stop(counter_backend *backend)
+{
+    papi_backend_priv *priv = backend->priv;
+
+    PAPI_stop(priv->eventset, priv->stop_values);
+    return 0;
+}
+
+static int papi_backend_detach(counter_backend *backend)
+{
+    papi_backend_priv *priv = backend->priv;
+    int return_code;
+
+    if ((return_code = PAPI_detach(priv->eventset)) != PAPI_OK)
+    {
+        printf("ERROR: PAPI_detach %d: %s\n", return_code, PAPI_strerror(return_code));
+        return -1;
+    }
+    return 0;
+}
+
+static void papi_backend_destroy(counter_backend *backend)
+{
+    papi_backend_priv *priv = backend->priv;
+
+    if (priv->library_user && --papi_users == 0)
+    {
+        PAPI_shutdown();
+    }
+    free(priv->codes);
+    free(priv->stop_values);
+    free(priv);
+    free(backend);
+}
+
+counter_backend *papi_backend_create(void)
+{
+    counter_backend *backend = calloc(1, sizeof(counter_backend));
+    papi_backend_priv *priv = calloc(1, sizeof(papi_backend_priv));
+
+    if (backend == NULL || priv == NULL)
+    {
+        free(backend);
+        free(priv);
+        return NULL;
+    }
+    priv->eventset = PAPI_NULL;
+
+    backend->name = "papi";
+    backend->init = papi_backend_init;
+    backend->init_from = papi_backend_init_from;
+    backend->attach = papi_backend_attach;
+    backend->start = papi_backend_start;
+    backend->read = papi_backend_read;
+    backend->stop = papi_backend_stop;
+    backend->detach = papi_backend_detach;
+    backend->destroy = papi_backend_destroy;
+    backend->priv = priv;
+    return backend;
+}
@@ -0,0 +1,498 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <papi.h>
+#ifdef HAVE_LIBPFM
+#include <perfmon/pfmlib_perf_event.h>
+#endif
+#include "counter_backend.h"
+#include "perf_backend.h"
+
+/**********
+ * Name: perf_backend
+ * Description: counter backend built directly on perf_event_open. All events
+ * are opened as one group with PERF_FORMAT_GROUP so a single read() returns
+ * every counter together with time_enabled and time_running. Counters are
+ * never reset; deltas are computed against the previous read.
+ * In multiplex mode every event is its own group so the kernel can rotate them
+ * over the available counters; each delta is then scaled by its own
+ * time_enabled/time_running and that ratio is reported as coverage.
+ * With enable_on_exec the group leaders are enabled by the kernel when the
+ * attached process calls exec(), start() has nothing left to do.
+ * The reads are also exposed split in requests and completion, so a sampler
+ * can issue the reads of many backends in one batch.
+ * ********/
+
+struct perf_generic_event
+{
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+};
+
+typedef struct perf_generic_event perf_generic_event;
+
+#define HW_CACHE_CONFIG(cache, op, result) \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+static const perf_generic_event perf_generic_events[] = {
+    {"PAPI_TOT_INS", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"PAPI_TOT_CYC", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"PAPI_L3_TCA", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+    {"PAPI_L3_TCM", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"PAPI_BR_INS", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+    {"PAPI_BR_MSP", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"PAPI_L1_DCM", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {"PAPI_TLB_DM", PERF_TYPE_HW_CACHE, HW_CACHE_CONFIG(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"cache-references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+    {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    {"cpu-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK},
+    {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    {"cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS}
+};
+
+#define NR_GENERIC_EVENTS (sizeof(perf_generic_events) / sizeof(perf_generic_events[0]))
+
+struct perf_backend_priv
+{
+    unsigned int nr_events;
+    struct perf_event_attr *attrs;
+    int *fds;
+    uint64_t *read_buffer;
+    const char **names;
+    uint64_t *previous;
+    uint64_t previous_enabled;
+    uint64_t previous_running;
+    uint64_t *previous_event_enabled;
+    uint64_t *previous_event_running;
+};
+
+typedef struct perf_backend_priv perf_backend_priv;
+
+/* layout of a PERF_FORMAT_GROUP | TOTAL_TIME_ENABLED | TOTAL_TIME_RUNNING read */
+struct perf_group_read
+{
+    uint64_t nr;
+    uint64_t time_enabled;
+    uint64_t time_running;
+    uint64_t values[];
+};
+
+int sys_perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu, int group_fd, unsigned long flags)
+{
+    return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+#ifdef HAVE_LIBPFM
+static int perf_encode_with_libpfm(const char *name, struct perf_event_attr *attr)
+{
+    static int pfm_initialized = 0;
+    char native_name[PAPI_2MAX_STR_LEN];
+    pfm_perf_encode_arg_t arg;
+    int code;
+
+    if (!pfm_initialized)
+    {
+        if (pfm_initialize() != PFM_SUCCESS)
+        {
+            return -1;
+        }
+        pfm_initialized = 1;
+    }
+
+    /* PAPI presets are translated to the single native event behind them */
+    snprintf(native_name, sizeof(native_name), "%s", name);
+    if (strncmp(name, "PAPI_", 5) == 0)
+    {
+        PAPI_event_info_t info;
+
+        if (PAPI_is_initialized() == PAPI_NOT_INITED && PAPI_library_init(PAPI_VER_CURRENT) != PAPI_VER_CURRENT)
+        {
+            return -1;
+        }
+        if (PAPI_event_name_to_code(name, &code) != PAPI_OK || PAPI_get_event_info(code, &info) != PAPI_OK)
+        {
+            return -1;
+        }
+        if (info.count != 1)
+        {
+            printf("ERROR: %s is derived from %u native events, list them individually for the perf backend\n", name, info.count);
+            return -1;
+        }
+        snprintf(native_name, sizeof(native_name), "%s", info.name[0]);
+    }
+
+    memset(&arg, 0, sizeof(arg));
+    arg.attr = attr;
+    arg.size = sizeof(arg);
+    if (pfm_get_os_event_encoding(native_name, PFM_PLM3, PFM_OS_PERF_EVENT, &arg) != PFM_SUCCESS)
+    {
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+int perf_encode_event(const char *name, struct perf_event_attr *attr)
+{
+    memset(attr, 0, sizeof(struct perf_event_attr));
+    attr->size = sizeof(struct perf_event_attr);
+
+    for (size_t i = 0; i < NR_GENERIC_EVENTS; i++)
+    {
+        if (strcmp(perf_generic_events[i].name, name) == 0)
+        {
+            attr->type = perf_generic_events[i].type;
+            attr->config = perf_generic_events[i].config;
+            return 0;
+        }
+    }
+
+    /* raw PMU encoding, e.g. r01c4 */
+    if (name[0] == 'r' && name[1] != '\0')
+    {
+        char *end;
+
+        attr->config = strtoull(name + 1, &end, 16);
+        if (*end == '\0')
+        {
+            attr->type = PERF_TYPE_RAW;
+            return 0;
+        }
+    }
+
+#ifdef HAVE_LIBPFM
+    if (perf_encode_with_libpfm(name, attr) == 0)
+    {
+        attr->size = sizeof(struct perf_event_attr);
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+static void perf_backend_close_fds(perf_backend_priv *priv)
+{
+    for (size_t i = 0; priv->fds != NULL && i < priv->nr_events; i++)
+    {
+        if (priv->fds[i] >= 0)
+        {
+            close(priv->fds[i]);
+            priv->fds[i] = -1;
+        }
+    }
+}
+
+static int perf_backend_attach(counter_backend *backend, pid_t pid)
+{
+    perf_backend_priv *priv = backend->priv;
+
+    for (size_t i = 0; i < priv->nr_events; i++)
+    {
+        int group_fd = (i == 0 || backend->multiplex) ? -1 : priv->fds[0];
+
+        priv->fds[i] = sys_perf_event_open(&priv->attrs[i], pid, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+        if (priv->fds[i] < 0)
+        {
+            printf("ERROR: perf_event_open for event %s on pid %d: %s\n", priv->names[i], pid, strerror(errno));
+            perf_backend_close_fds(priv);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int perf_backend_alloc(perf_backend_priv *priv, unsigned int nr_events)
+{
+    priv->nr_events = nr_events;
+    priv->attrs = calloc(nr_events, sizeof(struct perf_event_attr));
+    priv->fds = malloc(nr_events * sizeof(int));
+    /* a group read, or value, enabled and running of every event in multiplex mode */
+    priv->read_buffer = calloc(3 * nr_events + 3, sizeof(uint64_t));
+    priv->previous = calloc(nr_events, sizeof(uint64_t));
+    priv->names = calloc(nr_events, sizeof(char *));
+    priv->previous_event_enabled = calloc(nr_events, sizeof(uint64_t));
+    priv->previous_event_running = calloc(nr_events, sizeof(uint64_t));
+    if (priv->attrs == NULL || priv->fds == NULL || priv->read_buffer == NULL || priv->previous == NULL || priv->names == NULL ||
+        priv->previous_event_enabled == NULL || priv->previous_event_running == NULL)
+    {
+        perror("Could not allocate perf backend");
+        return -1;
+    }
+    for (size_t i = 0; i < nr_events; i++)
+    {
+        priv->fds[i] = -1;
+    }
+    return 0;
+}
+
+/* scope and grouping of the encoded events, from the flags of the backend */
+static void perf_backend_scope(counter_backend *backend)
+{
+    perf_backend_priv *priv = backend->priv;
+
+    for (size_t i = 0; i < priv->nr_events; i++)
+    {
+        struct perf_event_attr *attr = &priv->attrs[i];
+
+        /* same scope as the PAPI eventset: user space only, inherited by children */
+        attr->exclude_kernel = 1;
+        attr->exclude_hv = 1;
+        attr->inherit = !backend->single_thread;
+        if (backend->multiplex)
+        {
+            attr->disabled = 1;
+            attr->enable_on_exec = backend->enable_on_exec;
+            attr->read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        }
+        else
+        {
+            attr->disabled = (i == 0);
+            attr->enable_on_exec = (i == 0) && backend->enable_on_exec;
+            attr->read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        }
+    }
+}
+
+static int perf_backend_init(counter_backend *backend, const PAPI_event *events, unsigned int nr_events)
+{
+    perf_backend_priv *priv = backend->priv;
+
+    if (perf_backend_alloc(priv, nr_events) != 0)
+    {
+        return -1;
+    }
+
+    printf("Encoding %d events for perf_event_open\n", nr_events);
+
+    for (size_t i = 0; i < nr_events; i++)
+    {
+        priv->names[i] = events[i].event_name;
+        if (perf_encode_event(events[i].event_name, &priv->attrs[i]) != 0)
+        {
+            printf("ERROR: no perf encoding for event %s\n", events[i].event_name);
+            return -1;
+        }
+    }
+    perf_backend_scope(backend);
+
+    /* open the group on ourselves once so unsupported events fail before a child is started */
+    if (perf_backend_attach(backend, 0) != 0)
+    {
+        printf("ERROR: the event set is not supported on this hardware\n");
+        return -1;
+    }
+    perf_backend_close_fds(priv);
+    return 0;
+}
+
+static int perf_backend_init_from(counter_backend *backend, const counter_backend *template)
+{
+    perf_backend_priv *priv = backend->priv;
+    const perf_backend_priv *from = template->priv;
+
+    if (perf_backend_alloc(priv, from->nr_events) != 0)
+    {
+        return -1;
+    }
+    memcpy(priv->attrs, from->attrs, from->nr_events * sizeof(struct perf_event_attr));
+    memcpy(priv->names, from->names, from->nr_events * sizeof(char *));
+    perf_backend_scope(backend);
+    return 0;
+}
+
+static int perf_backend_start(counter_backend *backend)
+{
+    perf_backend_priv *priv = backend->priv;
+    size_t nr_groups = backend->multiplex ? priv->nr_events : 1;
+
+    if (backend->enable_on_exec)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < nr_groups; i++)
+    {
+        if (ioctl(priv->fds[i], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) < 0)
+        {
+            perror("could not enable perf event group");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int perf_backend_read_requests(counter_backend *backend, counter_read *reads)
+{
+    perf_backend_priv *priv = backend->priv;
+
+    if (!backend->multiplex)
+    {
+        reads[0].fd = priv->fds[0];
+        reads[0].buffer = priv->read_buffer;
+        reads[0].size = (3 + priv->nr_events) * sizeof(uint64_t);
+        return 1;
+    }
+    /* one read() per event, value, enabled and running side by side in the buffer */
+    for (size_t i = 0; i < priv->nr_events; i++)
+    {
+        reads[i].fd = priv->fds[i];
+        reads[i].buffer = &priv->read_buffer[3 * i];
+        reads[i].size = 3 * sizeof(uint64_t);
+    }
+    return priv->nr_events;
+}
+
+/* each event scaled by its own enabled/running times */
+static void perf_backend_complete_multiplexed(perf_backend_priv *priv, sample_record *record)
+{
+    for (size_t i = 0; i < priv->nr_events; i++)
+    {
+        uint64_t *counts = &priv->read_buffer[3 * i];
+        uint64_t delta, enabled, running;
+
+        delta = counts[0] - priv->previous[i];
+        enabled = counts[1] - priv->previous_event_enabled[i];
+        running = counts[2] - priv->previous_event_running[i];
+        priv->previous[i] = counts[0];
+        priv->previous_event_enabled[i] = counts[1];
+        priv->previous_event_running[i] = counts[2];
+
+        if (running == 0)
+        {
+            record->values[i] = 0;
+            record->coverage[i] = 0.0f;
+        }
+        else
+        {
+            record->values[i] = (long long)((double)delta * enabled / running);
+            record->coverage[i] = enabled ? (float)running / enabled : 1.0f;
+        }
+        if (i == 0)
+        {
+            record->time_enabled_ns = enabled;
+            record->time_running_ns = running;
+        }
+    }
+}
+
+static int perf_backend_read_complete(counter_backend *backend, sample_record *record)
+{
+    perf_backend_priv *priv = backend->priv;
+    struct perf_group_read *group = (struct perf_group_read *)priv->read_buffer;
+    float coverage;
+
+    if (backend->multiplex)
+    {
+        perf_backend_complete_multiplexed(priv, record);
+        return 0;
+    }
+
+    for (size_t i = 0; i < priv->nr_events; i++)
+    {
+        record->values[i] = (long long)(group->values[i] - priv->previous[i]);
+        priv->previous[i] = group->values[i];
+    }
+    record->time_enabled_ns = group->time_enabled - priv->previous_enabled;
+    record->time_running_ns = group->time_running - priv->previous_running;
+    priv->previous_enabled = group->time_enabled;
+    priv->previous_running = group->time_running;
+
+    /* a group is scheduled all or nothing, every event shares its coverage */
+    coverage = record->time_enabled_ns ? (float)record->time_running_ns / record->time_enabled_ns : 1.0f;
+    for (size_t i = 0; i < priv->nr_events; i++)
+    {
+        record->coverage[i] = coverage;
+    }
+    return 0;
+}
+
+static int perf_backend_read(counter_backend *backend, sample_record *record)
+{
+    counter_read reads[MAX_COUNTERS];
+    int nr_reads = perf_backend_read_requests(backend, reads);
+
+    for (int i = 0; i < nr_reads; i++)
+    {
+        if (read(reads[i].fd, reads[i].buffer, reads[i].size) != (ssize_t)reads[i].size)
+        {
+            return -1;
+        }
+    }
+    return perf_backend_read_complete(backend, record);
+}
+
+static int perf_backend_stop(counter_backend *backend)
+{
+    perf_backend_priv *priv = backend->priv;
+    size_t nr_groups = backend->multiplex ? priv->nr_events : 1;
+
+    for (size_t i = 0; i < nr_groups; i++)
+    {
+        if (priv->fds[i] >= 0)
+        {
+            ioctl(priv->fds[i], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+    return 0;
+}
+
+static int perf_backend_detach(counter_backend *backend)
+{
+    /* closing the last fd of an event removes it from the task */
+    perf_backend_close_fds(backend->priv);
+    return 0;
+}
+
+static void perf_backend_destroy(counter_backend *backend)
+{
+    perf_backend_priv *priv = backend->priv;
+
+    perf_backend_close_fds(priv);
+    free(priv->attrs);
+    free(priv->names);
+    free(priv->fds);
+    free(priv->read_buffer);
+    free(priv->previous);
+    free(priv->previous_event_enabled);
+    free(priv->previous_event_running);
+    free(priv);
+    free(backend);
+}
+
+counter_backend *perf_backend_create(void)
+{
+    counter_backend *backend = calloc(1, sizeof(counter_backend));
+    perf_backend_priv *priv = calloc(1, sizeof(perf_backend_priv));
+
+    if (backend == NULL || priv == NULL)
+    {
+        free(backend);
+        free(priv);
+        return NULL;
+    }
+
+    backend->name = "perf";
+    backend->init = perf_backend_init;
+    backend->init_from = perf_backend_init_from;
+    backend->attach = perf_backend_attach;
+    backend->start = perf_backend_start;
+    backend->read = perf_backend_read;
+    backend->read_requests = perf_backend_read_requests;
+    backend->read_complete = perf_backend_read_complete;
+    backend->stop = perf_backend_stop;
+    backend->detach = perf_backend_detach;
+    backend->destroy = perf_backend_destroy;
+    backend->priv = priv;
+    return backend;
+}
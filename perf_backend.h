@@ -0,0 +1,18 @@
+#ifndef PERF_BACKEND_H
+#define PERF_BACKEND_H
+
+#include <sys/types.h>
+#include <linux/perf_event.h>
+
+/**********
+ * Name: perf_encode_event
+ * Description: fills type/config of attr for the given event name. Accepts the
+ * PAPI preset names that have a generic perf equivalent, perf style names
+ * ("instructions", "task-clock", ...) and raw encodings ("r01c4"). When built
+ * with libpfm4 any native event name known to libpfm is accepted as well.
+ * ********/
+int perf_encode_event(const char *name, struct perf_event_attr *attr);
+
+int sys_perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu, int group_fd, unsigned long flags);
+
+#endif
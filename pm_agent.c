@@ -0,0 +1,359 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "agent_ring.h"
+
+/**********
+ * Name: pm_agent
+ * Description: sampling agent preloaded into commands monitored with the
+ * agent backend. Reading another process's counters always takes a syscall,
+ * the agent reads its own: its constructor opens the events of the ring as
+ * one group on the main thread and arms a timer that delivers AGENT_SIGNAL
+ * to that thread every period. The handler runs on the counted thread, so it
+ * reads the counters with rdpmc through the mmap'd perf pages and takes the
+ * time from the vDSO, without entering the kernel. An event that is not on a
+ * hardware counter (software events, no PMU, rdpmc disabled in
+ * /sys/bus/event_source/devices/cpu/rdpmc) has no index in its page, the
+ * sample then falls back to one read() of the group.
+ * Only the main thread is counted. The signal interrupts the sleeps of the
+ * main thread (nanosleep() and friends return early with EINTR, other
+ * syscalls are restarted), and AGENT_SIGNAL must be left to the agent.
+ * An exec() of the process loads the agent again; the totals continue from
+ * the last sample in the ring. The destructor takes a final sample at exit().
+ * Nothing is done in processes without a ring of their pid, e.g. the
+ * children of the command.
+ * ********/
+
+#define AGENT_SIGNAL (SIGRTMAX)
+
+struct agent_group_read
+{
+    uint64_t nr;
+    uint64_t time_enabled;
+    uint64_t time_running;
+    uint64_t values[AGENT_MAX_EVENTS];
+};
+
+struct agent
+{
+    struct agent_ring *ring;
+    pid_t pid;
+    unsigned int nr_events;
+    int fds[AGENT_MAX_EVENTS];
+    /* NULL when the page of the event could not be mapped */
+    struct perf_event_mmap_page *pages[AGENT_MAX_EVENTS];
+    size_t page_size;
+    int rdpmc;
+    timer_t timer;
+    /* totals of an earlier image of the process, see exec() above */
+    struct agent_sample base;
+    /* a sample is being taken, the handler and the destructor never write one together */
+    int busy;
+};
+
+static struct agent agent;
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline uint64_t agent_rdpmc(uint32_t counter)
+{
+    uint32_t low, high;
+
+    __asm__ volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(counter));
+    return low | (uint64_t)high << 32;
+}
+
+static inline uint64_t agent_rdtsc(void)
+{
+    uint32_t low, high;
+
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return low | (uint64_t)high << 32;
+}
+
+/* the self-monitoring read of perf_event_open(2), -1 if an event is not on a hardware counter right now */
+static int agent_read_rdpmc(struct agent_sample *sample)
+{
+    for (unsigned int e = 0; e < agent.nr_events; e++)
+    {
+        volatile struct perf_event_mmap_page *page = agent.pages[e];
+        uint64_t count, enabled, running, delta;
+        uint32_t sequence, index;
+
+        do
+        {
+            sequence = page->lock;
+            __asm__ volatile("" ::: "memory");
+            index = page->index;
+            if (!page->cap_user_rdpmc || index == 0)
+            {
+                return -1;
+            }
+            /* the counter is pmc_width bits wide and sign extended */
+            int64_t pmc = agent_rdpmc(index - 1) << (64 - page->pmc_width);
+            count = page->offset + (pmc >> (64 - page->pmc_width));
+            enabled = page->time_enabled;
+            running = page->time_running;
+            delta = 0;
+            if (page->cap_user_time)
+            {
+                uint64_t cycles = agent_rdtsc();
+                uint64_t quotient = cycles >> page->time_shift;
+                uint64_t remainder = cycles & (((uint64_t)1 << page->time_shift) - 1);
+
+                delta = page->time_offset + quotient * page->time_mult + ((remainder * page->time_mult) >> page->time_shift);
+            }
+            __asm__ volatile("" ::: "memory");
+        } while (page->lock != sequence);
+
+        sample->values[e] = agent.base.values[e] + count;
+        if (e == 0)
+        {
+            sample->time_enabled_ns = agent.base.time_enabled_ns + enabled + delta;
+            sample->time_running_ns = agent.base.time_running_ns + running + delta;
+        }
+    }
+    return 0;
+}
+#else
+static int agent_read_rdpmc(struct agent_sample *sample)
+{
+    (void)sample;
+    return -1;
+}
+#endif
+
+static int agent_read_group(struct agent_sample *sample)
+{
+    struct agent_group_read group;
+    size_t size = (3 + agent.nr_events) * sizeof(uint64_t);
+
+    if (read(agent.fds[0], &group, size) != (ssize_t)size)
+    {
+        return -1;
+    }
+    for (unsigned int e = 0; e < agent.nr_events; e++)
+    {
+        sample->values[e] = agent.base.values[e] + group.values[e];
+    }
+    sample->time_enabled_ns = agent.base.time_enabled_ns + group.time_enabled;
+    sample->time_running_ns = agent.base.time_running_ns + group.time_running;
+    return 0;
+}
+
+/* async-signal-safe, rdpmc only on the counted thread */
+static void agent_take_sample(int rdpmc)
+{
+    struct agent_ring *ring = agent.ring;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    struct agent_sample *sample;
+    struct timespec now;
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= AGENT_RING_CAPACITY)
+    {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    sample = &ring->samples[head & (AGENT_RING_CAPACITY - 1)];
+    if ((!rdpmc || agent_read_rdpmc(sample) != 0) && agent_read_group(sample) != 0)
+    {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    sample->timestamp_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void agent_tick(int signal_number, siginfo_t *info, void *context)
+{
+    int saved_errno = errno;
+
+    (void)signal_number;
+    (void)info;
+    (void)context;
+    if (!__atomic_exchange_n(&agent.busy, 1, __ATOMIC_ACQUIRE))
+    {
+        agent_take_sample(agent.rdpmc);
+        __atomic_store_n(&agent.busy, 0, __ATOMIC_RELEASE);
+    }
+    errno = saved_errno;
+}
+
+static void agent_close_events(void)
+{
+    for (unsigned int e = 0; e < agent.nr_events; e++)
+    {
+        if (agent.pages[e] != NULL)
+        {
+            munmap(agent.pages[e], agent.page_size);
+        }
+        if (agent.fds[e] >= 0)
+        {
+            close(agent.fds[e]);
+        }
+    }
+}
+
+static int agent_open_events(void)
+{
+    struct agent_ring *ring = agent.ring;
+
+    agent.nr_events = ring->nr_events;
+    agent.page_size = sysconf(_SC_PAGESIZE);
+    agent.rdpmc = 1;
+    for (unsigned int e = 0; e < agent.nr_events; e++)
+    {
+        agent.fds[e] = -1;
+    }
+    for (unsigned int e = 0; e < agent.nr_events; e++)
+    {
+        struct perf_event_attr attr;
+        void *page;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = ring->events[e].type;
+        attr.config = ring->events[e].config;
+        attr.config1 = ring->events[e].config1;
+        attr.config2 = ring->events[e].config2;
+        /* same scope as the other backends: user space only */
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        agent.fds[e] = syscall(SYS_perf_event_open, &attr, 0, -1, e == 0 ? -1 : agent.fds[0], PERF_FLAG_FD_CLOEXEC);
+        if (agent.fds[e] < 0)
+        {
+            return -1;
+        }
+        page = mmap(NULL, agent.page_size, PROT_READ, MAP_SHARED, agent.fds[e], 0);
+        agent.pages[e] = page != MAP_FAILED ? page : NULL;
+        agent.rdpmc = agent.rdpmc && agent.pages[e] != NULL && agent.pages[e]->cap_user_rdpmc;
+    }
+#if !defined(__x86_64__) && !defined(__i386__)
+    agent.rdpmc = 0;
+#endif
+    return 0;
+}
+
+static int agent_arm_timer(void)
+{
+    struct sigaction action;
+    struct sigevent event;
+    struct itimerspec period;
+    uint64_t period_ns = agent.ring->period_ns;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = agent_tick;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(AGENT_SIGNAL, &action, NULL) != 0)
+    {
+        return -1;
+    }
+
+    /* delivered to the main thread, the one the events count */
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = AGENT_SIGNAL;
+    event._sigev_un._tid = syscall(SYS_gettid);
+    if (timer_create(CLOCK_MONOTONIC, &event, &agent.timer) != 0)
+    {
+        return -1;
+    }
+    period.it_value.tv_sec = period_ns / 1000000000ULL;
+    period.it_value.tv_nsec = period_ns % 1000000000ULL;
+    period.it_interval = period.it_value;
+    if (timer_settime(agent.timer, 0, &period, NULL) != 0)
+    {
+        timer_delete(agent.timer);
+        return -1;
+    }
+    return 0;
+}
+
+__attribute__((constructor)) static void pm_agent_start(void)
+{
+    char path[64];
+    struct agent_ring *ring;
+    uint64_t head;
+    int fd;
+
+    agent.pid = getpid();
+    snprintf(path, sizeof(path), AGENT_RING_PATH_FORMAT, agent.pid);
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return;
+    }
+    ring = mmap(NULL, sizeof(struct agent_ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED)
+    {
+        return;
+    }
+    if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != AGENT_RING_MAGIC || ring->version != AGENT_RING_VERSION ||
+        ring->nr_events == 0 || ring->nr_events > AGENT_MAX_EVENTS || ring->period_ns == 0)
+    {
+        munmap(ring, sizeof(struct agent_ring));
+        return;
+    }
+    agent.ring = ring;
+
+    /* after an exec() the new counters start at 0 */
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head > 0)
+    {
+        agent.base = ring->samples[(head - 1) & (AGENT_RING_CAPACITY - 1)];
+    }
+    if (agent_open_events() != 0)
+    {
+        ring->error = errno;
+        agent_close_events();
+        __atomic_store_n(&ring->state, AGENT_FAILED, __ATOMIC_RELEASE);
+        agent.ring = NULL;
+        return;
+    }
+
+    /* the start of the first interval */
+    agent_take_sample(agent.rdpmc);
+    if (agent_arm_timer() != 0)
+    {
+        ring->error = errno;
+        agent_close_events();
+        __atomic_store_n(&ring->state, AGENT_FAILED, __ATOMIC_RELEASE);
+        agent.ring = NULL;
+        return;
+    }
+    __atomic_store_n(&ring->state, agent.rdpmc ? AGENT_RDPMC : AGENT_READ, __ATOMIC_RELEASE);
+}
+
+__attribute__((destructor)) static void pm_agent_stop(void)
+{
+    sigset_t agent_signal;
+
+    /* a forked child inherits the mapping but not the timer */
+    if (agent.ring == NULL || getpid() != agent.pid)
+    {
+        return;
+    }
+    timer_delete(agent.timer);
+    sigemptyset(&agent_signal);
+    sigaddset(&agent_signal, AGENT_SIGNAL);
+    pthread_sigmask(SIG_BLOCK, &agent_signal, NULL);
+
+    /* exit() may be called on any thread, read() is right on all of them */
+    if (!__atomic_exchange_n(&agent.busy, 1, __ATOMIC_ACQUIRE))
+    {
+        agent_take_sample(0);
+    }
+    agent_close_events();
+}
@@ -0,0 +1,214 @@
+#ifndef PM_REGION_H
+#define PM_REGION_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/**********
+ * Name: pm_region
+ * Description: region markers for programs run under process_monitor, so
+ * the counters can be attributed to the phases of the program instead of
+ * to time slices only:
+ *
+ *     pm_region_begin("multiply");
+ *     multiply(a, b, c);
+ *     pm_region_end();
+ *
+ * Header only, nothing to link. Started with --regions, the monitor creates
+ * a page in /dev/shm named after the pid of the process and reads the
+ * current region from it at every sample. The first marker call maps the
+ * page, every later one is a few stores to it and makes no syscall. Without
+ * the monitor, or when it was started after the first marker, the calls do
+ * nothing. Regions nest up to PM_REGION_DEPTH deep and are per process, not
+ * per thread; meant for the phases of the main thread. A forked child
+ * drops the page it inherited and looks for one of its own pid, so its
+ * markers cannot change the region of the monitored parent.
+ * The resolution is one sampling interval: every interval is credited to
+ * the region current when it is read, so a region shorter than an interval
+ * may get nothing and the intervals around a marker are partly credited to
+ * the wrong region. The monitor reports the share of each region's time
+ * from intervals in which the region changed, the part that is uncertain.
+ * Region ids are the index of the name in the page plus one, 0 is outside
+ * any region. Each translation unit maps the page on its own first call.
+ * ********/
+
+#define PM_REGION_MAGIC 0x706d7267u
+#define PM_REGION_VERSION 1
+#define PM_REGION_MAX 64
+#define PM_REGION_NAME_LEN 48
+#define PM_REGION_DEPTH 16
+#define PM_REGION_PATH_FORMAT "/dev/shm/process_monitor.regions.%d"
+
+/* O_CLOEXEC needs POSIX.1-2008, which plain -std=c99 does not declare */
+#ifdef O_CLOEXEC
+#define PM_REGION_CLOEXEC O_CLOEXEC
+#else
+#define PM_REGION_CLOEXEC 0
+#endif
+
+struct pm_region_name
+{
+    /* set once name is complete */
+    uint32_t ready;
+    char name[PM_REGION_NAME_LEN];
+};
+
+/* written by the program, read by the monitor; fits one page */
+struct pm_region_page
+{
+    uint32_t magic;
+    uint32_t version;
+    /* id of the innermost open region */
+    uint32_t current;
+    /* begin and end calls so far, the monitor sees whether a region changed within an interval */
+    uint32_t transitions;
+    uint32_t depth;
+    uint32_t stack[PM_REGION_DEPTH];
+    /* names handed out, may exceed PM_REGION_MAX when the page is full */
+    uint32_t nr_names;
+    struct pm_region_name names[PM_REGION_MAX];
+};
+
+/* name of a region id, NULL for 0 and unknown ids */
+static inline const char *pm_region_name(const struct pm_region_page *page, uint32_t id)
+{
+    if (id == 0 || id > PM_REGION_MAX || !__atomic_load_n(&page->names[id - 1].ready, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+    return page->names[id - 1].name;
+}
+
+static inline void pm_region_forget(void);
+
+/* the page of this process, mapped on the first call; forget drops it again */
+static inline struct pm_region_page *pm_region_page_lookup(int forget)
+{
+    static struct pm_region_page *page;
+    static int looked_up;
+    static int fork_handler;
+    char path[64];
+    void *mapped;
+    int fd;
+
+    if (forget)
+    {
+        if (page != NULL)
+        {
+            munmap(page, sizeof(struct pm_region_page));
+        }
+        page = NULL;
+        looked_up = 0;
+        return NULL;
+    }
+    if (looked_up)
+    {
+        return page;
+    }
+    looked_up = 1;
+    /* getpid() on every marker would be a syscall, a fork handler keeps them free of any */
+    if (!fork_handler)
+    {
+        fork_handler = 1;
+        pthread_atfork(NULL, NULL, pm_region_forget);
+    }
+    snprintf(path, sizeof(path), PM_REGION_PATH_FORMAT, (int)getpid());
+    fd = open(path, O_RDWR | PM_REGION_CLOEXEC);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    mapped = mmap(NULL, sizeof(struct pm_region_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return NULL;
+    }
+    if (((struct pm_region_page *)mapped)->magic != PM_REGION_MAGIC ||
+        ((struct pm_region_page *)mapped)->version != PM_REGION_VERSION)
+    {
+        munmap(mapped, sizeof(struct pm_region_page));
+        return NULL;
+    }
+    page = (struct pm_region_page *)mapped;
+    return page;
+}
+
+/* in a forked child, whose markers must not reach the parent's page */
+static inline void pm_region_forget(void)
+{
+    pm_region_page_lookup(1);
+}
+
+static inline struct pm_region_page *pm_region_page_get(void)
+{
+    return pm_region_page_lookup(0);
+}
+
+/* id of the name, registered in the page on first use; 0 when the page is full */
+static inline uint32_t pm_region_id(struct pm_region_page *page, const char *name)
+{
+    uint32_t nr_names = __atomic_load_n(&page->nr_names, __ATOMIC_ACQUIRE);
+    uint32_t slot;
+
+    for (uint32_t i = 0; i < nr_names && i < PM_REGION_MAX; i++)
+    {
+        if (__atomic_load_n(&page->names[i].ready, __ATOMIC_ACQUIRE) &&
+            strncmp(page->names[i].name, name, PM_REGION_NAME_LEN - 1) == 0)
+        {
+            return i + 1;
+        }
+    }
+    slot = __atomic_fetch_add(&page->nr_names, 1, __ATOMIC_ACQ_REL);
+    if (slot >= PM_REGION_MAX)
+    {
+        return 0;
+    }
+    strncpy(page->names[slot].name, name, PM_REGION_NAME_LEN - 1);
+    __atomic_store_n(&page->names[slot].ready, 1, __ATOMIC_RELEASE);
+    return slot + 1;
+}
+
+static inline void pm_region_begin(const char *name)
+{
+    struct pm_region_page *page = pm_region_page_get();
+    uint32_t id;
+
+    if (page == NULL)
+    {
+        return;
+    }
+    id = pm_region_id(page, name);
+    if (page->depth < PM_REGION_DEPTH)
+    {
+        page->stack[page->depth] = id;
+    }
+    page->depth++;
+    __atomic_store_n(&page->current, id, __ATOMIC_RELEASE);
+    __atomic_store_n(&page->transitions, page->transitions + 1, __ATOMIC_RELEASE);
+}
+
+static inline void pm_region_end(void)
+{
+    struct pm_region_page *page = pm_region_page_get();
+    uint32_t depth;
+
+    if (page == NULL || page->depth == 0)
+    {
+        return;
+    }
+    depth = --page->depth;
+    if (depth > PM_REGION_DEPTH)
+    {
+        depth = PM_REGION_DEPTH;
+    }
+    __atomic_store_n(&page->current, depth > 0 ? page->stack[depth - 1] : 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&page->transitions, page->transitions + 1, __ATOMIC_RELEASE);
+}
+
+#endif
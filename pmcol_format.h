@@ -0,0 +1,83 @@
+#ifndef PMCOL_FORMAT_H
+#define PMCOL_FORMAT_H
+
+#include <stdint.h>
+
+/**********
+ * Name: pmcol file format
+ * Description: binary columnar sample file. Layout (all little endian, every
+ * field 8 byte aligned so columns can be used in place from a mapping):
+ *
+ *   pmcol_file_header
+ *   pmcol_column[nr_columns]
+ *   block 0 .. nr_blocks - 1, each block_size(header) bytes:
+ *       pmcol_block_header
+ *       column 0: block_rows cells of 8 bytes
+ *       ...
+ *       column nr_columns - 1
+ *
+ * Blocks have a fixed size; only the last one may hold fewer than block_rows
+ * rows. nr_rows/nr_blocks in the file header are updated whenever a block is
+ * completed, so a file that is still being written can be read as well.
+ * ********/
+
+#define PMCOL_MAGIC "PMCOL\0\0\0"
+#define PMCOL_VERSION 1
+#define PMCOL_NAME_LEN 48
+
+enum pmcol_type
+{
+    PMCOL_U64 = 0,
+    PMCOL_I64 = 1,
+    PMCOL_F64 = 2
+};
+
+struct pmcol_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t nr_columns;
+    uint32_t block_rows;
+    uint64_t nr_blocks;
+    uint64_t nr_rows;
+};
+
+struct pmcol_column
+{
+    char name[PMCOL_NAME_LEN];
+    uint32_t type;
+    uint32_t reserved;
+};
+
+struct pmcol_block_header
+{
+    uint64_t first_row;
+    uint32_t nr_rows;
+    uint32_t reserved;
+};
+
+typedef struct pmcol_file_header pmcol_file_header;
+typedef struct pmcol_column pmcol_column;
+typedef struct pmcol_block_header pmcol_block_header;
+
+union pmcol_cell
+{
+    uint64_t u;
+    int64_t i;
+    double f;
+};
+
+typedef union pmcol_cell pmcol_cell;
+
+static inline uint64_t pmcol_header_size(uint32_t nr_columns)
+{
+    return sizeof(pmcol_file_header) + (uint64_t)nr_columns * sizeof(pmcol_column);
+}
+
+static inline uint64_t pmcol_block_size(uint32_t nr_columns, uint32_t block_rows)
+{
+    return sizeof(pmcol_block_header) + (uint64_t)nr_columns * block_rows * sizeof(pmcol_cell);
+}
+
+#endif
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pmcol_reader.h"
+
+static const pmcol_block_header *reader_block(const pmcol_reader *reader, uint64_t block)
+{
+    return (const pmcol_block_header *)(reader->base + reader->header->header_size + block * reader->block_size);
+}
+
+int pmcol_reader_open(pmcol_reader *reader, const char *path)
+{
+    struct stat st;
+    void *mapping;
+    int fd;
+
+    memset(reader, 0, sizeof(pmcol_reader));
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        perror("Could not open pmcol file");
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(pmcol_file_header))
+    {
+        printf("ERROR: %s is too small to be a pmcol file\n", path);
+        close(fd);
+        return -1;
+    }
+
+    mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        perror("Could not map pmcol file");
+        return -1;
+    }
+
+    reader->base = mapping;
+    reader->size = st.st_size;
+    reader->header = mapping;
+
+    if (memcmp(reader->header->magic, PMCOL_MAGIC, sizeof(reader->header->magic)) != 0 ||
+        reader->header->version != PMCOL_VERSION ||
+        reader->header->header_size != pmcol_header_size(reader->header->nr_columns) ||
+        reader->header->header_size > reader->size || reader->header->block_rows == 0)
+    {
+        printf("ERROR: %s is not a version %d pmcol file\n", path, PMCOL_VERSION);
+        pmcol_reader_close(reader);
+        return -1;
+    }
+
+    reader->columns = (const pmcol_column *)(reader->base + sizeof(pmcol_file_header));
+    reader->block_size = pmcol_block_size(reader->header->nr_columns, reader->header->block_rows);
+
+    /* a live file may map more preallocated blocks than the header has published */
+    reader->nr_blocks = (reader->size - reader->header->header_size) / reader->block_size;
+    if (reader->nr_blocks > reader->header->nr_blocks + 1)
+    {
+        reader->nr_blocks = reader->header->nr_blocks + 1;
+    }
+    return 0;
+}
+
+void pmcol_reader_close(pmcol_reader *reader)
+{
+    if (reader->base != NULL)
+    {
+        munmap((void *)reader->base, reader->size);
+    }
+    memset(reader, 0, sizeof(pmcol_reader));
+}
+
+int pmcol_reader_find_column(const pmcol_reader *reader, const char *name)
+{
+    for (uint32_t i = 0; i < reader->header->nr_columns; i++)
+    {
+        if (strncmp(reader->columns[i].name, name, PMCOL_NAME_LEN) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+uint64_t pmcol_reader_nr_rows(const pmcol_reader *reader)
+{
+    uint64_t rows = 0;
+
+    for (uint64_t block = 0; block < reader->nr_blocks; block++)
+    {
+        rows += reader_block(reader, block)->nr_rows;
+    }
+    return rows;
+}
+
+const pmcol_cell *pmcol_reader_column(const pmcol_reader *reader, uint32_t column, uint64_t block, uint32_t *nr_rows)
+{
+    const pmcol_block_header *block_header;
+
+    if (column >= reader->header->nr_columns || block >= reader->nr_blocks)
+    {
+        *nr_rows = 0;
+        return NULL;
+    }
+    block_header = reader_block(reader, block);
+    *nr_rows = block_header->nr_rows;
+    return (const pmcol_cell *)(block_header + 1) + (size_t)column * reader->header->block_rows;
+}
+
+pmcol_cell pmcol_reader_cell(const pmcol_reader *reader, uint32_t column, uint64_t row)
+{
+    uint32_t nr_rows;
+    const pmcol_cell *cells = pmcol_reader_column(reader, column, row / reader->header->block_rows, &nr_rows);
+    pmcol_cell empty = {0};
+
+    if (cells == NULL || row % reader->header->block_rows >= nr_rows)
+    {
+        return empty;
+    }
+    return cells[row % reader->header->block_rows];
+}
@@ -0,0 +1,41 @@
+#ifndef PMCOL_READER_H
+#define PMCOL_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "pmcol_format.h"
+
+/**********
+ * Name: pmcol_reader
+ * Description: read-only mapping of a pmcol file. Column data is returned as
+ * pointers into the mapping, nothing is copied. Returns 0 on success, -1 on failure.
+ * ********/
+
+struct pmcol_reader
+{
+    const unsigned char *base;
+    size_t size;
+    const pmcol_file_header *header;
+    const pmcol_column *columns;
+    uint64_t block_size;
+    uint64_t nr_blocks;
+};
+
+typedef struct pmcol_reader pmcol_reader;
+
+int pmcol_reader_open(pmcol_reader *reader, const char *path);
+void pmcol_reader_close(pmcol_reader *reader);
+
+/* returns the column index or -1 */
+int pmcol_reader_find_column(const pmcol_reader *reader, const char *name);
+
+/* rows stored in the file, including a partially filled last block */
+uint64_t pmcol_reader_nr_rows(const pmcol_reader *reader);
+
+/* cells of one column in one block; nr_rows receives the number of valid cells */
+const pmcol_cell *pmcol_reader_column(const pmcol_reader *reader, uint32_t column, uint64_t block, uint32_t *nr_rows);
+
+/* random access helper, prefer pmcol_reader_column for scans */
+pmcol_cell pmcol_reader_cell(const pmcol_reader *reader, uint32_t column, uint64_t row);
+
+#endif
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "output_sink.h"
+#include "pmcol_writer.h"
+
+/* rows per column block in binary output */
+#define BINARY_BLOCK_ROWS 1024
+
+/* target, tid, region, region_changed, throttle, budget_used, timestamp_ns, interval_ns, time_enabled_ns, time_running_ns */
+#define NR_TIME_COLUMNS 10
+
+/**********
+ * Name: pmcol_sink
+ * Description: streams samples into a pmcol binary columnar file
+ * ********/
+
+static void set_column(pmcol_column *column, const char *name, const char *suffix, enum pmcol_type type)
+{
+    snprintf(column->name, PMCOL_NAME_LEN, "%s%s", name, suffix);
+    column->type = type;
+}
+
+static int pmcol_sink_write(output_sink *sink, const sample_record *records, size_t nr_records)
+{
+    pmcol_writer *writer = sink->priv;
+    const output_columns *columns = &sink->columns;
+    pmcol_cell row[NR_TIME_COLUMNS + 3 * MAX_COUNTERS + MAX_METRICS];
+
+    for (size_t i = 0; i < nr_records; i++)
+    {
+        const sample_record *record = &records[i];
+        uint32_t nr_cells = 0;
+
+        if (columns->nr_targets > 1)
+        {
+            row[nr_cells++].u = record->target;
+        }
+        if (columns->per_thread)
+        {
+            row[nr_cells++].i = record->tid;
+        }
+        if (columns->regions)
+        {
+            row[nr_cells++].u = record->region;
+            row[nr_cells++].u = record->region_changed;
+        }
+        if (columns->regulation)
+        {
+            row[nr_cells++].u = record->throttle;
+            row[nr_cells++].f = record->budget_used;
+        }
+        row[nr_cells++].u = record->timestamp_ns;
+        row[nr_cells++].u = record->interval_ns;
+        row[nr_cells++].u = record->time_enabled_ns;
+        row[nr_cells++].u = record->time_running_ns;
+        for (size_t j = 0; j < columns->nr_counters; j++)
+        {
+            row[nr_cells++].i = record->values[j];
+            if (columns->rates)
+            {
+                row[nr_cells++].f = sample_counter_rate(record, j);
+            }
+            if (columns->coverage)
+            {
+                row[nr_cells++].f = record->coverage[j];
+            }
+        }
+        for (size_t j = 0; columns->metrics != NULL && j < columns->metrics->nr_metrics; j++)
+        {
+            row[nr_cells++].f = record->metrics[j];
+        }
+
+        if (pmcol_writer_append(writer, row) != 0)
+        {
+            return -1;
+        }
+        sink->bytes_written += nr_cells * sizeof(pmcol_cell);
+    }
+    return 0;
+}
+
+static int pmcol_sink_close(output_sink *sink)
+{
+    pmcol_writer *writer = sink->priv;
+    int return_code = pmcol_writer_close(writer);
+
+    sink->bytes_written = writer->bytes_written;
+    free(writer);
+    return return_code;
+}
+
+output_sink *pmcol_sink_open(const char *path, const output_columns *columns)
+{
+    output_sink *sink = calloc(1, sizeof(output_sink));
+    pmcol_writer *writer = calloc(1, sizeof(pmcol_writer));
+    pmcol_column descriptors[NR_TIME_COLUMNS + 3 * MAX_COUNTERS + MAX_METRICS];
+    uint32_t nr_columns = 0;
+
+    if (sink == NULL || writer == NULL)
+    {
+        free(sink);
+        free(writer);
+        return NULL;
+    }
+
+    memset(descriptors, 0, sizeof(descriptors));
+    if (columns->nr_targets > 1)
+    {
+        set_column(&descriptors[nr_columns++], "target", "", PMCOL_U64);
+    }
+    if (columns->per_thread)
+    {
+        set_column(&descriptors[nr_columns++], "tid", "", PMCOL_I64);
+    }
+    if (columns->regions)
+    {
+        set_column(&descriptors[nr_columns++], "region", "", PMCOL_U64);
+        set_column(&descriptors[nr_columns++], "region_changed", "", PMCOL_U64);
+    }
+    if (columns->regulation)
+    {
+        set_column(&descriptors[nr_columns++], "throttle", "", PMCOL_U64);
+        set_column(&descriptors[nr_columns++], "budget_used", "", PMCOL_F64);
+    }
+    set_column(&descriptors[nr_columns++], "timestamp_ns", "", PMCOL_U64);
+    set_column(&descriptors[nr_columns++], "interval_ns", "", PMCOL_U64);
+    set_column(&descriptors[nr_columns++], "time_enabled_ns", "", PMCOL_U64);
+    set_column(&descriptors[nr_columns++], "time_running_ns", "", PMCOL_U64);
+    for (size_t i = 0; i < columns->nr_counters; i++)
+    {
+        set_column(&descriptors[nr_columns++], columns->events[i].event_name, "", PMCOL_I64);
+        if (columns->rates)
+        {
+            set_column(&descriptors[nr_columns++], columns->events[i].event_name, "/s", PMCOL_F64);
+        }
+        if (columns->coverage)
+        {
+            set_column(&descriptors[nr_columns++], columns->events[i].event_name, ":coverage", PMCOL_F64);
+        }
+    }
+    for (size_t i = 0; columns->metrics != NULL && i < columns->metrics->nr_metrics; i++)
+    {
+        set_column(&descriptors[nr_columns++], columns->metrics->metrics[i].name, "", PMCOL_F64);
+    }
+
+    if (pmcol_writer_open(writer, path, descriptors, nr_columns, BINARY_BLOCK_ROWS) != 0)
+    {
+        free(sink);
+        free(writer);
+        return NULL;
+    }
+
+    sink->path = path;
+    sink->columns = *columns;
+    sink->write = pmcol_sink_write;
+    sink->close = pmcol_sink_close;
+    sink->priv = writer;
+    return sink;
+}
@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "pmcol_writer.h"
+
+/* number of blocks the file grows by when the mapping is full */
+#define PMCOL_GROW_BLOCKS 64
+
+static pmcol_file_header *writer_header(pmcol_writer *writer)
+{
+    return (pmcol_file_header *)writer->base;
+}
+
+static unsigned char *writer_block(pmcol_writer *writer, uint64_t block)
+{
+    return writer->base + pmcol_header_size(writer->nr_columns) + block * writer->block_size;
+}
+
+static int pmcol_writer_reserve(pmcol_writer *writer, size_t size)
+{
+    void *mapping;
+    int return_code;
+
+    if (size <= writer->mapped_size)
+    {
+        return 0;
+    }
+
+    /* posix_fallocate makes sure the stores into the mapping cannot hit ENOSPC later as SIGBUS */
+    if ((return_code = posix_fallocate(writer->fd, 0, size)) != 0)
+    {
+        printf("ERROR: could not preallocate output file: %s\n", strerror(return_code));
+        return -1;
+    }
+
+    if (writer->base == NULL)
+    {
+        mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, writer->fd, 0);
+    }
+    else
+    {
+        mapping = mremap(writer->base, writer->mapped_size, size, MREMAP_MAYMOVE);
+    }
+    if (mapping == MAP_FAILED)
+    {
+        perror("Could not map output file");
+        return -1;
+    }
+    writer->base = mapping;
+    writer->mapped_size = size;
+    return 0;
+}
+
+int pmcol_writer_open(pmcol_writer *writer, const char *path, const pmcol_column *columns, uint32_t nr_columns, uint32_t block_rows)
+{
+    pmcol_file_header *header;
+
+    memset(writer, 0, sizeof(pmcol_writer));
+    writer->nr_columns = nr_columns;
+    writer->block_rows = block_rows;
+    writer->block_size = pmcol_block_size(nr_columns, block_rows);
+
+    writer->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (writer->fd < 0)
+    {
+        perror("Could not open output file");
+        return -1;
+    }
+
+    if (pmcol_writer_reserve(writer, pmcol_header_size(nr_columns) + PMCOL_GROW_BLOCKS * writer->block_size) != 0)
+    {
+        close(writer->fd);
+        return -1;
+    }
+
+    header = writer_header(writer);
+    memcpy(header->magic, PMCOL_MAGIC, sizeof(header->magic));
+    header->version = PMCOL_VERSION;
+    header->header_size = pmcol_header_size(nr_columns);
+    header->nr_columns = nr_columns;
+    header->block_rows = block_rows;
+    header->nr_blocks = 0;
+    header->nr_rows = 0;
+    memcpy(writer->base + sizeof(pmcol_file_header), columns, nr_columns * sizeof(pmcol_column));
+    return 0;
+}
+
+int pmcol_writer_append(pmcol_writer *writer, const pmcol_cell *row)
+{
+    uint64_t block = writer->nr_rows / writer->block_rows;
+    uint32_t slot = writer->nr_rows % writer->block_rows;
+    size_t needed = pmcol_header_size(writer->nr_columns) + (block + 1) * writer->block_size;
+    pmcol_block_header *block_header;
+    pmcol_cell *cells;
+
+    if (needed > writer->mapped_size &&
+        pmcol_writer_reserve(writer, needed + (PMCOL_GROW_BLOCKS - 1) * writer->block_size) != 0)
+    {
+        return -1;
+    }
+
+    block_header = (pmcol_block_header *)writer_block(writer, block);
+    cells = (pmcol_cell *)(block_header + 1);
+    for (uint32_t i = 0; i < writer->nr_columns; i++)
+    {
+        cells[(size_t)i * writer->block_rows + slot] = row[i];
+    }
+
+    writer->nr_rows++;
+    block_header->first_row = block * writer->block_rows;
+    block_header->nr_rows = slot + 1;
+    if (slot + 1 == writer->block_rows)
+    {
+        /* publish completed blocks to readers of the live file */
+        writer_header(writer)->nr_blocks = block + 1;
+        writer_header(writer)->nr_rows = writer->nr_rows;
+    }
+    return 0;
+}
+
+int pmcol_writer_close(pmcol_writer *writer)
+{
+    uint64_t nr_blocks = (writer->nr_rows + writer->block_rows - 1) / writer->block_rows;
+    size_t final_size = pmcol_header_size(writer->nr_columns) + nr_blocks * writer->block_size;
+    int return_code = 0;
+
+    if (writer->base == NULL)
+    {
+        return -1;
+    }
+
+    writer_header(writer)->nr_blocks = nr_blocks;
+    writer_header(writer)->nr_rows = writer->nr_rows;
+    writer->bytes_written = final_size;
+
+    munmap(writer->base, writer->mapped_size);
+    writer->base = NULL;
+    if (ftruncate(writer->fd, final_size) != 0)
+    {
+        perror("Could not trim output file");
+        return_code = -1;
+    }
+    close(writer->fd);
+    writer->fd = -1;
+    return return_code;
+}
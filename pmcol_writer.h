@@ -0,0 +1,36 @@
+#ifndef PMCOL_WRITER_H
+#define PMCOL_WRITER_H
+
+#include <stddef.h>
+#include "pmcol_format.h"
+
+/**********
+ * Name: pmcol_writer
+ * Description: streams rows into a pmcol file through a shared mapping. The
+ * file is preallocated in steps of PMCOL_GROW_BLOCKS blocks, so appending a
+ * row is a handful of stores into memory. Returns 0 on success, -1 on failure.
+ * ********/
+
+struct pmcol_writer
+{
+    int fd;
+    unsigned char *base;
+    size_t mapped_size;
+    uint32_t nr_columns;
+    uint32_t block_rows;
+    uint64_t block_size;
+    uint64_t nr_rows;
+    uint64_t bytes_written;
+};
+
+typedef struct pmcol_writer pmcol_writer;
+
+int pmcol_writer_open(pmcol_writer *writer, const char *path, const pmcol_column *columns, uint32_t nr_columns, uint32_t block_rows);
+
+/* row holds one cell per column */
+int pmcol_writer_append(pmcol_writer *writer, const pmcol_cell *row);
+
+/* trims the preallocation and unmaps the file */
+int pmcol_writer_close(pmcol_writer *writer);
+
+#endif
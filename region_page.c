@@ -0,0 +1,63 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "region_page.h"
+
+int region_page_create(region_page *regions, pid_t pid)
+{
+    char proc_path[32];
+    struct stat owner;
+    void *mapped;
+    int fd;
+
+    memset(regions, 0, sizeof(region_page));
+    snprintf(regions->path, sizeof(regions->path), PM_REGION_PATH_FORMAT, pid);
+    /* left behind by a monitor that did not exit cleanly, pids are reused */
+    unlink(regions->path);
+    fd = open(regions->path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        printf("ERROR: could not create region page %s: %s\n", regions->path, strerror(errno));
+        return -1;
+    }
+    /* an attached process may run as another user than the monitor */
+    snprintf(proc_path, sizeof(proc_path), "/proc/%d", pid);
+    if (stat(proc_path, &owner) == 0 && owner.st_uid != geteuid() && fchown(fd, owner.st_uid, owner.st_gid) != 0)
+    {
+        printf("Warning: could not hand region page %s to uid %d: %s\n", regions->path, owner.st_uid, strerror(errno));
+    }
+    if (ftruncate(fd, sizeof(struct pm_region_page)) != 0)
+    {
+        printf("ERROR: could not size region page %s: %s\n", regions->path, strerror(errno));
+        close(fd);
+        unlink(regions->path);
+        return -1;
+    }
+    mapped = mmap(NULL, sizeof(struct pm_region_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        printf("ERROR: could not map region page %s: %s\n", regions->path, strerror(errno));
+        unlink(regions->path);
+        return -1;
+    }
+    regions->page = mapped;
+    regions->page->version = PM_REGION_VERSION;
+    __atomic_store_n(&regions->page->magic, PM_REGION_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void region_page_destroy(region_page *regions)
+{
+    if (regions->page == NULL)
+    {
+        return;
+    }
+    munmap(regions->page, sizeof(struct pm_region_page));
+    unlink(regions->path);
+    regions->page = NULL;
+}
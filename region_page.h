@@ -0,0 +1,37 @@
+#ifndef REGION_PAGE_H
+#define REGION_PAGE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "pm_region.h"
+
+/**********
+ * Name: region_page
+ * Description: the monitor's side of the pm_region markers. The page is
+ * created before the target runs its first marker, for a spawned command
+ * while it waits in front of exec(), and removed when the target is freed.
+ * The monitor only reads it. Functions return 0 on success and -1 after
+ * printing the reason.
+ * ********/
+
+struct region_page
+{
+    char path[64];
+    struct pm_region_page *page;
+};
+
+typedef struct region_page region_page;
+
+/* creates the page of pid, owned by the user running the process */
+int region_page_create(region_page *regions, pid_t pid);
+
+/* current region of the target, transitions receives the count of marker calls */
+static inline uint32_t region_page_read(const region_page *regions, uint32_t *transitions)
+{
+    *transitions = __atomic_load_n(&regions->page->transitions, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&regions->page->current, __ATOMIC_ACQUIRE);
+}
+
+void region_page_destroy(region_page *regions);
+
+#endif
@@ -0,0 +1,294 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <mntent.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "regulator.h"
+#include "scheduler.h"
+
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+
+static int write_text(const char *path, const char *text)
+{
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    ssize_t written;
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+    written = write(fd, text, strlen(text));
+    close(fd);
+    return written == (ssize_t)strlen(text) ? 0 : -1;
+}
+
+/* absolute path of the cgroup v2 group of pid, empty if it cannot be found */
+static void find_cgroup(pid_t pid, char *cgroup, size_t size)
+{
+    char path[64];
+    char line[PATH_MAX];
+    char root[PATH_MAX] = "";
+    struct mntent *mount;
+    FILE *fp;
+
+    cgroup[0] = '\0';
+    fp = setmntent("/proc/self/mounts", "r");
+    while (fp != NULL && (mount = getmntent(fp)) != NULL)
+    {
+        if (strcmp(mount->mnt_type, "cgroup2") == 0)
+        {
+            snprintf(root, sizeof(root), "%s", mount->mnt_dir);
+            break;
+        }
+    }
+    if (fp != NULL)
+    {
+        endmntent(fp);
+    }
+    snprintf(path, sizeof(path), "/proc/%d/cgroup", pid);
+    fp = fopen(path, "r");
+    while (root[0] != '\0' && fp != NULL && fgets(line, sizeof(line), fp) != NULL)
+    {
+        /* the unified hierarchy is listed as "0::<path>" */
+        if (strncmp(line, "0::", 3) == 0)
+        {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(cgroup, size, "%s%s", root, line + 3);
+            break;
+        }
+    }
+    if (fp != NULL)
+    {
+        fclose(fp);
+    }
+}
+
+/* moves the whole process into cgroup */
+static int move_to_cgroup(const char *cgroup, pid_t pid)
+{
+    char path[PATH_MAX + 16];
+    char text[16];
+
+    snprintf(path, sizeof(path), "%s/cgroup.procs", cgroup);
+    snprintf(text, sizeof(text), "%d", pid);
+    return write_text(path, text);
+}
+
+/* the monitor's cgroup of the target, it must be empty */
+static void remove_cgroup(regulator *regulator)
+{
+    if (rmdir(regulator->cgroup) != 0 && errno != ENOENT)
+    {
+        printf("Warning: could not remove cgroup %s: %s\n", regulator->cgroup, strerror(errno));
+    }
+    regulator->cgroup[0] = '\0';
+}
+
+regulator *regulator_create(enum throttle_method method, const char *cgroup_parent, unsigned int event, long long budget)
+{
+    regulator *regulator = calloc(1, sizeof(struct regulator));
+
+    if (regulator == NULL)
+    {
+        perror("Could not allocate regulator");
+        return NULL;
+    }
+    regulator->method = method;
+    regulator->event = event;
+    regulator->budget = budget;
+    regulator->pidfd = -1;
+    regulator->cpu_max_fd = -1;
+    if (method == THROTTLE_CGROUP)
+    {
+        snprintf(regulator->cgroup, sizeof(regulator->cgroup), "%s", cgroup_parent);
+    }
+    counter_stats_init(&regulator->budget_used, 1000.0);
+    counter_stats_init(&regulator->latency, 1.0);
+    return regulator;
+}
+
+int regulator_attach(regulator *regulator, pid_t pid, int pidfd)
+{
+    char parent[PATH_MAX];
+    char path[PATH_MAX + 32];
+
+    regulator->pid = pid;
+    regulator->pidfd = pidfd;
+    if (regulator->method != THROTTLE_CGROUP)
+    {
+        return 0;
+    }
+
+    /* the parent has to hand the cpu controller down, it may already do so */
+    snprintf(parent, sizeof(parent), "%s", regulator->cgroup);
+    snprintf(path, sizeof(path), "%s/cgroup.subtree_control", parent);
+    if (write_text(path, "+cpu") != 0)
+    {
+        printf("Warning: could not enable the cpu controller below %s: %s\n", parent, strerror(errno));
+    }
+    if (snprintf(regulator->cgroup, sizeof(regulator->cgroup), "%s/process_monitor.%d", parent, pid) >=
+        (int)sizeof(regulator->cgroup))
+    {
+        printf("ERROR: cgroup path %s is too long\n", parent);
+        regulator->cgroup[0] = '\0';
+        return -1;
+    }
+    if (mkdir(regulator->cgroup, 0755) != 0 && errno != EEXIST)
+    {
+        printf("ERROR: could not create cgroup %s: %s\n", regulator->cgroup, strerror(errno));
+        regulator->cgroup[0] = '\0';
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/cpu.max", regulator->cgroup);
+    regulator->cpu_max_fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (regulator->cpu_max_fd < 0)
+    {
+        printf("ERROR: could not open %s, is %s a cgroup v2 group with the cpu controller? %s\n",
+               path, parent, strerror(errno));
+        remove_cgroup(regulator);
+        return -1;
+    }
+    find_cgroup(pid, regulator->original_cgroup, sizeof(regulator->original_cgroup));
+    if (move_to_cgroup(regulator->cgroup, pid) != 0)
+    {
+        printf("ERROR: could not move pid %d into cgroup %s: %s\n", pid, regulator->cgroup, strerror(errno));
+        remove_cgroup(regulator);
+        return -1;
+    }
+    return 0;
+}
+
+/* throttles or lets go of the target, -1 with errno set if that failed */
+static int set_throttle(regulator *regulator, int throttle)
+{
+    const char *cpu_max = throttle ? REGULATOR_THROTTLED_CPU_MAX : REGULATOR_FREE_CPU_MAX;
+
+    if (regulator->method == THROTTLE_SIGNAL && regulator->pidfd >= 0)
+    {
+        return syscall(SYS_pidfd_send_signal, regulator->pidfd, throttle ? SIGSTOP : SIGCONT, NULL, 0);
+    }
+    if (regulator->method == THROTTLE_SIGNAL)
+    {
+        return kill(regulator->pid, throttle ? SIGSTOP : SIGCONT);
+    }
+    return pwrite(regulator->cpu_max_fd, cpu_max, strlen(cpu_max), 0) == (ssize_t)strlen(cpu_max) ? 0 : -1;
+}
+
+static void report_failure(regulator *regulator)
+{
+    /* a process that is gone needs no throttling */
+    if (!regulator->failed && errno != ESRCH)
+    {
+        printf("Warning: could not throttle pid %d: %s\n", regulator->pid, strerror(errno));
+    }
+    regulator->failed = 1;
+}
+
+void regulator_update(regulator *regulator, sample_record *record, uint64_t period_end_ns)
+{
+    long long used = record->values[regulator->event];
+    uint64_t now_ns;
+
+    record->budget_used = regulator->budget > 0 ? (float)used / regulator->budget : 0.0f;
+    record->throttle = THROTTLE_NONE;
+    regulator->nr_periods++;
+    counter_stats_add(&regulator->budget_used, record->budget_used);
+
+    /* a throttled target had its period off and starts the next one with a full budget */
+    if (regulator->throttled)
+    {
+        if (set_throttle(regulator, 0) != 0)
+        {
+            report_failure(regulator);
+            return;
+        }
+        regulator->throttled = 0;
+        regulator->throttled_ns += monotonic_ns() - regulator->throttle_start_ns;
+        record->throttle = THROTTLE_RESUMED;
+        return;
+    }
+    if (used <= regulator->budget)
+    {
+        return;
+    }
+    if (set_throttle(regulator, 1) != 0)
+    {
+        report_failure(regulator);
+        return;
+    }
+    now_ns = monotonic_ns();
+    regulator->throttled = 1;
+    regulator->nr_throttled++;
+    regulator->throttle_start_ns = now_ns;
+    counter_stats_add(&regulator->latency, now_ns - period_end_ns);
+    record->throttle = THROTTLE_STOPPED;
+}
+
+void regulator_release(regulator *regulator)
+{
+    if (!regulator->throttled)
+    {
+        return;
+    }
+    if (set_throttle(regulator, 0) != 0)
+    {
+        report_failure(regulator);
+        return;
+    }
+    regulator->throttled = 0;
+    regulator->throttled_ns += monotonic_ns() - regulator->throttle_start_ns;
+}
+
+void regulator_print(const regulator *regulator, const char *label, const char *event_name)
+{
+    const counter_stats *used = &regulator->budget_used;
+    const counter_stats *latency = &regulator->latency;
+
+    printf("***** Regulation of %s *****\n", label);
+    printf("budget:\t\t %lld %s per period, throttled with %s\n", regulator->budget, event_name,
+           regulator->method == THROTTLE_SIGNAL ? "SIGSTOP/SIGCONT" : "cpu.max");
+    printf("periods:\t %llu, throttled %llu (%.1f%%), %.3f s stopped\n", (unsigned long long)regulator->nr_periods,
+           (unsigned long long)regulator->nr_throttled,
+           regulator->nr_periods > 0 ? 100.0 * regulator->nr_throttled / regulator->nr_periods : 0.0,
+           regulator->throttled_ns / 1e9);
+    printf("budget used:\t mean %.3f, p50 %.3f, p99 %.3f, max %.3f\n", used->mean, counter_stats_percentile(used, 50.0),
+           counter_stats_percentile(used, 99.0), used->count > 0 ? used->max : 0.0);
+    if (latency->count > 0)
+    {
+        printf("throttle latency:\t mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us after the period end\n",
+               latency->mean / 1000, counter_stats_percentile(latency, 50.0) / 1000,
+               counter_stats_percentile(latency, 99.0) / 1000, latency->max / 1000);
+    }
+    printf("\n");
+}
+
+void regulator_destroy(regulator *regulator, int attached)
+{
+    if (regulator == NULL)
+    {
+        return;
+    }
+    if (regulator->cpu_max_fd >= 0)
+    {
+        close(regulator->cpu_max_fd);
+    }
+    if (regulator->method == THROTTLE_CGROUP && regulator->cgroup[0] != '\0')
+    {
+        if (attached && (regulator->original_cgroup[0] == '\0' ||
+                         move_to_cgroup(regulator->original_cgroup, regulator->pid) != 0))
+        {
+            printf("Warning: could not move pid %d back to its cgroup %s\n", regulator->pid, regulator->original_cgroup);
+        }
+        remove_cgroup(regulator);
+    }
+    counter_stats_destroy(&regulator->budget_used);
+    counter_stats_destroy(&regulator->latency);
+    free(regulator);
+}
@@ -0,0 +1,89 @@
+#ifndef REGULATOR_H
+#define REGULATOR_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "counter_stats.h"
+#include "sample.h"
+
+#define DEFAULT_REGULATED_EVENT "PAPI_L3_TCM"
+
+/* cpu.max of a throttled cgroup: the smallest quota in the longest period */
+#define REGULATOR_THROTTLED_CPU_MAX "1000 1000000"
+#define REGULATOR_FREE_CPU_MAX "max 100000"
+
+enum throttle_method
+{
+    /* SIGSTOP the whole process, SIGCONT it */
+    THROTTLE_SIGNAL,
+    /* move the process into a cgroup of its own and lower its cpu.max */
+    THROTTLE_CGROUP
+};
+
+/**********
+ * Name: regulator
+ * Description: MemGuard style bandwidth regulation of one target. Every
+ * sampling period is a regulation period: after each read the sampler hands
+ * the record to regulator_update(), which compares the delta of the
+ * regulated event with the budget. A target over budget is throttled until
+ * the next read, which lets it go again; the overshoot is paid for with the
+ * following period. The record carries the decision (throttle) and the
+ * fraction of the budget the target used (budget_used).
+ * With THROTTLE_CGROUP the target gets its own cgroup below the given
+ * cgroup v2 directory, whose cpu controller must be available; throttling
+ * writes REGULATOR_THROTTLED_CPU_MAX to its cpu.max, which the kernel applies
+ * at its next scheduler tick. An attached process is moved back to its
+ * cgroup when it is detached.
+ * Only the thread that samples the target calls regulator_update().
+ * Functions return 0 on success and -1 after printing the reason.
+ * ********/
+
+struct regulator
+{
+    enum throttle_method method;
+    /* index of the regulated event in the event set */
+    unsigned int event;
+    long long budget;
+    pid_t pid;
+    /* signals go through the pidfd so that they cannot hit a process that reused the pid, -1 for kill() */
+    int pidfd;
+    int throttled;
+    /* a failed throttle is reported once */
+    int failed;
+    /* cgroup of the target and its cpu.max kept open, THROTTLE_CGROUP only */
+    char cgroup[PATH_MAX];
+    int cpu_max_fd;
+    /* cgroup the process was in before, to move an attached process back */
+    char original_cgroup[PATH_MAX];
+    uint64_t nr_periods;
+    uint64_t nr_throttled;
+    uint64_t throttled_ns;
+    uint64_t throttle_start_ns;
+    /* regulated event per period over the budget */
+    counter_stats budget_used;
+    /* from the end of the period to the throttle having been applied */
+    counter_stats latency;
+};
+
+typedef struct regulator regulator;
+
+/* cgroup_parent is only used with THROTTLE_CGROUP; returns NULL after printing the reason */
+regulator *regulator_create(enum throttle_method method, const char *cgroup_parent, unsigned int event, long long budget);
+
+/* takes control of pid, a spawned command before its exec(); pidfd refers to the process, -1 where
+   pidfds are not available, and stays the caller's to close after regulator_destroy() */
+int regulator_attach(regulator *regulator, pid_t pid, int pidfd);
+
+/* regulates on the record read for the period that ended at period_end_ns and stamps it */
+void regulator_update(regulator *regulator, sample_record *record, uint64_t period_end_ns);
+
+/* lets a throttled target go, at the end of the measurement */
+void regulator_release(regulator *regulator);
+
+void regulator_print(const regulator *regulator, const char *label, const char *event_name);
+
+/* an attached process is moved back to its cgroup, a spawned one must have exited */
+void regulator_destroy(regulator *regulator, int attached);
+
+#endif
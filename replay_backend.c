@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "counter_backend.h"
+#include "pmcol_reader.h"
+
+/**********
+ * Name: replay_backend
+ * Description: counter backend that plays back a recording of the monitor,
+ * a CSV or pmcol output file, instead of reading hardware counters. Every
+ * read() returns the next sample of the recording, with the interval, the
+ * enabled/running times and the coverage it was recorded with, so a run on a
+ * machine without a PMU goes through the scheduler, statistics and writers
+ * exactly like a measured one. Samples are handed out one per tick: a shorter
+ * interval than the recorded one replays faster than real time.
+ * Only the samples of the whole process are replayed, of the first target
+ * when the recording has several. Events are looked up in the recording by
+ * name; read() returns 1 once the recording is exhausted.
+ * ********/
+
+/* the recorded columns of one sample */
+struct replay_sample
+{
+    uint64_t interval_ns;
+    uint64_t time_enabled_ns;
+    uint64_t time_running_ns;
+    long long values[MAX_COUNTERS];
+    float coverage[MAX_COUNTERS];
+};
+
+typedef struct replay_sample replay_sample;
+
+#define MAX_RECORDING_COLUMNS 512
+
+struct replay_backend_priv
+{
+    char *path;
+    unsigned int nr_events;
+    replay_sample *samples;
+    size_t nr_samples;
+    size_t capacity;
+    size_t next;
+};
+
+typedef struct replay_backend_priv replay_backend_priv;
+
+/* column of every field of a sample, -1 if the recording does not have it */
+struct replay_columns
+{
+    int target;
+    int tid;
+    int interval_ns;
+    int time_enabled_ns;
+    int time_running_ns;
+    int values[MAX_COUNTERS];
+    int coverage[MAX_COUNTERS];
+};
+
+typedef struct replay_columns replay_columns;
+
+static int has_suffix(const char *name, const char *suffix)
+{
+    size_t length = strlen(name);
+    size_t suffix_length = strlen(suffix);
+
+    return length >= suffix_length && strcmp(name + length - suffix_length, suffix) == 0;
+}
+
+static int is_csv(const char *path)
+{
+    return has_suffix(path, ".csv");
+}
+
+/* maps the column names of the recording to the fields of a sample */
+static int find_columns(replay_columns *columns, const char * const *names, unsigned int nr_names,
+                        const PAPI_event *events, unsigned int nr_events, const char *path)
+{
+    char coverage_name[128];
+
+    memset(columns, 0xff, sizeof(replay_columns));
+    for (unsigned int c = 0; c < nr_names; c++)
+    {
+        if (strcmp(names[c], "target") == 0)
+        {
+            columns->target = c;
+        }
+        else if (strcmp(names[c], "tid") == 0)
+        {
+            columns->tid = c;
+        }
+        else if (strcmp(names[c], "interval_ns") == 0)
+        {
+            columns->interval_ns = c;
+        }
+        else if (strcmp(names[c], "time_enabled_ns") == 0)
+        {
+            columns->time_enabled_ns = c;
+        }
+        else if (strcmp(names[c], "time_running_ns") == 0)
+        {
+            columns->time_running_ns = c;
+        }
+    }
+    if (columns->interval_ns < 0 || columns->time_enabled_ns < 0 || columns->time_running_ns < 0)
+    {
+        printf("ERROR: %s is not a recording of process_monitor\n", path);
+        return -1;
+    }
+    for (unsigned int e = 0; e < nr_events; e++)
+    {
+        snprintf(coverage_name, sizeof(coverage_name), "%s:coverage", events[e].event_name);
+        for (unsigned int c = 0; c < nr_names; c++)
+        {
+            if (strcmp(names[c], events[e].event_name) == 0)
+            {
+                columns->values[e] = c;
+            }
+            else if (strcmp(names[c], coverage_name) == 0)
+            {
+                columns->coverage[e] = c;
+            }
+        }
+        if (columns->values[e] < 0)
+        {
+            printf("ERROR: event %s is not in the recording %s\n", events[e].event_name, path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static replay_sample *append_sample(replay_backend_priv *priv)
+{
+    if (priv->nr_samples == priv->capacity)
+    {
+        size_t capacity = priv->capacity ? 2 * priv->capacity : 1024;
+        replay_sample *samples = realloc(priv->samples, capacity * sizeof(replay_sample));
+
+        if (samples == NULL)
+        {
+            perror("Could not allocate the recording");
+            return NULL;
+        }
+        priv->samples = samples;
+        priv->capacity = capacity;
+    }
+    return &priv->samples[priv->nr_samples++];
+}
+
+/* splits a line at the commas in place, returns the number of fields */
+static unsigned int split_csv(char *line, char **fields, unsigned int max_fields)
+{
+    unsigned int nr_fields = 0;
+    char *cursor = line;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    while (nr_fields < max_fields)
+    {
+        char *comma = strchr(cursor, ',');
+
+        fields[nr_fields++] = cursor;
+        if (comma == NULL)
+        {
+            break;
+        }
+        *comma = '\0';
+        cursor = comma + 1;
+    }
+    /* every line ends with a comma, drop the empty last field */
+    if (nr_fields > 0 && *fields[nr_fields - 1] == '\0')
+    {
+        nr_fields--;
+    }
+    return nr_fields;
+}
+
+static int load_csv(replay_backend_priv *priv, const PAPI_event *events, unsigned int nr_events)
+{
+    FILE *fp = fopen(priv->path, "r");
+    char *line = NULL;
+    size_t line_size = 0;
+    char *fields[MAX_RECORDING_COLUMNS];
+    unsigned int nr_fields;
+    replay_columns columns;
+    int return_code = 0;
+
+    if (fp == NULL)
+    {
+        printf("ERROR: could not open recording %s\n", priv->path);
+        return -1;
+    }
+    if (getline(&line, &line_size, fp) < 0)
+    {
+        printf("ERROR: recording %s is empty\n", priv->path);
+        free(line);
+        fclose(fp);
+        return -1;
+    }
+    nr_fields = split_csv(line, fields, MAX_RECORDING_COLUMNS);
+    if (find_columns(&columns, (const char * const *)fields, nr_fields, events, nr_events, priv->path) != 0)
+    {
+        free(line);
+        fclose(fp);
+        return -1;
+    }
+
+    while (getline(&line, &line_size, fp) >= 0)
+    {
+        replay_sample *sample;
+
+        nr_fields = split_csv(line, fields, MAX_RECORDING_COLUMNS);
+        if (nr_fields <= (unsigned int)columns.time_running_ns ||
+            (columns.target >= 0 && strtoul(fields[columns.target], NULL, 10) != 0) ||
+            (columns.tid >= 0 && strtol(fields[columns.tid], NULL, 10) != 0))
+        {
+            continue;
+        }
+        sample = append_sample(priv);
+        if (sample == NULL)
+        {
+            return_code = -1;
+            break;
+        }
+        sample->interval_ns = strtoull(fields[columns.interval_ns], NULL, 10);
+        sample->time_enabled_ns = strtoull(fields[columns.time_enabled_ns], NULL, 10);
+        sample->time_running_ns = strtoull(fields[columns.time_running_ns], NULL, 10);
+        for (unsigned int e = 0; e < nr_events; e++)
+        {
+            int value_column = columns.values[e];
+            int coverage_column = columns.coverage[e];
+
+            sample->values[e] = value_column < (int)nr_fields ? strtoll(fields[value_column], NULL, 10) : 0;
+            sample->coverage[e] = coverage_column >= 0 && coverage_column < (int)nr_fields ? strtof(fields[coverage_column], NULL) : 1.0f;
+        }
+    }
+    free(line);
+    fclose(fp);
+    return return_code;
+}
+
+static int load_pmcol(replay_backend_priv *priv, const PAPI_event *events, unsigned int nr_events)
+{
+    pmcol_reader reader;
+    const char *names[MAX_RECORDING_COLUMNS];
+    replay_columns columns;
+    uint64_t nr_rows;
+    int return_code = 0;
+
+    if (pmcol_reader_open(&reader, priv->path) != 0)
+    {
+        printf("ERROR: could not open recording %s\n", priv->path);
+        return -1;
+    }
+    if (reader.header->nr_columns > MAX_RECORDING_COLUMNS)
+    {
+        printf("ERROR: recording %s has more than %d columns\n", priv->path, MAX_RECORDING_COLUMNS);
+        pmcol_reader_close(&reader);
+        return -1;
+    }
+    for (uint32_t c = 0; c < reader.header->nr_columns; c++)
+    {
+        names[c] = reader.columns[c].name;
+    }
+    if (find_columns(&columns, names, reader.header->nr_columns, events, nr_events, priv->path) != 0)
+    {
+        pmcol_reader_close(&reader);
+        return -1;
+    }
+
+    nr_rows = pmcol_reader_nr_rows(&reader);
+    for (uint64_t row = 0; row < nr_rows; row++)
+    {
+        replay_sample *sample;
+
+        if ((columns.target >= 0 && pmcol_reader_cell(&reader, columns.target, row).u != 0) ||
+            (columns.tid >= 0 && pmcol_reader_cell(&reader, columns.tid, row).i != 0))
+        {
+            continue;
+        }
+        sample = append_sample(priv);
+        if (sample == NULL)
+        {
+            return_code = -1;
+            break;
+        }
+        sample->interval_ns = pmcol_reader_cell(&reader, columns.interval_ns, row).u;
+        sample->time_enabled_ns = pmcol_reader_cell(&reader, columns.time_enabled_ns, row).u;
+        sample->time_running_ns = pmcol_reader_cell(&reader, columns.time_running_ns, row).u;
+        for (unsigned int e = 0; e < nr_events; e++)
+        {
+            sample->values[e] = pmcol_reader_cell(&reader, columns.values[e], row).i;
+            sample->coverage[e] = columns.coverage[e] >= 0 ? pmcol_reader_cell(&reader, columns.coverage[e], row).f : 1.0f;
+        }
+    }
+    pmcol_reader_close(&reader);
+    return return_code;
+}
+
+static int replay_backend_init(counter_backend *backend, const PAPI_event *events, unsigned int nr_events)
+{
+    replay_backend_priv *priv = backend->priv;
+    int return_code;
+
+    priv->nr_events = nr_events;
+    return_code = is_csv(priv->path) ? load_csv(priv, events, nr_events) : load_pmcol(priv, events, nr_events);
+    if (return_code == 0 && priv->nr_samples == 0)
+    {
+        printf("ERROR: recording %s has no samples\n", priv->path);
+        return -1;
+    }
+    if (return_code == 0)
+    {
+        printf("Replaying %zu samples from %s\n", priv->nr_samples, priv->path);
+    }
+    return return_code;
+}
+
+static int replay_backend_attach(counter_backend *backend, pid_t pid)
+{
+    (void)backend;
+    (void)pid;
+    return 0;
+}
+
+static int replay_backend_start(counter_backend *backend)
+{
+    replay_backend_priv *priv = backend->priv;
+
+    priv->next = 0;
+    return 0;
+}
+
+static int replay_backend_read(counter_backend *backend, sample_record *record)
+{
+    replay_backend_priv *priv = backend->priv;
+    const replay_sample *sample;
+
+    if (priv->next == priv->nr_samples)
+    {
+        return 1;
+    }
+    sample = &priv->samples[priv->next++];
+    record->interval_ns = sample->interval_ns;
+    record->time_enabled_ns = sample->time_enabled_ns;
+    record->time_running_ns = sample->time_running_ns;
+    for (unsigned int e = 0; e < priv->nr_events; e++)
+    {
+        record->values[e] = sample->values[e];
+        record->coverage[e] = sample->coverage[e];
+    }
+    return 0;
+}
+
+static int replay_backend_stop(counter_backend *backend)
+{
+    (void)backend;
+    return 0;
+}
+
+static void replay_backend_destroy(counter_backend *backend)
+{
+    replay_backend_priv *priv = backend->priv;
+
+    free(priv->samples);
+    free(priv->path);
+    free(priv);
+    free(backend);
+}
+
+counter_backend *replay_backend_create(const char *path)
+{
+    counter_backend *backend = calloc(1, sizeof(counter_backend));
+    replay_backend_priv *priv = calloc(1, sizeof(replay_backend_priv));
+
+    if (backend == NULL || priv == NULL || (priv->path = strdup(path)) == NULL)
+    {
+        free(backend);
+        free(priv);
+        return NULL;
+    }
+
+    backend->name = "replay";
+    backend->own_interval = 1;
+    backend->init = replay_backend_init;
+    backend->attach = replay_backend_attach;
+    backend->start = replay_backend_start;
+    backend->read = replay_backend_read;
+    backend->stop = replay_backend_stop;
+    backend->detach = replay_backend_stop;
+    backend->destroy = replay_backend_destroy;
+    backend->priv = priv;
+    return backend;
+}
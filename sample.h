@@ -0,0 +1,70 @@
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdint.h>
+
+#define MAX_COUNTERS 32
+#define MAX_METRICS 16
+
+/**********
+ * Name: sample_record
+ * Description: fixed-size record pushed by the sampler for every tick.
+ * timestamp_ns is CLOCK_MONOTONIC at the tick, interval_ns the time since the
+ * previous tick, time_enabled_ns/time_running_ns the counter times of the interval.
+ * coverage is the fraction of the interval each counter was scheduled; with
+ * multiplexing the values are already scaled up to the full interval.
+ * target is the index of the monitored process the record belongs to; all
+ * targets read on the same tick share index and timestamp_ns. tid is 0 for
+ * the record of the whole process and the thread id in per-thread series.
+ * region is the pm_region the process was in when it was read, 0 outside
+ * of any; region_changed is set when it entered or left a region during
+ * the interval, so the record only partly belongs to that region.
+ * throttle is the regulator's decision at the end of the interval (see
+ * enum throttle_state) and budget_used the regulated event's delta as a
+ * fraction of its budget, both 0 without regulation.
+ * ********/
+
+enum throttle_state
+{
+    /* the target ran the whole interval */
+    THROTTLE_NONE,
+    /* the target went over its budget and was throttled at the end of the interval */
+    THROTTLE_STOPPED,
+    /* the target spent the interval throttled and was let go at its end */
+    THROTTLE_RESUMED
+};
+
+struct sample_record
+{
+    uint64_t index;
+    uint32_t target;
+    int32_t tid;
+    uint32_t region;
+    uint32_t region_changed;
+    uint32_t throttle;
+    float budget_used;
+    uint64_t timestamp_ns;
+    uint64_t lateness_ns;
+    uint64_t missed_deadlines;
+    uint64_t interval_ns;
+    uint64_t time_enabled_ns;
+    uint64_t time_running_ns;
+    long long values[MAX_COUNTERS];
+    float coverage[MAX_COUNTERS];
+    /* derived metrics, filled in by the writer thread */
+    double metrics[MAX_METRICS];
+};
+
+typedef struct sample_record sample_record;
+
+/* counter value normalized to events per second of the measured interval */
+static inline double sample_counter_rate(const sample_record *record, unsigned int counter)
+{
+    if (record->interval_ns == 0)
+    {
+        return 0.0;
+    }
+    return (double)record->values[counter] * 1e9 / (double)record->interval_ns;
+}
+
+#endif
@@ -0,0 +1,45 @@
+#include <stdlib.h>
+#include "sample_arena.h"
+
+int sample_arena_init(sample_arena *arena, size_t nr_chunks)
+{
+    arena->chunks = calloc(nr_chunks, sizeof(sample_chunk));
+    arena->free_list = NULL;
+    arena->nr_chunks = nr_chunks;
+    if (arena->chunks == NULL)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < nr_chunks; i++)
+    {
+        sample_arena_put(arena, &arena->chunks[i]);
+    }
+    return 0;
+}
+
+void sample_arena_destroy(sample_arena *arena)
+{
+    free(arena->chunks);
+    arena->chunks = NULL;
+    arena->free_list = NULL;
+}
+
+sample_chunk *sample_arena_get(sample_arena *arena)
+{
+    sample_chunk *chunk = arena->free_list;
+
+    if (chunk != NULL)
+    {
+        arena->free_list = chunk->next;
+        chunk->next = NULL;
+        chunk->nr_records = 0;
+    }
+    return chunk;
+}
+
+void sample_arena_put(sample_arena *arena, sample_chunk *chunk)
+{
+    chunk->next = arena->free_list;
+    arena->free_list = chunk;
+}
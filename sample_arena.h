@@ -0,0 +1,41 @@
+#ifndef SAMPLE_ARENA_H
+#define SAMPLE_ARENA_H
+
+#include <stddef.h>
+#include "sample.h"
+
+#define SAMPLE_CHUNK_RECORDS 1024
+
+/**********
+ * Name: sample_arena
+ * Description: fixed pool of sample chunks owned by the writer thread. A chunk
+ * is taken, filled, flushed to the output sink and put back, so the memory
+ * used for samples does not grow with the length of the run.
+ * ********/
+
+struct sample_chunk
+{
+    struct sample_chunk *next;
+    size_t nr_records;
+    sample_record records[SAMPLE_CHUNK_RECORDS];
+};
+
+typedef struct sample_chunk sample_chunk;
+
+struct sample_arena
+{
+    sample_chunk *chunks;
+    sample_chunk *free_list;
+    size_t nr_chunks;
+};
+
+typedef struct sample_arena sample_arena;
+
+int sample_arena_init(sample_arena *arena, size_t nr_chunks);
+void sample_arena_destroy(sample_arena *arena);
+
+/* returns NULL when every chunk is in use */
+sample_chunk *sample_arena_get(sample_arena *arena);
+void sample_arena_put(sample_arena *arena, sample_chunk *chunk);
+
+#endif
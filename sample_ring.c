@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sample_ring.h"
+
+sample_ring *sample_ring_create(size_t capacity)
+{
+    sample_ring *ring = aligned_alloc(64, sizeof(sample_ring));
+    size_t size = 1;
+
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+
+    ring->records = calloc(size, sizeof(sample_record));
+    if (ring->records == NULL)
+    {
+        free(ring);
+        return NULL;
+    }
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->high_water = 0;
+    return ring;
+}
+
+void sample_ring_destroy(sample_ring *ring)
+{
+    if (ring == NULL)
+    {
+        return;
+    }
+    free(ring->records);
+    free(ring);
+}
+
+int sample_ring_push(sample_ring *ring, const sample_record *record)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head - tail > ring->mask)
+    {
+        return -1;
+    }
+    memcpy(&ring->records[head & ring->mask], record, sizeof(sample_record));
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    if (head + 1 - tail > ring->high_water)
+    {
+        ring->high_water = head + 1 - tail;
+    }
+    return 0;
+}
+
+int sample_ring_pop(sample_ring *ring, sample_record *record)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (tail == head)
+    {
+        return -1;
+    }
+    memcpy(record, &ring->records[tail & ring->mask], sizeof(sample_record));
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include "sample.h"
+
+/* one ring per sampler thread */
+#define MAX_SAMPLERS 16
+
+/**********
+ * Name: sample_ring
+ * Description: single-producer/single-consumer lock-free ring of sample
+ * records. The sampler is the only producer, the writer thread the only consumer.
+ * ********/
+
+struct sample_ring
+{
+    _Alignas(64) atomic_size_t head;
+    /* most records the ring has held at once, kept by the producer */
+    size_t high_water;
+    _Alignas(64) atomic_size_t tail;
+    _Alignas(64) size_t mask;
+    sample_record *records;
+};
+
+typedef struct sample_ring sample_ring;
+
+/* capacity is rounded up to a power of two */
+sample_ring *sample_ring_create(size_t capacity);
+void sample_ring_destroy(sample_ring *ring);
+
+/* returns -1 without blocking when the ring is full */
+int sample_ring_push(sample_ring *ring, const sample_record *record);
+
+/* returns -1 when the ring is empty */
+int sample_ring_pop(sample_ring *ring, sample_record *record);
+
+#endif
@@ -0,0 +1,565 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sample_writer.h"
+
+/* how long the writer sleeps when the ring is empty */
+#define WRITER_IDLE_NS 1000000
+
+/* chunks in the writer arena, one is filled while the others are spare */
+#define WRITER_ARENA_CHUNKS 2
+
+/* histogram resolution of derived metrics, three decimals */
+#define METRIC_STATS_SCALE 1000.0
+
+static const char *region_name(const sample_writer *writer, unsigned int target, uint32_t region)
+{
+    const struct pm_region_page *page = writer->config.region_pages[target];
+    const char *name = page != NULL ? pm_region_name(page, region) : NULL;
+
+    if (name != NULL)
+    {
+        return name;
+    }
+    return region == 0 ? "-" : "(unnamed)";
+}
+
+static void print_header(const sample_writer *writer)
+{
+    printf("<-- PAPI Counters -->\n");
+    if (writer->config.nr_targets > 1)
+    {
+        printf("target\t");
+    }
+    printf("time_ms\t\t");
+    if (writer->config.region_pages != NULL)
+    {
+        printf("region\t\t");
+    }
+    if (writer->config.regulation)
+    {
+        printf("budget\t");
+    }
+    for(size_t i = 0; i < writer->config.nr_counters; i++)
+    {
+        printf("%s\t", writer->config.events[i].event_name);
+        if (writer->config.rates)
+        {
+            printf("%s/s\t", writer->config.events[i].event_name);
+        }
+    }
+    for (size_t i = 0; i < writer->nr_metrics; i++)
+    {
+        printf("%s\t", writer->config.metrics->metrics[i].name);
+    }
+    printf("\n");
+    return;
+}
+
+static void print_sample(const sample_writer *writer, const sample_record *record)
+{
+    if (writer->config.nr_targets > 1)
+    {
+        printf("%u \t", record->target);
+    }
+    printf("%.3f \t", (double)(record->timestamp_ns - writer->first_timestamp_ns) / 1e6);
+    if (writer->config.region_pages != NULL)
+    {
+        printf("%s%s \t", region_name(writer, record->target, record->region), record->region_changed ? "*" : "");
+    }
+    if (writer->config.regulation)
+    {
+        /* ! marks a target throttled for the next period */
+        printf("%.2f%s \t", record->budget_used, record->throttle == THROTTLE_STOPPED ? "!" : "");
+    }
+    for(size_t j = 0; j < writer->config.nr_counters; j++)
+    {
+        printf("%lld \t\t", record->values[j]);
+        if (writer->config.rates)
+        {
+            printf("%.0f \t", sample_counter_rate(record, j));
+        }
+    }
+    for (size_t j = 0; j < writer->nr_metrics; j++)
+    {
+        printf("%.3f \t", record->metrics[j]);
+    }
+    printf("\n");
+}
+
+static void print_target_statistics(const sample_writer *writer, const writer_target *target)
+{
+    printf("event\t\t mean \t\t stddev \t min \t\t max \t\t p50 \t\t p90 \t\t p99 \t\t p99.9\n");
+    for (size_t i = 0; i < writer->config.nr_counters; i++)
+    {
+        const counter_stats *stats = &target->stats[i];
+
+        printf("%s:\t %.0f \t %.0f \t %.0f \t %.0f \t %.0f \t %.0f \t %.0f \t %.0f", writer->config.events[i].event_name,
+               stats->mean, counter_stats_stddev(stats), stats->min, stats->max,
+               counter_stats_percentile(stats, 50.0), counter_stats_percentile(stats, 90.0),
+               counter_stats_percentile(stats, 99.0), counter_stats_percentile(stats, 99.9));
+        if (writer->config.coverage)
+        {
+            double coverage = target->nr_samples ? target->coverage_sums[i] / target->nr_samples : 0.0;
+
+            printf(" \t(estimated, counted %.1f%% of the time)", coverage * 100.0);
+        }
+        printf("\n");
+    }
+    for (size_t i = 0; i < writer->nr_metrics; i++)
+    {
+        const counter_stats *stats = &target->stats[writer->config.nr_counters + i];
+
+        printf("%s:\t %.3f \t %.3f \t %.3f \t %.3f \t %.3f \t %.3f \t %.3f \t %.3f\n", writer->config.metrics->metrics[i].name,
+               stats->mean, counter_stats_stddev(stats), stats->min, stats->max,
+               counter_stats_percentile(stats, 50.0), counter_stats_percentile(stats, 90.0),
+               counter_stats_percentile(stats, 99.0), counter_stats_percentile(stats, 99.9));
+    }
+    printf("\n");
+}
+
+static void print_counter_statistics(const sample_writer *writer)
+{
+    printf("\n");
+    if (writer->config.nr_targets == 1)
+    {
+        printf("***** Statistics of captured metrics (%zu samples) *****\n", writer->nr_samples);
+        print_target_statistics(writer, &writer->targets[0]);
+        return;
+    }
+    for (unsigned int t = 0; t < writer->config.nr_targets; t++)
+    {
+        printf("***** Statistics of target %u: %s (%zu samples) *****\n", t,
+               writer->config.target_names[t], writer->targets[t].nr_samples);
+        print_target_statistics(writer, &writer->targets[t]);
+    }
+}
+
+/* the totals of a region as one record, so the derived metrics can be evaluated on them */
+static void region_record(const sample_writer *writer, const region_totals *totals, sample_record *record)
+{
+    memset(record, 0, sizeof(sample_record));
+    record->interval_ns = totals->time_ns;
+    record->time_enabled_ns = totals->time_ns;
+    record->time_running_ns = totals->time_ns;
+    for (size_t j = 0; j < writer->config.nr_counters; j++)
+    {
+        record->values[j] = totals->values[j];
+        record->coverage[j] = 1.0f;
+    }
+    if (writer->nr_metrics > 0)
+    {
+        metric_set_evaluate(writer->config.metrics, record);
+    }
+}
+
+static void print_region_statistics(const sample_writer *writer)
+{
+    sample_record record;
+
+    for (unsigned int t = 0; t < writer->config.nr_targets; t++)
+    {
+        const writer_target *target = &writer->targets[t];
+
+        printf("***** Regions of %s *****\n", writer->config.target_names != NULL ? writer->config.target_names[t] : "the process");
+        /* changed intervals are credited to the region at their end, part of their counts belongs elsewhere */
+        printf("region\t\t samples \t changed \t changed_time \t time_s");
+        for (size_t i = 0; i < writer->config.nr_counters; i++)
+        {
+            printf(" \t %s", writer->config.events[i].event_name);
+        }
+        for (size_t i = 0; i < writer->nr_metrics; i++)
+        {
+            printf(" \t %s", writer->config.metrics->metrics[i].name);
+        }
+        printf("\n");
+        for (uint32_t r = 0; r <= PM_REGION_MAX; r++)
+        {
+            const region_totals *totals = &target->regions[r];
+
+            if (totals->nr_samples == 0)
+            {
+                continue;
+            }
+            region_record(writer, totals, &record);
+            printf("%s:\t %zu \t\t %zu \t\t %.1f%% \t\t %.3f", region_name(writer, t, r), totals->nr_samples,
+                   totals->nr_changed, totals->time_ns > 0 ? 100.0 * totals->changed_ns / totals->time_ns : 0.0,
+                   totals->time_ns / 1e9);
+            for (size_t j = 0; j < writer->config.nr_counters; j++)
+            {
+                printf(" \t %lld", totals->values[j]);
+            }
+            for (size_t j = 0; j < writer->nr_metrics; j++)
+            {
+                printf(" \t %.3f", record.metrics[j]);
+            }
+            printf("\n");
+        }
+        printf("\n");
+    }
+}
+
+/* target,region,name,samples,changed,changed_time_ns,time_ns followed by the counter totals and metrics */
+static void write_region_totals(const sample_writer *writer, const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    sample_record record;
+    int failed;
+
+    if (fp == NULL)
+    {
+        printf("ERROR: could not create region file %s\n", path);
+        return;
+    }
+    fprintf(fp, "target,region,name,samples,changed,changed_time_ns,time_ns");
+    for (size_t i = 0; i < writer->config.nr_counters; i++)
+    {
+        fprintf(fp, ",%s", writer->config.events[i].event_name);
+    }
+    for (size_t i = 0; i < writer->nr_metrics; i++)
+    {
+        fprintf(fp, ",%s", writer->config.metrics->metrics[i].name);
+    }
+    fprintf(fp, "\n");
+    for (unsigned int t = 0; t < writer->config.nr_targets; t++)
+    {
+        for (uint32_t r = 0; r <= PM_REGION_MAX; r++)
+        {
+            const region_totals *totals = &writer->targets[t].regions[r];
+
+            if (totals->nr_samples == 0)
+            {
+                continue;
+            }
+            region_record(writer, totals, &record);
+            fprintf(fp, "%u,%u,%s,%zu,%zu,%llu,%llu", t, r, region_name(writer, t, r), totals->nr_samples, totals->nr_changed,
+                    (unsigned long long)totals->changed_ns, (unsigned long long)totals->time_ns);
+            for (size_t j = 0; j < writer->config.nr_counters; j++)
+            {
+                fprintf(fp, ",%lld", totals->values[j]);
+            }
+            for (size_t j = 0; j < writer->nr_metrics; j++)
+            {
+                fprintf(fp, ",%.6g", record.metrics[j]);
+            }
+            fprintf(fp, "\n");
+        }
+    }
+    failed = ferror(fp);
+    if (fclose(fp) != 0 || failed)
+    {
+        printf("ERROR: could not write region file %s\n", path);
+        return;
+    }
+    printf("Wrote the region totals to %s\n", path);
+}
+
+static void print_schedule_summary(const sample_writer *writer)
+{
+    const counter_stats *lateness = &writer->lateness;
+
+    printf("***** Sampling schedule *****\n");
+    printf("samples:\t %zu\n", writer->nr_ticks);
+    printf("missed deadlines:\t %llu\n", (unsigned long long)writer->missed_deadlines);
+    printf("mean lateness:\t %.0f us\n", lateness->mean / 1000);
+    printf("p99 lateness:\t %.0f us\n", counter_stats_percentile(lateness, 99.0) / 1000);
+    printf("max lateness:\t %.0f us\n", lateness->max / 1000);
+    printf("\n");
+}
+
+static unsigned long long monotonic_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* hands the current chunk to the sink and recycles it */
+static void flush_chunk(sample_writer *writer)
+{
+    if (writer->chunk == NULL)
+    {
+        return;
+    }
+    if (writer->sink != NULL && writer->chunk->nr_records > 0 &&
+        writer->sink->write(writer->sink, writer->chunk->records, writer->chunk->nr_records) != 0)
+    {
+        /* stop writing rather than failing on every following chunk */
+        printf("ERROR: could not write to output file %s\n", writer->sink->path);
+        output_sink_close(writer->sink, &writer->bytes_written);
+        writer->sink = NULL;
+    }
+    sample_arena_put(&writer->arena, writer->chunk);
+    writer->chunk = NULL;
+}
+
+static void store_record(sample_writer *writer, const sample_record *record)
+{
+    if (writer->chunk == NULL)
+    {
+        writer->chunk = sample_arena_get(&writer->arena);
+    }
+    writer->chunk->records[writer->chunk->nr_records++] = *record;
+    writer->nr_records++;
+    if (writer->chunk->nr_records == SAMPLE_CHUNK_RECORDS)
+    {
+        flush_chunk(writer);
+    }
+}
+
+static void consume_sample(sample_writer *writer, unsigned int ring, sample_record *record)
+{
+    writer_target *target = &writer->targets[record->target];
+
+    if (writer->nr_metrics > 0)
+    {
+        metric_set_evaluate(writer->config.metrics, record);
+    }
+    if (record->tid != 0)
+    {
+        /* thread series are only written out, the statistics cover the processes */
+        store_record(writer, record);
+        return;
+    }
+    if (writer->nr_samples == 0)
+    {
+        writer->first_timestamp_ns = record->timestamp_ns;
+    }
+    for (size_t j = 0; j < writer->config.nr_counters; j++)
+    {
+        counter_stats_add(&target->stats[j], record->values[j]);
+        target->coverage_sums[j] += record->coverage[j];
+    }
+    for (size_t j = 0; j < writer->nr_metrics; j++)
+    {
+        counter_stats_add(&target->stats[writer->config.nr_counters + j], record->metrics[j]);
+    }
+    target->nr_samples++;
+    if (target->regions != NULL)
+    {
+        region_totals *totals = &target->regions[record->region <= PM_REGION_MAX ? record->region : 0];
+
+        totals->nr_samples++;
+        totals->nr_changed += record->region_changed != 0;
+        totals->changed_ns += record->region_changed ? record->interval_ns : 0;
+        totals->time_ns += record->interval_ns;
+        for (size_t j = 0; j < writer->config.nr_counters; j++)
+        {
+            totals->values[j] += record->values[j];
+        }
+    }
+    if (writer->ring_ticks[ring] == 0 || record->index != writer->last_index[ring])
+    {
+        counter_stats_add(&writer->lateness, record->lateness_ns);
+        writer->missed_deadlines += record->missed_deadlines;
+        writer->last_index[ring] = record->index;
+        writer->ring_ticks[ring]++;
+        writer->nr_ticks++;
+    }
+    writer->nr_samples++;
+    store_record(writer, record);
+}
+
+static void drain_ring(sample_writer *writer, unsigned int ring)
+{
+    sample_record record;
+
+    while (sample_ring_pop(writer->rings[ring], &record) == 0)
+    {
+        writer_target *target = &writer->targets[record.target];
+
+        consume_sample(writer, ring, &record);
+        if (record.tid != 0)
+        {
+            continue;
+        }
+
+        /* console output is throttled, only the latest sample of a target in a period is shown */
+        unsigned long long now = monotonic_ms();
+        if (now - target->last_print >= writer->config.print_interval_ms)
+        {
+            print_sample(writer, &record);
+            target->last_print = now;
+            target->unprinted = 0;
+        }
+        else
+        {
+            target->last_record = record;
+            target->unprinted = 1;
+        }
+    }
+}
+
+static void *sample_writer_thread(void *arg)
+{
+    sample_writer *writer = arg;
+    const struct timespec idle = {0, WRITER_IDLE_NS};
+
+    print_header(writer);
+
+    for (;;)
+    {
+        int stopping = atomic_load(&writer->stop);
+
+        for (unsigned int ring = 0; ring < writer->nr_rings; ring++)
+        {
+            drain_ring(writer, ring);
+        }
+        for (unsigned int t = 0; writer->config.profilers != NULL && t < writer->config.nr_targets; t++)
+        {
+            ip_profiler_resolve(writer->config.profilers[t]);
+        }
+        if (atomic_exchange(&writer->report_requested, 0))
+        {
+            print_counter_statistics(writer);
+        }
+        if (stopping)
+        {
+            break;
+        }
+        nanosleep(&idle, NULL);
+    }
+    for (unsigned int t = 0; t < writer->config.nr_targets; t++)
+    {
+        if (writer->targets[t].unprinted)
+        {
+            print_sample(writer, &writer->targets[t].last_record);
+        }
+    }
+    flush_chunk(writer);
+
+    /* Print the statistics of collected data */
+    print_counter_statistics(writer);
+    if (writer->config.region_pages != NULL)
+    {
+        print_region_statistics(writer);
+        if (writer->config.regions_filename != NULL)
+        {
+            write_region_totals(writer, writer->config.regions_filename);
+        }
+    }
+    print_schedule_summary(writer);
+
+    if (writer->sink != NULL)
+    {
+        printf("Wrote %zu measurements to output file %s\n", writer->nr_records, writer->sink->path);
+        output_sink_close(writer->sink, &writer->bytes_written);
+        writer->sink = NULL;
+    }
+    return NULL;
+}
+
+int sample_writer_start(sample_writer *writer, sample_ring * const *rings, unsigned int nr_rings, const sample_writer_config *config)
+{
+    memset(writer, 0, sizeof(sample_writer));
+    atomic_init(&writer->stop, 0);
+    memcpy(writer->rings, rings, nr_rings * sizeof(sample_ring *));
+    writer->nr_rings = nr_rings;
+    writer->config = *config;
+
+    atomic_init(&writer->report_requested, 0);
+
+    if (writer->config.nr_targets == 0)
+    {
+        writer->config.nr_targets = 1;
+    }
+    writer->nr_metrics = config->metrics != NULL ? config->metrics->nr_metrics : 0;
+
+    size_t series = config->nr_counters + writer->nr_metrics;
+    writer->stats = calloc(writer->config.nr_targets * series, sizeof(counter_stats));
+    writer->targets = calloc(writer->config.nr_targets, sizeof(writer_target));
+    if (config->region_pages != NULL)
+    {
+        writer->regions = calloc(writer->config.nr_targets * (PM_REGION_MAX + 1), sizeof(region_totals));
+    }
+    if (writer->stats == NULL || writer->targets == NULL || (config->region_pages != NULL && writer->regions == NULL) ||
+        sample_arena_init(&writer->arena, WRITER_ARENA_CHUNKS) != 0)
+    {
+        perror("Could not allocate sample arena");
+        free(writer->stats);
+        free(writer->targets);
+        free(writer->regions);
+        return -1;
+    }
+    for (unsigned int t = 0; t < writer->config.nr_targets; t++)
+    {
+        writer_target *target = &writer->targets[t];
+
+        target->stats = &writer->stats[t * series];
+        if (writer->regions != NULL)
+        {
+            target->regions = &writer->regions[t * (PM_REGION_MAX + 1)];
+        }
+        for (size_t i = 0; i < config->nr_counters; i++)
+        {
+            counter_stats_init(&target->stats[i], 1.0);
+        }
+        for (size_t i = 0; i < writer->nr_metrics; i++)
+        {
+            counter_stats_init(&target->stats[config->nr_counters + i], METRIC_STATS_SCALE);
+        }
+    }
+    counter_stats_init(&writer->lateness, 1.0);
+
+    /* Write output to file is requested */
+    if (config->output_filename != NULL)
+    {
+        output_columns columns = {config->events, config->nr_counters, config->rates, config->coverage, config->metrics,
+                                  writer->config.nr_targets, config->per_thread, config->region_pages != NULL,
+                                  config->regulation};
+
+        writer->sink = output_sink_open(config->format, config->output_filename, &columns);
+        if (writer->sink == NULL)
+        {
+            sample_arena_destroy(&writer->arena);
+            free(writer->stats);
+            free(writer->targets);
+            free(writer->regions);
+            return -1;
+        }
+    }
+
+    if (pthread_create(&writer->thread, NULL, sample_writer_thread, writer) != 0)
+    {
+        perror("Could not start writer thread");
+        if (writer->sink != NULL)
+        {
+            output_sink_close(writer->sink, &writer->bytes_written);
+        }
+        sample_arena_destroy(&writer->arena);
+        free(writer->stats);
+        free(writer->targets);
+        free(writer->regions);
+        return -1;
+    }
+    return 0;
+}
+
+void sample_writer_finish(sample_writer *writer)
+{
+    atomic_store(&writer->stop, 1);
+    pthread_join(writer->thread, NULL);
+    sample_arena_destroy(&writer->arena);
+    for (size_t i = 0; i < writer->config.nr_targets * (writer->config.nr_counters + writer->nr_metrics); i++)
+    {
+        counter_stats_destroy(&writer->stats[i]);
+    }
+    free(writer->stats);
+    free(writer->targets);
+    free(writer->regions);
+    writer->stats = NULL;
+    writer->targets = NULL;
+    writer->regions = NULL;
+}
+
+void sample_writer_destroy(sample_writer *writer)
+{
+    counter_stats_destroy(&writer->lateness);
+}
+
+void sample_writer_request_report(sample_writer *writer)
+{
+    atomic_store(&writer->report_requested, 1);
+}
@@ -0,0 +1,135 @@
+#ifndef SAMPLE_WRITER_H
+#define SAMPLE_WRITER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "events.h"
+#include "sample.h"
+#include "sample_ring.h"
+#include "sample_arena.h"
+#include "output_sink.h"
+#include "counter_stats.h"
+#include "metrics.h"
+#include "pm_region.h"
+#include "ip_profiler.h"
+
+/**********
+ * Name: sample_writer
+ * Description: consumer thread of the sample rings, one per sampler. Collects the samples into
+ * arena chunks that are flushed to the output sink and recycled when full,
+ * keeps streaming statistics per target and counter and prints the samples of
+ * every target to the console at most once per print_interval_ms. Per-thread
+ * records only go to the output file. Memory use does not depend on the
+ * number of samples.
+ * With region pages the counts of every target are also summed per
+ * pm_region, reported with the statistics and written to regions_filename.
+ * ********/
+
+struct sample_writer_config
+{
+    const PAPI_event *events;
+    unsigned int nr_counters;
+    unsigned int print_interval_ms;
+    /* NULL when no file should be written */
+    const char *output_filename;
+    enum output_format format;
+    /* add per-second rate columns next to the raw counts */
+    int rates;
+    /* counters are multiplexed, report how much of the time each one was counted */
+    int coverage;
+    /* derived metrics evaluated for every sample, may be NULL */
+    const metric_set *metrics;
+    /* names of the monitored processes, indexed by sample_record.target */
+    const char * const *target_names;
+    unsigned int nr_targets;
+    /* records with a tid are written, add a tid column */
+    int per_thread;
+    /* pm_region page of every target, NULL when the targets have none */
+    const struct pm_region_page * const *region_pages;
+    /* per-region totals, NULL when no file should be written */
+    const char *regions_filename;
+    /* the targets are regulated, add the throttle and budget_used columns */
+    int regulation;
+    /* profiler of every target whose collected samples the writer resolves, NULL when not profiling */
+    ip_profiler * const *profilers;
+};
+
+typedef struct sample_writer_config sample_writer_config;
+
+/* counts of one target summed over the records taken in one region */
+struct region_totals
+{
+    size_t nr_samples;
+    /* records whose interval saw the region change, and their time */
+    size_t nr_changed;
+    uint64_t changed_ns;
+    uint64_t time_ns;
+    long long values[MAX_COUNTERS];
+};
+
+typedef struct region_totals region_totals;
+
+struct writer_target
+{
+    /* nr_counters entries followed by the derived metrics */
+    counter_stats *stats;
+    double coverage_sums[MAX_COUNTERS];
+    size_t nr_samples;
+    unsigned long long last_print;
+    /* latest sample, printed at the end if the throttle skipped it */
+    sample_record last_record;
+    int unprinted;
+    /* indexed by region id, PM_REGION_MAX + 1 entries, NULL without region pages */
+    region_totals *regions;
+};
+
+typedef struct writer_target writer_target;
+
+struct sample_writer
+{
+    pthread_t thread;
+    atomic_int stop;
+    atomic_int report_requested;
+    sample_ring *rings[MAX_SAMPLERS];
+    unsigned int nr_rings;
+    sample_writer_config config;
+    uint64_t first_timestamp_ns;
+
+    sample_arena arena;
+    sample_chunk *chunk;
+    output_sink *sink;
+
+    size_t nr_samples;
+    /* samples plus per-thread records handed to the sink */
+    size_t nr_records;
+    /* the series of every target */
+    counter_stats *stats;
+    /* region totals of every target */
+    region_totals *regions;
+    /* kept after finish for the overhead report, until sample_writer_destroy() */
+    counter_stats lateness;
+    unsigned int nr_metrics;
+    writer_target *targets;
+    /* schedule statistics are counted once per tick of every sampler, not per target */
+    size_t nr_ticks;
+    size_t ring_ticks[MAX_SAMPLERS];
+    uint64_t last_index[MAX_SAMPLERS];
+    uint64_t missed_deadlines;
+    /* size of the output file once it is closed */
+    uint64_t bytes_written;
+};
+
+typedef struct sample_writer sample_writer;
+
+int sample_writer_start(sample_writer *writer, sample_ring * const *rings, unsigned int nr_rings, const sample_writer_config *config);
+
+/* drains the ring, flushes the output file, prints the statistics and joins the thread */
+void sample_writer_finish(sample_writer *writer);
+
+/* frees what finish keeps for the overhead report */
+void sample_writer_destroy(sample_writer *writer);
+
+/* asks the writer thread to print the statistics so far, safe to call from a signal handler */
+void sample_writer_request_report(sample_writer *writer);
+
+#endif
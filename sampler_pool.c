@@ -0,0 +1,712 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "sampler_pool.h"
+
+/* the supervisor checks the shards at least this often */
+#define SUPERVISOR_MIN_PERIOD_NS 1000000ULL
+
+#define SAMPLER_FIFO_PRIORITY 50
+
+/* a new assignment is only taken if it lowers the busiest shard by 10% */
+#define REBALANCE_GAIN_PERCENT 90
+
+/* weight of the latest read in the moving average of the read cost */
+#define READ_COST_SHIFT 3
+
+int parse_cpu_list(const char *list, cpu_set_t *cpus)
+{
+    const char *cursor = list;
+
+    CPU_ZERO(cpus);
+    while (*cursor != '\0')
+    {
+        char *end;
+        long first = strtol(cursor, &end, 10);
+        long last = first;
+
+        if (end == cursor || first < 0)
+        {
+            printf("ERROR: invalid CPU list %s\n", list);
+            return -1;
+        }
+        if (*end == '-')
+        {
+            cursor = end + 1;
+            last = strtol(cursor, &end, 10);
+            if (end == cursor || last < first)
+            {
+                printf("ERROR: invalid CPU list %s\n", list);
+                return -1;
+            }
+        }
+        if (last >= CPU_SETSIZE)
+        {
+            printf("ERROR: CPU %ld is out of range\n", last);
+            return -1;
+        }
+        for (long cpu = first; cpu <= last; cpu++)
+        {
+            CPU_SET(cpu, cpus);
+        }
+        if (*end == ',')
+        {
+            end++;
+        }
+        else if (*end != '\0')
+        {
+            printf("ERROR: invalid CPU list %s\n", list);
+            return -1;
+        }
+        cursor = end;
+    }
+    return CPU_COUNT(cpus) > 0 ? 0 : -1;
+}
+
+static uint64_t target_cost(target *target)
+{
+    uint64_t cost = atomic_load(&target->read_cost_ns);
+
+    /* not read yet, weigh it by the number of event sets */
+    return cost > 0 ? cost : 1000 * (target->nr_threads + 1);
+}
+
+/* longest processing time first: the most expensive target goes to the least loaded shard */
+static void rebalance(sampler_pool *pool, int force)
+{
+    target_list *targets = pool->targets;
+    unsigned int nr_shards = pool->config.nr_samplers;
+    uint64_t current[MAX_SAMPLERS] = {0};
+    uint64_t balanced[MAX_SAMPLERS] = {0};
+    uint64_t current_max = 0;
+    uint64_t balanced_max = 0;
+    unsigned int *order = malloc(targets->nr_targets * sizeof(unsigned int));
+    int *shard_of = malloc(targets->nr_targets * sizeof(int));
+    unsigned int nr_live = 0;
+
+    if (order == NULL || shard_of == NULL)
+    {
+        free(order);
+        free(shard_of);
+        return;
+    }
+    for (unsigned int t = 0; t < targets->nr_targets; t++)
+    {
+        target *target = &targets->targets[t];
+
+        if (atomic_load(&target->exited) || atomic_load(&target->exit_pending))
+        {
+            continue;
+        }
+        current[atomic_load(&target->assigned)] += target_cost(target);
+        order[nr_live++] = t;
+    }
+
+    /* insertion sort by cost, highest first; the target count is small */
+    for (unsigned int i = 1; i < nr_live; i++)
+    {
+        unsigned int key = order[i];
+        uint64_t key_cost = target_cost(&targets->targets[key]);
+        unsigned int j = i;
+
+        while (j > 0 && target_cost(&targets->targets[order[j - 1]]) < key_cost)
+        {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = key;
+    }
+    for (unsigned int i = 0; i < nr_live; i++)
+    {
+        unsigned int lightest = 0;
+
+        for (unsigned int s = 1; s < nr_shards; s++)
+        {
+            if (balanced[s] < balanced[lightest])
+            {
+                lightest = s;
+            }
+        }
+        shard_of[order[i]] = lightest;
+        balanced[lightest] += target_cost(&targets->targets[order[i]]);
+    }
+    for (unsigned int s = 0; s < nr_shards; s++)
+    {
+        current_max = current[s] > current_max ? current[s] : current_max;
+        balanced_max = balanced[s] > balanced_max ? balanced[s] : balanced_max;
+    }
+
+    if (nr_live > 0 && (force ? balanced_max < current_max : balanced_max * 100 < current_max * REBALANCE_GAIN_PERCENT))
+    {
+        for (unsigned int i = 0; i < nr_live; i++)
+        {
+            atomic_store(&targets->targets[order[i]].assigned, shard_of[order[i]]);
+        }
+        pool->rebalances++;
+    }
+    free(order);
+    free(shard_of);
+}
+
+int sampler_pool_init(sampler_pool *pool, target_list *targets, const sampler_pool_config *config)
+{
+    memset(pool, 0, sizeof(sampler_pool));
+    pool->config = *config;
+    pool->targets = targets;
+    atomic_init(&pool->stop, 0);
+
+    if (config->nr_samplers == 0 || config->nr_samplers > MAX_SAMPLERS)
+    {
+        printf("ERROR: between 1 and %d samplers are supported\n", MAX_SAMPLERS);
+        return -1;
+    }
+    for (unsigned int s = 0; s < config->nr_samplers; s++)
+    {
+        sampler_shard *shard = &pool->shards[s];
+
+        shard->id = s;
+        shard->pool = pool;
+        shard->ring = sample_ring_create(config->ring_capacity);
+        if (shard->ring == NULL)
+        {
+            perror("Could not allocate sample ring");
+            sampler_pool_destroy(pool);
+            return -1;
+        }
+        pool->rings[s] = shard->ring;
+        atomic_init(&shard->missed_deadlines, 0);
+        atomic_init(&shard->dropped_samples, 0);
+        atomic_init(&shard->done, 0);
+        counter_stats_init(&shard->read_latency, 1.0);
+    }
+
+    /* round-robin first, the measured read costs refine it later */
+    for (unsigned int t = 0; t < targets->nr_targets; t++)
+    {
+        atomic_store(&targets->targets[t].assigned, t % config->nr_samplers);
+        atomic_store(&targets->targets[t].owner, t % config->nr_samplers);
+    }
+    rebalance(pool, 1);
+    for (unsigned int t = 0; t < targets->nr_targets; t++)
+    {
+        atomic_store(&targets->targets[t].owner, atomic_load(&targets->targets[t].assigned));
+    }
+    pool->rebalances = 0;
+    return 0;
+}
+
+static void configure_sampler(sampler_shard *shard)
+{
+    const sampler_pool_config *config = &shard->pool->config;
+
+    if (config->pin)
+    {
+        unsigned int nth = shard->id % CPU_COUNT(&config->cpus);
+        cpu_set_t cpu;
+
+        CPU_ZERO(&cpu);
+        for (int c = 0; c < CPU_SETSIZE; c++)
+        {
+            if (CPU_ISSET(c, &config->cpus) && nth-- == 0)
+            {
+                CPU_SET(c, &cpu);
+                break;
+            }
+        }
+        /* pid 0 is the calling thread */
+        if (sched_setaffinity(0, sizeof(cpu), &cpu) != 0)
+        {
+            printf("Warning: could not pin sampler %u: %s\n", shard->id, strerror(errno));
+        }
+    }
+    if (config->realtime)
+    {
+        struct sched_param param;
+
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = SAMPLER_FIFO_PRIORITY;
+        if (sched_setscheduler(0, SCHED_FIFO, &param) != 0)
+        {
+            printf("Warning: could not run sampler %u at SCHED_FIFO: %s\n", shard->id, strerror(errno));
+        }
+    }
+}
+
+static void push_record(sampler_shard *shard, const sample_record *record)
+{
+    if (sample_ring_push(shard->ring, record) != 0)
+    {
+        atomic_fetch_add(&shard->dropped_samples, 1);
+    }
+}
+
+static void update_read_cost(target *target, uint64_t cost)
+{
+    uint64_t average = atomic_load(&target->read_cost_ns);
+
+    atomic_store(&target->read_cost_ns, average ? average - (average >> READ_COST_SHIFT) + (cost >> READ_COST_SHIFT) : cost);
+}
+
+/* stamps the record read for a target and pushes it with its per-thread records */
+static void push_target_records(sampler_shard *shard, unsigned int index, const sample_tick *tick, sample_record *record,
+                                uint64_t timestamp_ns, int exiting)
+{
+    target *target = &shard->pool->targets->targets[index];
+
+    record->index = shard->scheduler.tick;
+    record->target = index;
+    record->tid = 0;
+    record->timestamp_ns = timestamp_ns;
+    if (!target->backend->own_interval)
+    {
+        record->interval_ns = timestamp_ns - target->previous_ns;
+    }
+    target->previous_ns = timestamp_ns;
+    record->lateness_ns = exiting ? 0 : tick->lateness_ns;
+    record->missed_deadlines = exiting ? 0 : tick->missed;
+    target_read_region(target, record);
+    record->throttle = THROTTLE_NONE;
+    record->budget_used = 0.0f;
+    if (target->regulator != NULL && !exiting)
+    {
+        regulator_update(target->regulator, record, tick->deadline_ns);
+    }
+    push_record(shard, record);
+
+    /* the per-thread series share the tick of the process record */
+    for (unsigned int k = 0; target->per_thread && k < target->nr_threads; k++)
+    {
+        sample_record *thread_record = &target->threads[k].record;
+
+        thread_record->index = record->index;
+        thread_record->target = index;
+        thread_record->tid = target->threads[k].totals.tid;
+        thread_record->timestamp_ns = record->timestamp_ns;
+        thread_record->interval_ns = record->interval_ns;
+        thread_record->lateness_ns = record->lateness_ns;
+        thread_record->missed_deadlines = record->missed_deadlines;
+        thread_record->region = record->region;
+        thread_record->region_changed = record->region_changed;
+        thread_record->throttle = record->throttle;
+        thread_record->budget_used = record->budget_used;
+        push_record(shard, thread_record);
+    }
+
+    /* samples the backend took on its own within the interval, as the series of the main thread */
+    if (target->backend->read_burst != NULL)
+    {
+        sample_record burst_record;
+
+        while (target->backend->read_burst(target->backend, &burst_record) == 0)
+        {
+            burst_record.index = record->index;
+            burst_record.target = index;
+            burst_record.tid = target->pid;
+            burst_record.region = record->region;
+            burst_record.region_changed = record->region_changed;
+            burst_record.throttle = record->throttle;
+            burst_record.budget_used = record->budget_used;
+            push_record(shard, &burst_record);
+        }
+    }
+}
+
+/* reads one target and pushes its record and per-thread records */
+static void sample_target(sampler_shard *shard, unsigned int index, const sample_tick *tick, sample_record *record)
+{
+    target *target = &shard->pool->targets->targets[index];
+    int exiting = atomic_load_explicit(&target->exit_pending, memory_order_acquire);
+    uint64_t timestamp_ns = tick->actual_ns;
+    uint64_t read_start_ns;
+    int return_code;
+
+    if (exiting)
+    {
+        /* the counters keep the final counts of the exited target, take its partial last interval */
+        if (target->exit.exit_ns <= target->previous_ns)
+        {
+            atomic_store(&target->exited, 1);
+            return;
+        }
+        timestamp_ns = target->exit.exit_ns;
+    }
+
+    read_start_ns = monotonic_ns();
+    return_code = target_read(target, record);
+    if (return_code > 0)
+    {
+        printf("The counter source of %s has no more samples\n", target->label);
+        atomic_store(&target->exited, 1);
+        return;
+    }
+    if (return_code != 0)
+    {
+        printf("ERROR: could not read the counters of %s, it is no longer sampled\n", target->label);
+        atomic_store(&target->exited, 1);
+        return;
+    }
+    counter_stats_add(&shard->read_latency, monotonic_ns() - read_start_ns);
+    push_target_records(shard, index, tick, record, timestamp_ns, exiting);
+    update_read_cost(target, monotonic_ns() - read_start_ns);
+
+    if (exiting)
+    {
+        atomic_store(&target->exited, 1);
+    }
+}
+
+/* the expected size rides along in the upper half of the user data */
+static void batched_read_complete(void *context, uint64_t user_data, int result)
+{
+    sampler_shard *shard = context;
+    batched_read *pending = &shard->pending[user_data & 0xffffffff];
+
+    if (result != (int)(user_data >> 32))
+    {
+        pending->failed = 1;
+    }
+}
+
+/* queues the reads of a target into the shard's io_uring, returns 0 if it has to be read on its own */
+static int queue_target(sampler_shard *shard, unsigned int index)
+{
+    target *target = &shard->pool->targets->targets[index];
+    counter_read reads[MAX_COUNTERS];
+    int nr_reads;
+
+    if (atomic_load_explicit(&target->exit_pending, memory_order_acquire))
+    {
+        return 0;
+    }
+    nr_reads = target_read_requests(target, reads);
+    if (nr_reads == 0)
+    {
+        return 0;
+    }
+    shard->pending[shard->nr_pending].target = index;
+    shard->pending[shard->nr_pending].failed = 0;
+    for (int i = 0; i < nr_reads; i++)
+    {
+        uint64_t user_data = ((uint64_t)reads[i].size << 32) | shard->nr_pending;
+
+        if (uring_reader_queue(&shard->reader, reads[i].fd, reads[i].buffer, reads[i].size, user_data) != 0)
+        {
+            shard->pending[shard->nr_pending].failed = 1;
+            break;
+        }
+    }
+    shard->nr_pending++;
+    return 1;
+}
+
+/* issues the queued reads with one io_uring_enter() and pushes the records of the batch */
+static void sample_batch(sampler_shard *shard, const sample_tick *tick, sample_record *record)
+{
+    target_list *targets = shard->pool->targets;
+    uint64_t read_start_ns = monotonic_ns();
+    uint64_t cost;
+
+    if (uring_reader_submit(&shard->reader) != 0)
+    {
+        for (unsigned int p = 0; p < shard->nr_pending; p++)
+        {
+            shard->pending[p].failed = 1;
+        }
+    }
+    /* the batch costs the same for every target in it */
+    cost = (monotonic_ns() - read_start_ns) / shard->nr_pending;
+
+    for (unsigned int p = 0; p < shard->nr_pending; p++)
+    {
+        unsigned int index = shard->pending[p].target;
+        target *target = &targets->targets[index];
+
+        if (shard->pending[p].failed || target_read_complete(target, record) != 0)
+        {
+            printf("ERROR: could not read the counters of %s, it is no longer sampled\n", target->label);
+            atomic_store(&target->exited, 1);
+            continue;
+        }
+        push_target_records(shard, index, tick, record, tick->actual_ns, 0);
+        counter_stats_add(&shard->read_latency, cost);
+        update_read_cost(target, cost);
+    }
+    shard->nr_pending = 0;
+}
+
+static void *sampler_thread(void *arg)
+{
+    sampler_shard *shard = arg;
+    sampler_pool *pool = shard->pool;
+    target_list *targets = pool->targets;
+    sample_tick tick;
+    sample_record record;
+
+    configure_sampler(shard);
+    memset(&record, 0, sizeof(record));
+
+    for (size_t i = 0; pool->config.num_measurements == 0 || i < pool->config.num_measurements; i++)
+    {
+        if (sample_scheduler_wait(&shard->scheduler, &tick) < 0 || atomic_load(&pool->stop))
+        {
+            break;
+        }
+        for (unsigned int t = 0; t < targets->nr_targets; t++)
+        {
+            target *target = &targets->targets[t];
+            int assigned;
+
+            if (atomic_load_explicit(&target->owner, memory_order_acquire) != (int)shard->id || atomic_load(&target->exited))
+            {
+                continue;
+            }
+            /* hand over at the tick boundary, the new owner reads it from its next pass on */
+            assigned = atomic_load(&target->assigned);
+            if (assigned != (int)shard->id)
+            {
+                atomic_store_explicit(&target->owner, assigned, memory_order_release);
+                continue;
+            }
+            if (!shard->batched || !queue_target(shard, t))
+            {
+                sample_target(shard, t, &tick, &record);
+            }
+            if (target->profiler != NULL)
+            {
+                ip_profiler_collect(target->profiler);
+            }
+        }
+        if (shard->nr_pending > 0)
+        {
+            sample_batch(shard, &tick, &record);
+        }
+        atomic_store(&shard->missed_deadlines, shard->scheduler.missed_deadlines);
+        if (target_list_alive(targets) == 0)
+        {
+            break;
+        }
+    }
+    getrusage(RUSAGE_THREAD, &shard->rusage);
+    atomic_store(&shard->done, 1);
+    return NULL;
+}
+
+/* sized for every target, a rebalance may move all of them to this shard */
+static void start_batched_reads(sampler_shard *shard)
+{
+    target_list *targets = shard->pool->targets;
+    counter_read reads[MAX_COUNTERS];
+    unsigned int nr_reads = 0;
+
+    for (unsigned int t = 0; t < targets->nr_targets; t++)
+    {
+        nr_reads += target_read_requests(&targets->targets[t], reads);
+    }
+    if (nr_reads == 0)
+    {
+        printf("Warning: no target can be read in batches, sampler %u reads them one by one\n", shard->id);
+        return;
+    }
+    shard->pending = calloc(targets->nr_targets, sizeof(batched_read));
+    if (shard->pending == NULL)
+    {
+        perror("Could not allocate the read batch");
+        return;
+    }
+    if (uring_reader_init(&shard->reader, nr_reads, batched_read_complete, shard) != 0)
+    {
+        free(shard->pending);
+        shard->pending = NULL;
+        return;
+    }
+    shard->nr_pending = 0;
+    shard->batched = 1;
+}
+
+static void stop_batched_reads(sampler_shard *shard)
+{
+    if (shard->batched)
+    {
+        uring_reader_destroy(&shard->reader);
+        shard->batched = 0;
+    }
+    free(shard->pending);
+    shard->pending = NULL;
+}
+
+int sampler_pool_start(sampler_pool *pool)
+{
+    target_list *targets = pool->targets;
+
+    if (pool->config.realtime && mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        printf("Warning: could not lock the monitor's memory: %s\n", strerror(errno));
+    }
+
+    /* every shard ticks on the same grid, so all targets share the tick */
+    pool->start_ns = monotonic_ns();
+    for (unsigned int t = 0; t < targets->nr_targets; t++)
+    {
+        targets->targets[t].previous_ns = pool->start_ns;
+    }
+    for (unsigned int s = 0; s < pool->config.nr_samplers; s++)
+    {
+        sampler_shard *shard = &pool->shards[s];
+
+        if (sample_scheduler_init_at(&shard->scheduler, pool->config.period_ns, pool->start_ns) != 0)
+        {
+            return -1;
+        }
+        if (pool->config.batched_reads)
+        {
+            start_batched_reads(shard);
+        }
+        if (pthread_create(&shard->thread, NULL, sampler_thread, shard) != 0)
+        {
+            perror("Could not start sampler thread");
+            sample_scheduler_destroy(&shard->scheduler);
+            stop_batched_reads(shard);
+            return -1;
+        }
+        pool->nr_started++;
+    }
+    return 0;
+}
+
+static int all_shards_done(const sampler_pool *pool)
+{
+    for (unsigned int s = 0; s < pool->nr_started; s++)
+    {
+        if (!atomic_load(&pool->shards[s].done))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* a shard that starts missing deadlines asks for a better spread */
+static int shards_overloaded(sampler_pool *pool)
+{
+    int overloaded = 0;
+
+    for (unsigned int s = 0; s < pool->nr_started; s++)
+    {
+        unsigned long long missed = atomic_load(&pool->shards[s].missed_deadlines);
+
+        if (missed > pool->checked_missed[s])
+        {
+            overloaded = 1;
+        }
+        pool->checked_missed[s] = missed;
+    }
+    return overloaded;
+}
+
+int sampler_pool_run(sampler_pool *pool, const sigset_t *stop_signals)
+{
+    target_list *targets = pool->targets;
+    sample_scheduler supervisor;
+    sample_tick tick;
+    uint64_t period_ns = pool->config.period_ns > SUPERVISOR_MIN_PERIOD_NS ? pool->config.period_ns : SUPERVISOR_MIN_PERIOD_NS;
+    int return_code = 0;
+
+    if (sample_scheduler_init_at(&supervisor, period_ns, pool->start_ns) != 0 ||
+        sample_scheduler_watch_signals(&supervisor, stop_signals) != 0)
+    {
+        return_code = -1;
+    }
+    for (unsigned int t = 0; return_code == 0 && t < targets->nr_targets; t++)
+    {
+        if (sample_scheduler_watch_child(&supervisor, targets->targets[t].pid) != 0)
+        {
+            return_code = -1;
+        }
+    }
+
+    while (return_code == 0 && !all_shards_done(pool))
+    {
+        int event = sample_scheduler_wait(&supervisor, &tick);
+
+        if (event < 0)
+        {
+            break;
+        }
+        if (event == SCHEDULER_STOP)
+        {
+            printf("Received signal %d, ending the measurement\n", supervisor.stop_signal);
+            break;
+        }
+        if (event == SCHEDULER_CHILD_EXIT)
+        {
+            target *exited = target_list_find(targets, supervisor.exit.pid);
+
+            if (exited != NULL && !atomic_load(&exited->exit_pending))
+            {
+                exited->exit = supervisor.exit;
+                atomic_store_explicit(&exited->exit_pending, 1, memory_order_release);
+                if (pool->config.nr_samplers > 1)
+                {
+                    rebalance(pool, 1);
+                }
+            }
+            continue;
+        }
+        if (pool->config.nr_samplers > 1 && shards_overloaded(pool))
+        {
+            rebalance(pool, 0);
+        }
+    }
+
+    atomic_store(&pool->stop, 1);
+    for (unsigned int s = 0; s < pool->nr_started; s++)
+    {
+        pthread_join(pool->shards[s].thread, NULL);
+        sample_scheduler_destroy(&pool->shards[s].scheduler);
+        stop_batched_reads(&pool->shards[s]);
+    }
+    pool->nr_started = 0;
+    sample_scheduler_destroy(&supervisor);
+    if (pool->rebalances > 0)
+    {
+        printf("Targets were rebalanced over the samplers %u times\n", pool->rebalances);
+    }
+    return return_code;
+}
+
+unsigned long long sampler_pool_dropped_samples(const sampler_pool *pool)
+{
+    unsigned long long dropped = 0;
+
+    for (unsigned int s = 0; s < pool->config.nr_samplers; s++)
+    {
+        dropped += atomic_load(&pool->shards[s].dropped_samples);
+    }
+    return dropped;
+}
+
+void sampler_pool_read_latency(const sampler_pool *pool, counter_stats *stats)
+{
+    for (unsigned int s = 0; s < pool->config.nr_samplers; s++)
+    {
+        counter_stats_merge(stats, &pool->shards[s].read_latency);
+    }
+}
+
+void sampler_pool_destroy(sampler_pool *pool)
+{
+    for (unsigned int s = 0; s < MAX_SAMPLERS; s++)
+    {
+        if (pool->shards[s].ring != NULL)
+        {
+            sample_ring_destroy(pool->shards[s].ring);
+            pool->shards[s].ring = NULL;
+            pool->rings[s] = NULL;
+        }
+        counter_stats_destroy(&pool->shards[s].read_latency);
+    }
+}
@@ -0,0 +1,124 @@
+#ifndef SAMPLER_POOL_H
+#define SAMPLER_POOL_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include "sample_ring.h"
+#include "counter_stats.h"
+#include "scheduler.h"
+#include "target.h"
+#include "uring_reader.h"
+
+/**********
+ * Name: sampler_pool
+ * Description: sampler threads that read the targets on a common tick grid.
+ * Every shard owns a subset of the targets and pushes their records into
+ * its own ring, so each ring keeps a single producer. The calling thread
+ * supervises: it watches exits and stop signals, and rebalances the targets
+ * over the shards by their measured read cost when a target exits or a
+ * shard starts missing deadlines.
+ * A target changes shards only at a tick boundary of its current owner,
+ * which hands it over by storing the new owner, so two shards never read
+ * the same target. Functions return 0 on success and -1 after printing the reason.
+ * With batched_reads a shard queues the reads of all its single event set
+ * targets into an io_uring and issues them with one io_uring_enter() per
+ * tick instead of one read() per target.
+ * The owner of a profiled target also copies the raw records out of its
+ * sample buffers after each read, the writer thread resolves them.
+ * Samples a backend takes on its own (read_burst) follow the record of
+ * their tick as the series of the target's main thread.
+ * A regulated target is throttled or let go by its owner right after its
+ * read, before the record is pushed.
+ * ********/
+
+struct sampler_pool_config
+{
+    unsigned int nr_samplers;
+    uint64_t period_ns;
+    /* 0 samples until every target has exited */
+    unsigned int num_measurements;
+    size_t ring_capacity;
+    /* pin sampler n to the n-th CPU of cpus, round-robin */
+    int pin;
+    cpu_set_t cpus;
+    /* SCHED_FIFO samplers and all memory locked */
+    int realtime;
+    /* read through io_uring, one syscall per tick and shard */
+    int batched_reads;
+};
+
+typedef struct sampler_pool_config sampler_pool_config;
+
+typedef struct sampler_pool sampler_pool;
+
+/* target whose reads are in the current batch */
+struct batched_read
+{
+    unsigned int target;
+    int failed;
+};
+
+typedef struct batched_read batched_read;
+
+struct sampler_shard
+{
+    pthread_t thread;
+    unsigned int id;
+    sampler_pool *pool;
+    sample_ring *ring;
+    sample_scheduler scheduler;
+    int batched;
+    uring_reader reader;
+    /* one slot per target, nr_pending used in the current tick */
+    batched_read *pending;
+    unsigned int nr_pending;
+    /* time the reads of one target took, in ns */
+    counter_stats read_latency;
+    /* CPU use of the sampler thread, taken when it ends */
+    struct rusage rusage;
+    /* written by the shard, read by the supervisor */
+    atomic_ullong missed_deadlines;
+    atomic_ullong dropped_samples;
+    atomic_int done;
+};
+
+typedef struct sampler_shard sampler_shard;
+
+struct sampler_pool
+{
+    sampler_pool_config config;
+    target_list *targets;
+    sampler_shard shards[MAX_SAMPLERS];
+    /* ring of shard n, for the writer */
+    sample_ring *rings[MAX_SAMPLERS];
+    unsigned int nr_started;
+    uint64_t start_ns;
+    atomic_int stop;
+    /* missed deadlines of every shard at the previous balance check */
+    unsigned long long checked_missed[MAX_SAMPLERS];
+    unsigned int rebalances;
+};
+
+/* creates the rings and spreads the targets over the shards */
+int sampler_pool_init(sampler_pool *pool, target_list *targets, const sampler_pool_config *config);
+
+/* starts the sampler threads, the first interval of every target begins now */
+int sampler_pool_start(sampler_pool *pool);
+
+/* supervises until the measurement ends, then stops and joins the samplers */
+int sampler_pool_run(sampler_pool *pool, const sigset_t *stop_signals);
+
+unsigned long long sampler_pool_dropped_samples(const sampler_pool *pool);
+
+/* read latency of all samplers merged into stats, after sampler_pool_run() */
+void sampler_pool_read_latency(const sampler_pool *pool, counter_stats *stats);
+
+/* frees the rings and the read latencies, after the writer has finished */
+void sampler_pool_destroy(sampler_pool *pool);
+
+/* comma separated CPUs and ranges, e.g. "0,2-3" */
+int parse_cpu_list(const char *list, cpu_set_t *cpus);
+
+#endif
@@ -0,0 +1,289 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include "scheduler.h"
+
+#define NS_PER_SEC 1000000000ULL
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NS_PER_SEC + now.tv_nsec;
+}
+
+static struct timespec ns_to_timespec(uint64_t ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ns / NS_PER_SEC;
+    ts.tv_nsec = ns % NS_PER_SEC;
+    return ts;
+}
+
+/* the timer is tagged 0, watched process i is tagged i + 1 */
+#define TIMER_TAG 0
+#define SIGNAL_TAG UINT32_MAX
+
+static int epoll_add(int epoll_fd, int fd, uint32_t tag)
+{
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = tag;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+int sample_scheduler_init(sample_scheduler *scheduler, uint64_t period_ns)
+{
+    return sample_scheduler_init_at(scheduler, period_ns, monotonic_ns());
+}
+
+int sample_scheduler_init_at(sample_scheduler *scheduler, uint64_t period_ns, uint64_t start_ns)
+{
+    struct itimerspec spec;
+
+    memset(scheduler, 0, sizeof(sample_scheduler));
+    scheduler->period_ns = period_ns;
+    scheduler->start_ns = start_ns;
+    scheduler->timer_fd = -1;
+    scheduler->signal_fd = -1;
+
+    scheduler->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (scheduler->epoll_fd < 0)
+    {
+        perror("Could not create scheduler epoll set");
+        return -1;
+    }
+
+    if (period_ns == 0)
+    {
+        return 0;
+    }
+
+    scheduler->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (scheduler->timer_fd < 0)
+    {
+        perror("Could not create sampling timer");
+        sample_scheduler_destroy(scheduler);
+        return -1;
+    }
+
+    /* the kernel keeps the absolute grid start + n * period, so there is no drift */
+    spec.it_value = ns_to_timespec(scheduler->start_ns + period_ns);
+    spec.it_interval = ns_to_timespec(period_ns);
+    if (timerfd_settime(scheduler->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0 ||
+        epoll_add(scheduler->epoll_fd, scheduler->timer_fd, TIMER_TAG) < 0)
+    {
+        perror("Could not arm sampling timer");
+        sample_scheduler_destroy(scheduler);
+        return -1;
+    }
+    return 0;
+}
+
+int sample_scheduler_watch_child(sample_scheduler *scheduler, pid_t pid)
+{
+    scheduler_child *children;
+    scheduler_child *child;
+
+    children = realloc(scheduler->children, (scheduler->nr_children + 1) * sizeof(scheduler_child));
+    if (children == NULL)
+    {
+        perror("Could not watch child");
+        return -1;
+    }
+    scheduler->children = children;
+    child = &children[scheduler->nr_children];
+    child->pid = pid;
+    child->fd = syscall(SYS_pidfd_open, pid, 0);
+    if (child->fd >= 0 && epoll_add(scheduler->epoll_fd, child->fd, scheduler->nr_children + 1) < 0)
+    {
+        perror("Could not watch child pidfd");
+        close(child->fd);
+        return -1;
+    }
+    /* kernels before 5.3 have no pidfd, the child is then checked on every tick */
+    scheduler->nr_children++;
+    return 0;
+}
+
+int sample_scheduler_watch_signals(sample_scheduler *scheduler, const sigset_t *signals)
+{
+    scheduler->signal_fd = signalfd(-1, signals, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (scheduler->signal_fd < 0 || epoll_add(scheduler->epoll_fd, scheduler->signal_fd, SIGNAL_TAG) < 0)
+    {
+        perror("Could not watch stop signals");
+        return -1;
+    }
+    return 0;
+}
+
+/* returns 1 if the watched process has exited, children of the monitor are reaped */
+static int reap_child(sample_scheduler *scheduler, scheduler_child *child)
+{
+    child_exit *exit_info = &scheduler->exit;
+    pid_t ret;
+
+    if (child->pid <= 0)
+    {
+        return 0;
+    }
+    memset(exit_info, 0, sizeof(child_exit));
+    ret = wait4(child->pid, &exit_info->status, WNOHANG, &exit_info->rusage);
+    if (ret == child->pid)
+    {
+        exit_info->reaped = 1;
+    }
+    else if (ret < 0 && errno == ECHILD)
+    {
+        /* not our child, a readable pidfd or a failing kill() means it is gone */
+        if (child->fd < 0 && kill(child->pid, 0) == 0)
+        {
+            return 0;
+        }
+    }
+    else
+    {
+        return 0;
+    }
+    exit_info->pid = child->pid;
+    exit_info->exit_ns = monotonic_ns();
+    child->pid = 0;
+    if (child->fd >= 0)
+    {
+        /* an exited pidfd stays readable, it must leave the epoll set */
+        epoll_ctl(scheduler->epoll_fd, EPOLL_CTL_DEL, child->fd, NULL);
+        close(child->fd);
+        child->fd = -1;
+    }
+    return 1;
+}
+
+int sample_scheduler_wait(sample_scheduler *scheduler, sample_tick *tick)
+{
+    uint64_t expirations = scheduler->pending_expirations;
+    struct epoll_event events[SCHEDULER_MAX_EVENTS];
+    int timeout = scheduler->timer_fd >= 0 ? -1 : 0;
+    int exited = 0;
+
+    scheduler->pending_expirations = 0;
+    while (expirations == 0 && !exited)
+    {
+        int nr_events = epoll_wait(scheduler->epoll_fd, events, SCHEDULER_MAX_EVENTS, timeout);
+
+        if (nr_events < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Could not wait for sampling timer");
+            return -1;
+        }
+
+        /* the whole batch is taken in, a timer read together with an exit must not be lost */
+        for (int i = 0; i < nr_events; i++)
+        {
+            uint32_t tag = events[i].data.u32;
+            struct signalfd_siginfo siginfo;
+
+            if (tag == SIGNAL_TAG)
+            {
+                if (read(scheduler->signal_fd, &siginfo, sizeof(siginfo)) == sizeof(siginfo))
+                {
+                    scheduler->stop_signal = siginfo.ssi_signo;
+                    return SCHEDULER_STOP;
+                }
+                continue;
+            }
+            if (tag != TIMER_TAG)
+            {
+                /* further exits stay readable for the next call */
+                if (!exited && reap_child(scheduler, &scheduler->children[tag - 1]))
+                {
+                    exited = 1;
+                }
+                continue;
+            }
+            if (read(scheduler->timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            {
+                expirations = 0;
+            }
+        }
+        if (scheduler->timer_fd < 0)
+        {
+            expirations = 1;
+        }
+    }
+
+    for (unsigned int i = 0; !exited && i < scheduler->nr_children; i++)
+    {
+        if (scheduler->children[i].fd < 0 && reap_child(scheduler, &scheduler->children[i]))
+        {
+            exited = 1;
+        }
+    }
+    if (exited)
+    {
+        /* the deadlines that passed are reported by the next call, which then does not block */
+        scheduler->pending_expirations = scheduler->timer_fd >= 0 ? expirations : 0;
+        return SCHEDULER_CHILD_EXIT;
+    }
+
+    /* more than one expiration means the previous tick overran the deadlines in between */
+    scheduler->tick += expirations;
+    scheduler->missed_deadlines += expirations - 1;
+
+    tick->actual_ns = monotonic_ns();
+    tick->deadline_ns = scheduler->period_ns ? scheduler->start_ns + scheduler->tick * scheduler->period_ns : tick->actual_ns;
+    tick->lateness_ns = tick->actual_ns > tick->deadline_ns ? tick->actual_ns - tick->deadline_ns : 0;
+    tick->missed = expirations - 1;
+    return SCHEDULER_TICK;
+}
+
+void sample_scheduler_destroy(sample_scheduler *scheduler)
+{
+    if (scheduler->timer_fd >= 0)
+    {
+        close(scheduler->timer_fd);
+        scheduler->timer_fd = -1;
+    }
+    if (scheduler->signal_fd >= 0)
+    {
+        close(scheduler->signal_fd);
+        scheduler->signal_fd = -1;
+    }
+    for (unsigned int i = 0; i < scheduler->nr_children; i++)
+    {
+        if (scheduler->children[i].fd >= 0)
+        {
+            close(scheduler->children[i].fd);
+        }
+    }
+    free(scheduler->children);
+    scheduler->children = NULL;
+    scheduler->nr_children = 0;
+    if (scheduler->epoll_fd >= 0)
+    {
+        close(scheduler->epoll_fd);
+        scheduler->epoll_fd = -1;
+    }
+}
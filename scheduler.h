@@ -0,0 +1,100 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/**********
+ * Name: sample_scheduler
+ * Description: fires on absolute CLOCK_MONOTONIC deadlines start + n * period
+ * using a timerfd, so the work done between ticks never stretches the period.
+ * Deadlines that pass while the sampler is busy are counted as missed and skipped.
+ * Watched processes are waited for through their pidfds in the same epoll set,
+ * so an exit ends the wait immediately instead of being noticed by polling.
+ * Stop signals are received through a signalfd in the same set.
+ * ********/
+
+#define SCHEDULER_MAX_EVENTS 16
+
+enum scheduler_event
+{
+    SCHEDULER_TICK,
+    SCHEDULER_CHILD_EXIT,
+    SCHEDULER_STOP
+};
+
+struct child_exit
+{
+    pid_t pid;
+    /* status and rusage are only known for children of the monitor */
+    int reaped;
+    int status;
+    uint64_t exit_ns;
+    struct rusage rusage;
+};
+
+typedef struct child_exit child_exit;
+
+struct scheduler_child
+{
+    pid_t pid;
+    /* -1 when the kernel has no pidfd_open, the process is then checked on every tick */
+    int fd;
+};
+
+typedef struct scheduler_child scheduler_child;
+
+struct sample_scheduler
+{
+    int timer_fd;
+    int epoll_fd;
+    scheduler_child *children;
+    unsigned int nr_children;
+    int signal_fd;
+    /* signal that ended the measurement */
+    int stop_signal;
+    uint64_t period_ns;
+    uint64_t start_ns;
+    uint64_t tick;
+    uint64_t missed_deadlines;
+    /* expirations read in the same wait as an exit, reported by the next call */
+    uint64_t pending_expirations;
+    child_exit exit;
+};
+
+typedef struct sample_scheduler sample_scheduler;
+
+struct sample_tick
+{
+    uint64_t deadline_ns;
+    uint64_t actual_ns;
+    uint64_t lateness_ns;
+    uint64_t missed;
+};
+
+typedef struct sample_tick sample_tick;
+
+uint64_t monotonic_ns(void);
+
+/* a period of 0 makes the scheduler free-running */
+int sample_scheduler_init(sample_scheduler *scheduler, uint64_t period_ns);
+
+/* same grid start + n * period for schedulers that must tick together */
+int sample_scheduler_init_at(sample_scheduler *scheduler, uint64_t period_ns, uint64_t start_ns);
+
+/* reports the exit of pid as SCHEDULER_CHILD_EXIT and reaps it into scheduler->exit,
+   pid does not have to be a child of the monitor */
+int sample_scheduler_watch_child(sample_scheduler *scheduler, pid_t pid);
+
+/* reports the given signals as SCHEDULER_STOP; they must already be blocked in every thread */
+int sample_scheduler_watch_signals(sample_scheduler *scheduler, const sigset_t *signals);
+
+/* blocks until the next deadline or the exit of a watched process, returns the
+   scheduler_event or -1; tick describes the deadline. One exit is reported per call. */
+int sample_scheduler_wait(sample_scheduler *scheduler, sample_tick *tick);
+
+void sample_scheduler_destroy(sample_scheduler *scheduler);
+
+#endif
@@ -0,0 +1,175 @@
+#include <stdlib.h>
+#include <string.h>
+#include "stack_trie.h"
+
+#define MAX_FRAME_NAME 256
+/* deepest path written, perf stops the chains at 127 frames by default */
+#define MAX_FOLDED_DEPTH 512
+
+int stack_trie_init(stack_trie *trie)
+{
+    memset(trie, 0, sizeof(stack_trie));
+    trie->capacity = 1024;
+    trie->index_capacity = 2048;
+    trie->nodes = calloc(trie->capacity, sizeof(stack_node));
+    trie->index = calloc(trie->index_capacity, sizeof(uint32_t));
+    if (trie->nodes == NULL || trie->index == NULL)
+    {
+        perror("Could not allocate the stack trie");
+        free(trie->nodes);
+        free(trie->index);
+        return -1;
+    }
+    trie->nr_nodes = 1;
+    return 0;
+}
+
+void stack_trie_free(stack_trie *trie)
+{
+    free(trie->nodes);
+    free(trie->index);
+    memset(trie, 0, sizeof(stack_trie));
+}
+
+static uint32_t frame_hash(uint32_t parent, const stack_frame *frame)
+{
+    uint64_t key = (uintptr_t)frame->symbol ^ ((uintptr_t)frame->module << 7) ^ ((uint64_t)parent << 40);
+
+    return (key * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+/* slot of the child of parent with the given frame, or the free slot where it belongs */
+static uint32_t index_slot(const stack_trie *trie, const uint32_t *index, uint32_t capacity, uint32_t parent, const stack_frame *frame)
+{
+    uint32_t slot = frame_hash(parent, frame) & (capacity - 1);
+
+    while (index[slot] != 0)
+    {
+        const stack_node *node = &trie->nodes[index[slot]];
+
+        if (node->parent == parent && node->frame.symbol == frame->symbol && node->frame.module == frame->module)
+        {
+            break;
+        }
+        slot = (slot + 1) & (capacity - 1);
+    }
+    return slot;
+}
+
+static int grow(stack_trie *trie)
+{
+    if (trie->nr_nodes == trie->capacity)
+    {
+        uint32_t capacity = 2 * trie->capacity;
+        stack_node *nodes = realloc(trie->nodes, capacity * sizeof(stack_node));
+
+        if (nodes == NULL)
+        {
+            return -1;
+        }
+        trie->nodes = nodes;
+        trie->capacity = capacity;
+    }
+    if (2 * (trie->nr_nodes + 1) > trie->index_capacity)
+    {
+        uint32_t capacity = 2 * trie->index_capacity;
+        uint32_t *index = calloc(capacity, sizeof(uint32_t));
+
+        if (index == NULL)
+        {
+            return -1;
+        }
+        for (uint32_t n = 1; n < trie->nr_nodes; n++)
+        {
+            index[index_slot(trie, index, capacity, trie->nodes[n].parent, &trie->nodes[n].frame)] = n;
+        }
+        free(trie->index);
+        trie->index = index;
+        trie->index_capacity = capacity;
+    }
+    return 0;
+}
+
+void stack_trie_add(stack_trie *trie, const stack_frame *frames, unsigned int nr_frames)
+{
+    uint32_t node = 0;
+
+    for (unsigned int f = 0; f < nr_frames; f++)
+    {
+        uint32_t slot = index_slot(trie, trie->index, trie->index_capacity, node, &frames[f]);
+        uint32_t child = trie->index[slot];
+
+        if (child == 0)
+        {
+            if (trie->nr_nodes >= MAX_STACK_NODES || grow(trie) != 0)
+            {
+                trie->nr_truncated++;
+                break;
+            }
+            /* the index may have been rebuilt */
+            slot = index_slot(trie, trie->index, trie->index_capacity, node, &frames[f]);
+            child = trie->nr_nodes++;
+            memset(&trie->nodes[child], 0, sizeof(stack_node));
+            trie->nodes[child].frame = frames[f];
+            trie->nodes[child].parent = node;
+            trie->index[slot] = child;
+        }
+        node = child;
+    }
+    trie->nodes[node].samples++;
+}
+
+void stack_frame_name(const stack_frame *frame, char *name, size_t size)
+{
+    const char *slash;
+
+    if (frame->symbol != NULL)
+    {
+        snprintf(name, size, "%s", frame->symbol->name);
+        return;
+    }
+    /* pseudo modules such as [unknown] and [vdso] already carry their brackets */
+    if (frame->module[0] == '[')
+    {
+        snprintf(name, size, "%s", frame->module);
+        return;
+    }
+    slash = strrchr(frame->module, '/');
+    snprintf(name, size, "[%s]", slash != NULL ? slash + 1 : frame->module);
+}
+
+/* one line per node with samples, the path is rebuilt from the parent links */
+void stack_trie_write_folded(const stack_trie *trie, const char *root, uint64_t weight, FILE *fp)
+{
+    uint32_t path[MAX_FOLDED_DEPTH];
+    char name[MAX_FRAME_NAME];
+
+    for (uint32_t n = 1; n < trie->nr_nodes; n++)
+    {
+        unsigned int depth = 0;
+
+        if (trie->nodes[n].samples == 0)
+        {
+            continue;
+        }
+        for (uint32_t node = n; node != 0 && depth < MAX_FOLDED_DEPTH; node = trie->nodes[node].parent)
+        {
+            path[depth++] = node;
+        }
+        if (root != NULL)
+        {
+            fprintf(fp, "%s;", root);
+        }
+        while (depth-- > 0)
+        {
+            stack_frame_name(&trie->nodes[path[depth]].frame, name, sizeof(name));
+            fprintf(fp, depth > 0 ? "%s;" : "%s", name);
+        }
+        fprintf(fp, " %llu\n", (unsigned long long)(trie->nodes[n].samples * weight));
+    }
+    /* samples without any resolvable frame */
+    if (trie->nodes[0].samples > 0)
+    {
+        fprintf(fp, "%s %llu\n", root != NULL ? root : "[unknown]", (unsigned long long)(trie->nodes[0].samples * weight));
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef STACK_TRIE_H
+#define STACK_TRIE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "elf_symbols.h"
+
+/* nodes of one trie, 32 bytes each */
+#define MAX_STACK_NODES (1 << 18)
+
+/**********
+ * Name: stack_trie
+ * Description: call stacks merged by function, outermost caller at the
+ * root, so a stack seen a million times costs one counter and long runs use
+ * memory by the number of distinct call paths, not by samples. Children are
+ * found through a hash on parent and function, and a path is written by
+ * following the parent links up from its last node. Once MAX_STACK_NODES
+ * are used a new path is cut off at the deepest node it shares with the
+ * trie, and the sample is counted there, so the totals stay exact. The
+ * trie is written in the folded format of flame graph tools: one line per
+ * path, frames separated by ';' and the weight at the end.
+ * ********/
+
+struct stack_frame
+{
+    /* NULL when the address is in no known function */
+    const elf_symbol *symbol;
+    const char *module;
+};
+
+typedef struct stack_frame stack_frame;
+
+struct stack_node
+{
+    stack_frame frame;
+    uint32_t parent;
+    /* samples that ended in this function */
+    uint64_t samples;
+};
+
+typedef struct stack_node stack_node;
+
+struct stack_trie
+{
+    /* node 0 is the root, it has no frame */
+    stack_node *nodes;
+    uint32_t nr_nodes;
+    uint32_t capacity;
+    /* node indices by parent and frame, 0 marks a free slot */
+    uint32_t *index;
+    uint32_t index_capacity;
+    /* samples counted at a shorter path because the trie was full */
+    uint64_t nr_truncated;
+};
+
+typedef struct stack_trie stack_trie;
+
+int stack_trie_init(stack_trie *trie);
+
+/* frames from the outermost caller to the sampled function */
+void stack_trie_add(stack_trie *trie, const stack_frame *frames, unsigned int nr_frames);
+
+/* root, if not NULL, is prepended to every path; weights are samples times weight */
+void stack_trie_write_folded(const stack_trie *trie, const char *root, uint64_t weight, FILE *fp);
+
+void stack_trie_free(stack_trie *trie);
+
+/* name of the function, or of its module in brackets unless the module name already has them */
+void stack_frame_name(const stack_frame *frame, char *name, size_t size);
+
+#endif
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "counter_backend.h"
+
+/**********
+ * Name: synthetic_backend
+ * Description: deterministic counter source for machines without a PMU. Each
+ * read() covers a nominal SYNTHETIC_INTERVAL_NS; event n counts (n + 1) *
+ * SYNTHETIC_BASE_COUNT per interval, modulated by a slow triangle wave and a
+ * fixed pseudo random jitter, so statistics and metrics are non-trivial but
+ * every run produces exactly the same values whatever the timing.
+ * SYNTHETIC_NR_COUNTERS counters are simulated: more events fail in init()
+ * like on real hardware, and with multiplexing they share the counters, each
+ * counted nr_counters / nr_events of the time and scaled up.
+ * ********/
+
+#define SYNTHETIC_INTERVAL_NS 1000000ULL
+#define SYNTHETIC_BASE_COUNT 100000
+/* more than the default event set, which then runs without --multiplex */
+#define SYNTHETIC_NR_COUNTERS 8
+
+/* reads per period of the triangle wave */
+#define SYNTHETIC_WAVE_PERIOD 64
+
+struct synthetic_backend_priv
+{
+    unsigned int nr_events;
+    uint64_t nr_reads;
+    float coverage;
+};
+
+typedef struct synthetic_backend_priv synthetic_backend_priv;
+
+/* splitmix64, the same value for the same read and event in every run */
+static uint64_t synthetic_random(uint64_t read, unsigned int event)
+{
+    uint64_t z = read * 0x9e3779b97f4a7c15ULL + event + 1;
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static int synthetic_backend_init(counter_backend *backend, const PAPI_event *events, unsigned int nr_events)
+{
+    synthetic_backend_priv *priv = backend->priv;
+
+    (void)events;
+    if (nr_events > SYNTHETIC_NR_COUNTERS && !backend->multiplex)
+    {
+        printf("ERROR: the synthetic backend has %d counters, use --multiplex for %u events\n",
+               SYNTHETIC_NR_COUNTERS, nr_events);
+        return -1;
+    }
+    priv->nr_events = nr_events;
+    priv->coverage = nr_events > SYNTHETIC_NR_COUNTERS ? (float)SYNTHETIC_NR_COUNTERS / nr_events : 1.0f;
+    return 0;
+}
+
+static int synthetic_backend_init_from(counter_backend *backend, const counter_backend *template)
+{
+    synthetic_backend_priv *priv = backend->priv;
+    const synthetic_backend_priv *from = template->priv;
+
+    priv->nr_events = from->nr_events;
+    priv->coverage = from->coverage;
+    return 0;
+}
+
+static int synthetic_backend_attach(counter_backend *backend, pid_t pid)
+{
+    (void)backend;
+    (void)pid;
+    return 0;
+}
+
+static int synthetic_backend_start(counter_backend *backend)
+{
+    synthetic_backend_priv *priv = backend->priv;
+
+    priv->nr_reads = 0;
+    return 0;
+}
+
+static int synthetic_backend_read(counter_backend *backend, sample_record *record)
+{
+    synthetic_backend_priv *priv = backend->priv;
+    uint64_t phase = priv->nr_reads % SYNTHETIC_WAVE_PERIOD;
+    /* 0 .. 1 .. 0 over one period */
+    double wave = (phase < SYNTHETIC_WAVE_PERIOD / 2 ? phase : SYNTHETIC_WAVE_PERIOD - phase) * 2.0 / SYNTHETIC_WAVE_PERIOD;
+
+    record->interval_ns = SYNTHETIC_INTERVAL_NS;
+    record->time_enabled_ns = SYNTHETIC_INTERVAL_NS;
+    record->time_running_ns = (uint64_t)(SYNTHETIC_INTERVAL_NS * priv->coverage);
+    for (unsigned int e = 0; e < priv->nr_events; e++)
+    {
+        long long base = (long long)(e + 1) * SYNTHETIC_BASE_COUNT;
+        long long jitter = synthetic_random(priv->nr_reads, e) % (base / 16);
+
+        record->values[e] = (long long)(base * (0.5 + wave)) + jitter;
+        record->coverage[e] = priv->coverage;
+    }
+    priv->nr_reads++;
+    return 0;
+}
+
+static int synthetic_backend_stop(counter_backend *backend)
+{
+    (void)backend;
+    return 0;
+}
+
+static void synthetic_backend_destroy(counter_backend *backend)
+{
+    free(backend->priv);
+    free(backend);
+}
+
+counter_backend *synthetic_backend_create(void)
+{
+    counter_backend *backend = calloc(1, sizeof(counter_backend));
+    synthetic_backend_priv *priv = calloc(1, sizeof(synthetic_backend_priv));
+
+    if (backend == NULL || priv == NULL)
+    {
+        free(backend);
+        free(priv);
+        return NULL;
+    }
+
+    backend->name = "synthetic";
+    backend->own_interval = 1;
+    backend->init = synthetic_backend_init;
+    backend->init_from = synthetic_backend_init_from;
+    backend->attach = synthetic_backend_attach;
+    backend->start = synthetic_backend_start;
+    backend->read = synthetic_backend_read;
+    backend->stop = synthetic_backend_stop;
+    backend->detach = synthetic_backend_stop;
+    backend->destroy = synthetic_backend_destroy;
+    backend->priv = priv;
+    return backend;
+}
@@ -0,0 +1,851 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include "target.h"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+static target *target_list_append(target_list *list, enum target_kind kind)
+{
+    target *targets;
+
+    if (list->nr_targets >= MAX_TARGETS)
+    {
+        printf("ERROR: too many targets, at most %d are supported\n", MAX_TARGETS);
+        return NULL;
+    }
+    targets = realloc(list->targets, (list->nr_targets + 1) * sizeof(target));
+    if (targets == NULL)
+    {
+        perror("Could not grow target list");
+        return NULL;
+    }
+    list->targets = targets;
+    memset(&targets[list->nr_targets], 0, sizeof(target));
+    targets[list->nr_targets].kind = kind;
+    targets[list->nr_targets].pidfd = -1;
+    targets[list->nr_targets].gate_fd = -1;
+    targets[list->nr_targets].exec_error_fd = -1;
+    return &targets[list->nr_targets++];
+}
+
+int target_list_add_command(target_list *list, const char * const *argv, unsigned int argc)
+{
+    target *target;
+    size_t label_len = 1;
+
+    if (argc == 0)
+    {
+        printf("ERROR: empty command\n");
+        return -1;
+    }
+    if (argc >= MAX_TARGET_ARGS)
+    {
+        printf("ERROR: command %s has too many arguments, at most %d are supported\n", argv[0], MAX_TARGET_ARGS - 1);
+        return -1;
+    }
+    target = target_list_append(list, TARGET_COMMAND);
+    if (target == NULL)
+    {
+        return -1;
+    }
+
+    target->argv = calloc(argc + 1, sizeof(char *));
+    for (unsigned int i = 0; i < argc; i++)
+    {
+        label_len += strlen(argv[i]) + 1;
+    }
+    target->label = malloc(label_len);
+    if (target->argv == NULL || target->label == NULL)
+    {
+        perror("Could not allocate target");
+        return -1;
+    }
+    target->label[0] = '\0';
+    for (unsigned int i = 0; i < argc; i++)
+    {
+        target->argv[i] = strdup(argv[i]);
+        if (target->argv[i] == NULL)
+        {
+            perror("Could not allocate target");
+            return -1;
+        }
+        if (i > 0)
+        {
+            strcat(target->label, " ");
+        }
+        strcat(target->label, argv[i]);
+    }
+    return 0;
+}
+
+int target_list_add_command_line(target_list *list, const char *command_line)
+{
+    const char *argv[MAX_TARGET_ARGS];
+    unsigned int argc = 0;
+    char *copy = strdup(command_line);
+    char *save = NULL;
+    int ret;
+
+    if (copy == NULL)
+    {
+        perror("Could not parse command");
+        return -1;
+    }
+    for (char *arg = strtok_r(copy, " \t", &save); arg != NULL; arg = strtok_r(NULL, " \t", &save))
+    {
+        /* one slot stays free for the NULL of the argv handed to execve() */
+        if (argc == MAX_TARGET_ARGS - 1)
+        {
+            printf("ERROR: command %s has too many arguments, at most %d are supported\n", argv[0], MAX_TARGET_ARGS - 1);
+            free(copy);
+            return -1;
+        }
+        argv[argc++] = arg;
+    }
+    ret = target_list_add_command(list, argv, argc);
+    free(copy);
+    return ret;
+}
+
+int target_list_add_pid(target_list *list, pid_t pid)
+{
+    target *target;
+    char label[32];
+
+    if (pid <= 0)
+    {
+        printf("ERROR: invalid pid %d\n", pid);
+        return -1;
+    }
+    for (unsigned int i = 0; i < list->nr_targets; i++)
+    {
+        if (list->targets[i].kind == TARGET_PID && list->targets[i].pid == pid)
+        {
+            printf("ERROR: pid %d is listed twice\n", pid);
+            return -1;
+        }
+    }
+    target = target_list_append(list, TARGET_PID);
+    if (target == NULL)
+    {
+        return -1;
+    }
+    target->pid = pid;
+    snprintf(label, sizeof(label), "pid %d", pid);
+    target->label = strdup(label);
+    if (target->label == NULL)
+    {
+        perror("Could not allocate target");
+        return -1;
+    }
+    return 0;
+}
+
+/* runs in the forked child; the monitor may already have threads, so only async-signal-safe calls until exec() */
+static void spawn_child(const target *target, int gate_fd, int exec_error_fd, const sigset_t *sigmask)
+{
+    char gate;
+    int error;
+    ssize_t ret;
+
+    while ((ret = read(gate_fd, &gate, 1)) < 0 && errno == EINTR)
+    {
+    }
+    /* end of file, the monitor exited without releasing us */
+    if (ret != 1)
+    {
+        _exit(127);
+    }
+    sigprocmask(SIG_SETMASK, sigmask, NULL);
+    execve(target->argv[0], target->argv, target->envp != NULL ? target->envp : environ);
+
+    error = errno;
+    write(exec_error_fd, &error, sizeof(error));
+    _exit(127);
+}
+
+/* the monitor's environment with library in front of LD_PRELOAD, NULL terminated */
+static char **preload_environment(const char *library)
+{
+    const char *preload = getenv("LD_PRELOAD");
+    size_t nr_variables = 0;
+    size_t n = 0;
+    char **envp;
+
+    while (environ[nr_variables] != NULL)
+    {
+        nr_variables++;
+    }
+    envp = calloc(nr_variables + 2, sizeof(char *));
+    if (envp == NULL)
+    {
+        return NULL;
+    }
+    for (size_t i = 0; i < nr_variables; i++)
+    {
+        if (strncmp(environ[i], "LD_PRELOAD=", strlen("LD_PRELOAD=")) != 0 && (envp[n] = strdup(environ[i])) != NULL)
+        {
+            n++;
+        }
+    }
+    envp[n] = malloc(strlen("LD_PRELOAD=") + strlen(library) + (preload != NULL ? strlen(preload) + 1 : 0) + 1);
+    if (envp[n] != NULL)
+    {
+        sprintf(envp[n], "LD_PRELOAD=%s%s%s", library, preload != NULL ? ":" : "", preload != NULL ? preload : "");
+    }
+    return envp;
+}
+
+int target_spawn(target *target)
+{
+    int gate[2];
+    int exec_error[2];
+    sigset_t all_signals;
+    sigset_t sigmask;
+
+    if (target->kind != TARGET_COMMAND)
+    {
+        return 0;
+    }
+
+    if (target->backend->preload != NULL && (target->envp = preload_environment(target->backend->preload)) == NULL)
+    {
+        perror("Could not prepare the environment of the child process");
+        return -1;
+    }
+    if (pipe2(gate, O_CLOEXEC) != 0)
+    {
+        perror("Could not prepare the child process");
+        return -1;
+    }
+    if (pipe2(exec_error, O_CLOEXEC) != 0)
+    {
+        perror("Could not prepare the child process");
+        close(gate[0]);
+        close(gate[1]);
+        return -1;
+    }
+
+    /* no handler of the monitor may run in the child before exec() */
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &sigmask);
+    target->pid = fork();
+    if (target->pid == 0)
+    {
+        /* only the monitor may hold the write end, so the gate reads end of file if it goes away */
+        close(gate[1]);
+        close(exec_error[0]);
+        spawn_child(target, gate[0], exec_error[1], &sigmask);
+    }
+    pthread_sigmask(SIG_SETMASK, &sigmask, NULL);
+
+    close(gate[0]);
+    close(exec_error[1]);
+    target->gate_fd = gate[1];
+    target->exec_error_fd = exec_error[0];
+    if (target->pid < 0)
+    {
+        perror("Could not start the child process");
+        return -1;
+    }
+    printf("Started provided executable process with pid: %d\n", target->pid);
+    return 0;
+}
+
+int target_release(target *target)
+{
+    char gate = 1;
+    int error;
+    ssize_t ret;
+
+    if (target->kind != TARGET_COMMAND || target->gate_fd < 0)
+    {
+        return 0;
+    }
+
+    target->start_ns = monotonic_ns();
+    if (write(target->gate_fd, &gate, 1) != 1)
+    {
+        perror("Could not release the child process");
+        return -1;
+    }
+    close(target->gate_fd);
+    target->gate_fd = -1;
+
+    /* end of file means exec() succeeded and closed the pipe */
+    while ((ret = read(target->exec_error_fd, &error, sizeof(error))) < 0 && errno == EINTR)
+    {
+    }
+    close(target->exec_error_fd);
+    target->exec_error_fd = -1;
+    if (ret == sizeof(error))
+    {
+        printf("ERROR: could not execute %s: %s\n", target->argv[0], strerror(error));
+        return -1;
+    }
+    return 0;
+}
+
+static counter_backend *create_backend(const char *backend_name, int multiplex, int enable_on_exec,
+                                       const PAPI_event *events, unsigned int nr_events)
+{
+    counter_backend *backend = counter_backend_create(backend_name);
+
+    if (backend == NULL)
+    {
+        printf("Error: unknown counter backend %s\n", backend_name);
+        return NULL;
+    }
+    backend->multiplex = multiplex;
+    backend->enable_on_exec = enable_on_exec;
+    if (backend->init(backend, events, nr_events) != 0)
+    {
+        backend->destroy(backend);
+        return NULL;
+    }
+    return backend;
+}
+
+int target_init(target *target, const char *backend_name, int multiplex, const PAPI_event *events, unsigned int nr_events)
+{
+    target->events = events;
+    target->nr_events = nr_events;
+    target->backend = create_backend(backend_name, multiplex, target->kind == TARGET_COMMAND, events, nr_events);
+    return target->backend != NULL ? 0 : -1;
+}
+
+/* a backend for one thread from the checked template of the target, quiet enough for a sampler */
+static counter_backend *create_thread_backend(const target *target, int single_thread, int enable_on_exec)
+{
+    counter_backend *backend = counter_backend_create(target->backend->name);
+
+    if (backend == NULL)
+    {
+        return NULL;
+    }
+    backend->multiplex = target->backend->multiplex;
+    backend->single_thread = single_thread;
+    backend->enable_on_exec = enable_on_exec;
+    if (backend->init_from(backend, target->backend) != 0)
+    {
+        backend->destroy(backend);
+        return NULL;
+    }
+    return backend;
+}
+
+/* every thread has its own event set, the process event set is only a template */
+static int target_threaded(const target *target)
+{
+    return target->per_thread || (target->kind == TARGET_PID && target->all_threads);
+}
+
+/* threads are kept sorted by tid, returns the index of tid or where it belongs */
+static unsigned int find_thread(const target *target, pid_t tid)
+{
+    unsigned int low = 0;
+    unsigned int high = target->nr_threads;
+
+    while (low < high)
+    {
+        unsigned int middle = (low + high) / 2;
+
+        if (target->threads[middle].totals.tid < tid)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/* an inherited event set on tid for the process record of a per_thread target, 0 if tid is gone */
+static int add_process_backend(target *target, pid_t tid)
+{
+    counter_backend **backends;
+    counter_backend *backend;
+
+    backends = realloc(target->process_backends, (target->nr_process_backends + 1) * sizeof(counter_backend *));
+    if (backends == NULL)
+    {
+        perror("Could not grow the process event sets");
+        return -1;
+    }
+    target->process_backends = backends;
+    backend = create_thread_backend(target, 0, target->backend->enable_on_exec);
+    if (backend == NULL)
+    {
+        return -1;
+    }
+    if (backend->attach(backend, tid) != 0)
+    {
+        backend->destroy(backend);
+        return 0;
+    }
+    target->process_backends[target->nr_process_backends++] = backend;
+    return 0;
+}
+
+static int add_thread(target *target, pid_t tid, int start)
+{
+    unsigned int index = find_thread(target, tid);
+    target_thread *threads;
+    target_thread *thread;
+    counter_backend *backend;
+
+    if (index < target->nr_threads && target->threads[index].totals.tid == tid)
+    {
+        target->threads[index].seen_pass = target->scan_pass;
+        return 0;
+    }
+    if (target->nr_threads == target->threads_capacity)
+    {
+        unsigned int capacity = target->threads_capacity ? target->threads_capacity * 2 : 16;
+
+        threads = realloc(target->threads, capacity * sizeof(target_thread));
+        if (threads == NULL)
+        {
+            perror("Could not grow thread list");
+            return -1;
+        }
+        target->threads = threads;
+        target->threads_capacity = capacity;
+    }
+    /* the threads there at the attach carry the process record, see target_read() */
+    if (target->per_thread && !start && add_process_backend(target, tid) != 0)
+    {
+        return -1;
+    }
+    /* a thread only counts itself in per-thread mode, otherwise it also covers the threads it creates */
+    /* threads found after the start are already past exec() */
+    backend = create_thread_backend(target, target->per_thread, target->backend->enable_on_exec && !start);
+    if (backend == NULL)
+    {
+        return -1;
+    }
+    if (backend->attach(backend, tid) != 0 || (start && backend->start(backend) != 0))
+    {
+        /* the thread exited between the listing and the attach */
+        backend->destroy(backend);
+        return 0;
+    }
+
+    memmove(&target->threads[index + 1], &target->threads[index], (target->nr_threads - index) * sizeof(target_thread));
+    thread = &target->threads[index];
+    memset(thread, 0, sizeof(target_thread));
+    thread->totals.tid = tid;
+    thread->backend = backend;
+    thread->seen_pass = target->scan_pass;
+    target->nr_threads++;
+    return 0;
+}
+
+/* keeps the totals of a thread that is gone for the final breakdown */
+static void retire_thread(target *target, unsigned int index)
+{
+    target_thread *thread = &target->threads[index];
+    thread_totals *retired;
+
+    thread->backend->destroy(thread->backend);
+    retired = realloc(target->retired, (target->nr_retired + 1) * sizeof(thread_totals));
+    if (retired != NULL)
+    {
+        target->retired = retired;
+        target->retired[target->nr_retired++] = thread->totals;
+    }
+    memmove(thread, thread + 1, (target->nr_threads - index - 1) * sizeof(target_thread));
+    target->nr_threads--;
+}
+
+static int open_task_dir(target *target)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "/proc/%d/task", target->pid);
+    target->task_dir = opendir(path);
+    if (target->task_dir == NULL)
+    {
+        perror("Could not list the threads of the process");
+        return -1;
+    }
+    return 0;
+}
+
+/* reads at most budget entries of /proc/<pid>/task, returns 1 when the listing is complete */
+static int scan_threads(target *target, unsigned int budget, int start)
+{
+    struct dirent *entry;
+
+    for (unsigned int i = 0; i < budget || budget == 0; i++)
+    {
+        entry = readdir(target->task_dir);
+        if (entry == NULL)
+        {
+            return 1;
+        }
+        pid_t tid = atoi(entry->d_name);
+        if (tid > 0 && add_thread(target, tid, start) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int target_attach(target *target)
+{
+    /* a spawned command is not reaped before the monitor is done, an attached process may already be gone */
+    target->pidfd = syscall(SYS_pidfd_open, target->pid, 0);
+    if (target->pidfd < 0 && errno != ENOSYS)
+    {
+        printf("ERROR: could not open pid %d: %s\n", target->pid, strerror(errno));
+        return -1;
+    }
+    if (target->profiler != NULL && ip_profiler_attach(target->profiler, target->pid, target->kind == TARGET_COMMAND) != 0)
+    {
+        return -1;
+    }
+    if (target->regions && region_page_create(&target->region_page, target->pid) != 0)
+    {
+        return -1;
+    }
+    if (target->regulator != NULL && regulator_attach(target->regulator, target->pid, target->pidfd) != 0)
+    {
+        return -1;
+    }
+    if (target_threaded(target))
+    {
+        if (target->backend->init_from == NULL)
+        {
+            printf("ERROR: the %s backend cannot count the threads one by one\n", target->backend->name);
+            return -1;
+        }
+        if (open_task_dir(target) != 0 || scan_threads(target, 0, 0) < 0)
+        {
+            return -1;
+        }
+        if (target->nr_threads == 0)
+        {
+            printf("ERROR: could not attach to any thread of pid %d\n", target->pid);
+            return -1;
+        }
+        rewinddir(target->task_dir);
+        target->scan_pass++;
+        printf("Attached to %u threads of pid %d\n", target->nr_threads, target->pid);
+        return 0;
+    }
+    if (target->backend->attach(target->backend, target->pid) != 0)
+    {
+        if (target->kind == TARGET_PID)
+        {
+            printf("Attaching to a running process needs ptrace permission on it and a low enough /proc/sys/kernel/perf_event_paranoid\n");
+        }
+        return -1;
+    }
+    return 0;
+}
+
+int target_start(target *target)
+{
+    if (target->profiler != NULL && ip_profiler_start(target->profiler) != 0)
+    {
+        return -1;
+    }
+    if (!target_threaded(target))
+    {
+        return target->backend->start(target->backend);
+    }
+    for (unsigned int i = 0; i < target->nr_process_backends; i++)
+    {
+        if (target->process_backends[i]->start(target->process_backends[i]) != 0)
+        {
+            return -1;
+        }
+    }
+    for (unsigned int i = 0; i < target->nr_threads; i++)
+    {
+        if (target->threads[i].backend->start(target->threads[i].backend) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void target_read_region(target *target, sample_record *record)
+{
+    uint32_t transitions;
+
+    if (target->region_page.page == NULL)
+    {
+        record->region = 0;
+        record->region_changed = 0;
+        return;
+    }
+    record->region = region_page_read(&target->region_page, &transitions);
+    record->region_changed = transitions != target->region_transitions;
+    target->region_transitions = transitions;
+}
+
+static void add_to_rollup(sample_record *record, const sample_record *thread_record, double *coverage_sums, unsigned int nr_events)
+{
+    for (size_t j = 0; j < nr_events; j++)
+    {
+        record->values[j] += thread_record->values[j];
+        coverage_sums[j] += (double)thread_record->coverage[j] * thread_record->time_enabled_ns;
+    }
+    record->time_enabled_ns += thread_record->time_enabled_ns;
+    record->time_running_ns += thread_record->time_running_ns;
+}
+
+/* reads a thread into its own record and adds it to the totals and the rollup, if there is one;
+   -1 if the thread is gone */
+static int read_thread(target *target, target_thread *thread, sample_record *rollup, double *coverage_sums)
+{
+    if (thread->backend->read(thread->backend, &thread->record) != 0)
+    {
+        return -1;
+    }
+    for (size_t j = 0; j < target->nr_events; j++)
+    {
+        thread->totals.values[j] += thread->record.values[j];
+    }
+    if (rollup != NULL)
+    {
+        add_to_rollup(rollup, &thread->record, coverage_sums, target->nr_events);
+    }
+    return 0;
+}
+
+/* the process record of a per_thread target from its inherited event sets */
+static void read_process(target *target, sample_record *record, double *coverage_sums)
+{
+    sample_record process_record;
+
+    for (unsigned int i = 0; i < target->nr_process_backends; i++)
+    {
+        counter_backend *backend = target->process_backends[i];
+
+        if (backend->read(backend, &process_record) != 0)
+        {
+            /* the kernel could not keep the set of a thread that is gone */
+            backend->destroy(backend);
+            target->process_backends[i--] = target->process_backends[--target->nr_process_backends];
+            continue;
+        }
+        add_to_rollup(record, &process_record, coverage_sums, target->nr_events);
+    }
+}
+
+int target_read(target *target, sample_record *record)
+{
+    double coverage_sums[MAX_COUNTERS];
+    sample_record *rollup = target->per_thread ? NULL : record;
+
+    if (!target_threaded(target))
+    {
+        return target->backend->read(target->backend, record);
+    }
+
+    record->time_enabled_ns = 0;
+    record->time_running_ns = 0;
+    for (size_t j = 0; j < target->nr_events; j++)
+    {
+        record->values[j] = 0;
+        coverage_sums[j] = 0.0;
+    }
+
+    /* new threads get counters, threads missing from a complete listing take a final read and retire */
+    if (target->per_thread)
+    {
+        int complete = scan_threads(target, TARGET_SCAN_BUDGET, 1);
+
+        if (complete < 0)
+        {
+            return -1;
+        }
+        if (complete)
+        {
+            for (unsigned int i = 0; i < target->nr_threads; i++)
+            {
+                if (target->threads[i].seen_pass != target->scan_pass)
+                {
+                    read_thread(target, &target->threads[i], rollup, coverage_sums);
+                    retire_thread(target, i--);
+                }
+            }
+            rewinddir(target->task_dir);
+            target->scan_pass++;
+        }
+    }
+
+    /* coverage of the sum is the enabled-time weighted coverage of the event sets in it */
+    read_process(target, record, coverage_sums);
+    for (unsigned int i = 0; i < target->nr_threads; i++)
+    {
+        if (read_thread(target, &target->threads[i], rollup, coverage_sums) != 0)
+        {
+            /* the thread is gone and its event set with it */
+            retire_thread(target, i--);
+        }
+    }
+    for (size_t j = 0; j < target->nr_events; j++)
+    {
+        record->coverage[j] = record->time_enabled_ns > 0 ? coverage_sums[j] / record->time_enabled_ns : 1.0f;
+    }
+    return 0;
+}
+
+int target_read_requests(target *target, counter_read *reads)
+{
+    if (target_threaded(target) || target->backend->read_requests == NULL)
+    {
+        return 0;
+    }
+    return target->backend->read_requests(target->backend, reads);
+}
+
+int target_read_complete(target *target, sample_record *record)
+{
+    return target->backend->read_complete(target->backend, record);
+}
+
+void target_stop(target *target)
+{
+    if (!target_threaded(target))
+    {
+        target->backend->stop(target->backend);
+    }
+    for (unsigned int i = 0; i < target->nr_process_backends; i++)
+    {
+        target->process_backends[i]->stop(target->process_backends[i]);
+    }
+    for (unsigned int i = 0; i < target->nr_threads; i++)
+    {
+        target->threads[i].backend->stop(target->threads[i].backend);
+    }
+    /* what is left in the buffers is drained once the writer has finished */
+    if (target->profiler != NULL)
+    {
+        ip_profiler_stop(target->profiler);
+    }
+    /* an exited target's pid may already belong to another process */
+    if (target->regulator != NULL && target->exit.pid == 0)
+    {
+        regulator_release(target->regulator);
+    }
+}
+
+void target_detach(target *target)
+{
+    if (!target_threaded(target))
+    {
+        target->backend->detach(target->backend);
+    }
+    for (unsigned int i = 0; i < target->nr_process_backends; i++)
+    {
+        target->process_backends[i]->detach(target->process_backends[i]);
+    }
+    for (unsigned int i = 0; i < target->nr_threads; i++)
+    {
+        target->threads[i].backend->detach(target->threads[i].backend);
+    }
+}
+
+unsigned int target_list_alive(const target_list *list)
+{
+    unsigned int alive = 0;
+
+    for (unsigned int i = 0; i < list->nr_targets; i++)
+    {
+        if (!list->targets[i].exited)
+        {
+            alive++;
+        }
+    }
+    return alive;
+}
+
+target *target_list_find(target_list *list, pid_t pid)
+{
+    for (unsigned int i = 0; i < list->nr_targets; i++)
+    {
+        if (list->targets[i].pid == pid)
+        {
+            return &list->targets[i];
+        }
+    }
+    return NULL;
+}
+
+void target_list_free(target_list *list)
+{
+    for (unsigned int i = 0; i < list->nr_targets; i++)
+    {
+        target *target = &list->targets[i];
+
+        if (target->backend != NULL)
+        {
+            target->backend->destroy(target->backend);
+        }
+        for (unsigned int j = 0; j < target->nr_threads; j++)
+        {
+            target->threads[j].backend->destroy(target->threads[j].backend);
+        }
+        for (unsigned int j = 0; j < target->nr_process_backends; j++)
+        {
+            target->process_backends[j]->destroy(target->process_backends[j]);
+        }
+        free(target->process_backends);
+        ip_profiler_destroy(target->profiler);
+        region_page_destroy(&target->region_page);
+        regulator_destroy(target->regulator, target->kind == TARGET_PID);
+        free(target->threads);
+        free(target->retired);
+        if (target->task_dir != NULL)
+        {
+            closedir(target->task_dir);
+        }
+        for (size_t j = 0; target->argv != NULL && target->argv[j] != NULL; j++)
+        {
+            free(target->argv[j]);
+        }
+        free(target->argv);
+        for (size_t j = 0; target->envp != NULL && target->envp[j] != NULL; j++)
+        {
+            free(target->envp[j]);
+        }
+        free(target->envp);
+        free(target->label);
+        if (target->gate_fd >= 0)
+        {
+            close(target->gate_fd);
+        }
+        if (target->exec_error_fd >= 0)
+        {
+            close(target->exec_error_fd);
+        }
+        if (target->pidfd >= 0)
+        {
+            close(target->pidfd);
+        }
+    }
+    free(list->targets);
+    list->targets = NULL;
+    list->nr_targets = 0;
+}
@@ -0,0 +1,201 @@
+#ifndef TARGET_H
+#define TARGET_H
+
+#include <stdint.h>
+#include <dirent.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include "counter_backend.h"
+#include "ip_profiler.h"
+#include "region_page.h"
+#include "regulator.h"
+#include "scheduler.h"
+
+#define MAX_TARGETS 1024
+#define MAX_TARGET_ARGS 64
+
+/* /proc/<pid>/task entries looked at per tick in per-thread mode */
+#define TARGET_SCAN_BUDGET 64
+
+enum target_kind
+{
+    /* started by the monitor with fork() and execve() */
+    TARGET_COMMAND,
+    /* already running process, only attached to */
+    TARGET_PID
+};
+
+/**********
+ * Name: target
+ * Description: one monitored process with its own counter backend and event set.
+ * All targets are read on the same tick grid by the shards of the sampler
+ * pool, every record carries the index of its target. Functions return 0 on success and -1
+ * after printing the reason.
+ * Counters follow the threads a process creates after the attach. With
+ * all_threads the threads that already exist when attaching to a running
+ * process get an event set each, and their counts are summed into the target.
+ * per_thread counts every thread on its own: /proc/<pid>/task is listed
+ * incrementally, TARGET_SCAN_BUDGET entries per read, so new threads get
+ * counters and threads missing from a complete listing are retired. A
+ * thread's counts before it is listed are not in its own series, and a
+ * thread that ends before it is listed has none. The target record does not
+ * depend on the listing: it is the sum of inherited event sets opened on the
+ * threads there at the attach, which follow every thread created later, so
+ * it matches the count without --per-thread. Each thread's deltas are left
+ * in its record for the per-thread series. A thread then carries two event
+ * sets; when they do not fit the PMU together the kernel time-shares them,
+ * which shows in the coverage. The event set checked
+ * by target_init() is the template of the threads' backends, which the
+ * samplers create with init_from() without printing or checking again.
+ * Commands are spawned held on a gate pipe in front of exec(). The counters
+ * are attached and armed while the child waits, target_release() then lets
+ * it exec so counting starts with the first instruction of the payload.
+ * A library the backend needs in the command (see counter_backend.preload)
+ * is put in front of LD_PRELOAD in the environment it execs with.
+ * A target with a profiler is also sampled by instruction pointer, the
+ * profiler is attached, started and stopped together with the counters.
+ * With regions the process gets a pm_region page at the attach, and every
+ * read stamps the records with the region the process is in.
+ * A regulated target is taken over by its regulator at the attach, before a
+ * spawned command execs, and let go at target_stop().
+ * ********/
+
+struct thread_totals
+{
+    pid_t tid;
+    long long values[MAX_COUNTERS];
+};
+
+typedef struct thread_totals thread_totals;
+
+struct target_thread
+{
+    /* tid and the counts of the whole run */
+    thread_totals totals;
+    counter_backend *backend;
+    /* listing pass in which the thread was last seen */
+    uint32_t seen_pass;
+    /* deltas of the latest read */
+    sample_record record;
+};
+
+typedef struct target_thread target_thread;
+
+struct target
+{
+    enum target_kind kind;
+    pid_t pid;
+    /* refers to the process even once its pid is reused, opened at the attach; -1 before 5.3 kernels */
+    int pidfd;
+    /* command line or pid, used in the console output */
+    char *label;
+    /* NULL terminated, only for TARGET_COMMAND */
+    char **argv;
+    /* environment of the command when the backend preloads a library, otherwise NULL for the monitor's */
+    char **envp;
+    counter_backend *backend;
+    /* also attach to the threads the process already has */
+    int all_threads;
+    /* separate counts for every thread */
+    int per_thread;
+    /* per_thread: inherited event sets on the threads there at the attach, which also
+       follow the threads created later; their sum is the record of the process */
+    counter_backend **process_backends;
+    unsigned int nr_process_backends;
+    /* sorted by tid */
+    target_thread *threads;
+    unsigned int nr_threads;
+    unsigned int threads_capacity;
+    thread_totals *retired;
+    unsigned int nr_retired;
+    DIR *task_dir;
+    uint32_t scan_pass;
+    const PAPI_event *events;
+    unsigned int nr_events;
+    /* exec() time of spawned commands */
+    uint64_t start_ns;
+    /* write end of the gate the spawned child waits on, -1 once released */
+    int gate_fd;
+    /* receives the errno of a failed exec(), closed by a successful one */
+    int exec_error_fd;
+    /* time of the previous read, start of the next interval */
+    uint64_t previous_ns;
+    atomic_int exited;
+    child_exit exit;
+
+    /* sampler shard reading the target and the shard it should move to, see sampler_pool */
+    atomic_int owner;
+    atomic_int assigned;
+    /* exit is filled in, the owner takes the final read */
+    atomic_int exit_pending;
+    /* moving average of the time one read takes */
+    atomic_ullong read_cost_ns;
+    /* overflow sampling of instruction pointers, NULL when not profiling */
+    ip_profiler *profiler;
+    /* create a pm_region page for the process at the attach */
+    int regions;
+    region_page region_page;
+    /* marker calls seen at the previous read */
+    uint32_t region_transitions;
+    /* throttles the process over its budget, NULL when not regulating */
+    regulator *regulator;
+};
+
+typedef struct target target;
+
+struct target_list
+{
+    target *targets;
+    unsigned int nr_targets;
+};
+
+typedef struct target_list target_list;
+
+/* executable followed by its arguments */
+int target_list_add_command(target_list *list, const char * const *argv, unsigned int argc);
+
+/* space separated command line, e.g. "/bin/worker --threads 4" */
+int target_list_add_command_line(target_list *list, const char *command_line);
+
+int target_list_add_pid(target_list *list, pid_t pid);
+
+/* creates the counter backend and checks the events, before the process is spawned */
+int target_init(target *target, const char *backend_name, int multiplex, const PAPI_event *events, unsigned int nr_events);
+
+/* starts a TARGET_COMMAND held in front of exec(), does nothing for TARGET_PID */
+int target_spawn(target *target);
+
+/* lets a spawned command exec() and waits until it has, does nothing for TARGET_PID */
+int target_release(target *target);
+
+int target_attach(target *target);
+int target_start(target *target);
+
+/* region of the process for a record read now, see sample_record */
+void target_read_region(target *target, sample_record *record);
+
+/* reads the deltas of the process, summed over its threads */
+int target_read(target *target, sample_record *record);
+
+/* lists the reads for a batched read of a single event set, returns 0 when the target
+   has several or its backend cannot split reads, target_read() is then used */
+int target_read_requests(target *target, counter_read *reads);
+
+/* target_read() after the reads listed by target_read_requests() are done */
+int target_read_complete(target *target, sample_record *record);
+
+void target_stop(target *target);
+
+/* releases the counters and leaves the process running untouched */
+void target_detach(target *target);
+
+/* number of targets that have not exited yet */
+unsigned int target_list_alive(const target_list *list);
+
+/* returns NULL if pid is not one of the targets */
+target *target_list_find(target_list *list, pid_t pid);
+
+/* destroys the backends and frees the list */
+void target_list_free(target_list *list);
+
+#endif
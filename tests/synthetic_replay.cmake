@@ -0,0 +1,57 @@
+# Smoke test that needs no PMU: records the synthetic backend to .csv and to
+# .pmcol, replays both recordings and checks that the replayed counter deltas
+# are the recorded ones. Run by ctest, see CMakeLists.txt.
+#   cmake -DPROCESS_MONITOR=<binary> -DWORK_DIR=<dir> -P synthetic_replay.cmake
+
+set(EVENTS PAPI_TOT_INS,PAPI_L2_TCM,PAPI_L2_DCA,PAPI_L3_TCA,PAPI_L3_TCM)
+set(SAMPLES 20)
+
+# runs the monitor in dir on a command that outlives the samples, returns the output file
+function(run_monitor dir pattern result)
+  file(REMOVE_RECURSE ${dir})
+  file(MAKE_DIRECTORY ${dir})
+  execute_process(COMMAND ${PROCESS_MONITOR} ${ARGN} ${SAMPLES} 1 0 /bin/sleep 10
+                  WORKING_DIRECTORY ${dir}
+                  RESULT_VARIABLE code
+                  OUTPUT_VARIABLE output
+                  ERROR_VARIABLE output)
+  file(GLOB files ${dir}/${pattern})
+  list(LENGTH files nr_files)
+  if(NOT code EQUAL 0 OR NOT nr_files EQUAL 1)
+    message(FATAL_ERROR "process_monitor ${ARGN} exited with ${code} and wrote ${nr_files} ${pattern}:\n${output}")
+  endif()
+  set(${result} ${files} PARENT_SCOPE)
+endfunction()
+
+# counter columns of a .csv output, without the timestamps and times that depend on the run
+function(csv_counters file result)
+  file(STRINGS ${file} lines)
+  set(counters "")
+  foreach(line ${lines})
+    string(REGEX REPLACE "^[^,]*,[^,]*,[^,]*,[^,]*," "" line "${line}")
+    list(APPEND counters "${line}")
+  endforeach()
+  list(LENGTH counters nr_lines)
+  math(EXPR expected "${SAMPLES} + 1")
+  if(NOT nr_lines EQUAL expected)
+    message(FATAL_ERROR "${file} has ${nr_lines} lines, expected a header and ${SAMPLES} samples")
+  endif()
+  set(${result} "${counters}" PARENT_SCOPE)
+endfunction()
+
+run_monitor(${WORK_DIR}/csv "*output.csv" recorded_csv -b synthetic)
+csv_counters(${recorded_csv} recorded)
+
+run_monitor(${WORK_DIR}/csv_replay "*output.csv" replayed_csv -b replay:${recorded_csv} -e ${EVENTS})
+csv_counters(${replayed_csv} replayed)
+if(NOT recorded STREQUAL replayed)
+  message(FATAL_ERROR "replaying ${recorded_csv} gave other counts in ${replayed_csv}")
+endif()
+
+# the synthetic counts are the same in every run, so the binary recording must replay to them as well
+run_monitor(${WORK_DIR}/pmcol "*output.pmcol" recorded_pmcol -b synthetic --format binary)
+run_monitor(${WORK_DIR}/pmcol_replay "*output.csv" replayed_csv -b replay:${recorded_pmcol} -e ${EVENTS})
+csv_counters(${replayed_csv} replayed)
+if(NOT recorded STREQUAL replayed)
+  message(FATAL_ERROR "replaying ${recorded_pmcol} gave other counts in ${replayed_csv} than ${recorded_csv}")
+endif()
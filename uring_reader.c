@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "uring_reader.h"
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/* the ring indices are shared with the kernel */
+static unsigned int load_acquire(unsigned int *index)
+{
+    return atomic_load_explicit((_Atomic unsigned int *)index, memory_order_acquire);
+}
+
+static void store_release(unsigned int *index, unsigned int value)
+{
+    atomic_store_explicit((_Atomic unsigned int *)index, value, memory_order_release);
+}
+
+int uring_reader_init(uring_reader *reader, unsigned int entries, uring_read_complete complete, void *context)
+{
+    struct io_uring_params params;
+
+    memset(reader, 0, sizeof(uring_reader));
+    memset(&params, 0, sizeof(params));
+    reader->complete = complete;
+    reader->context = context;
+    reader->sq_ring = MAP_FAILED;
+    reader->cq_ring = MAP_FAILED;
+    reader->sqes = MAP_FAILED;
+
+    if (entries > URING_READER_MAX_ENTRIES)
+    {
+        entries = URING_READER_MAX_ENTRIES;
+    }
+    reader->ring_fd = sys_io_uring_setup(entries > 0 ? entries : 1, &params);
+    if (reader->ring_fd < 0)
+    {
+        printf("Warning: io_uring is not available: %s\n", strerror(errno));
+        return -1;
+    }
+    reader->entries = params.sq_entries;
+
+    reader->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    reader->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        /* both rings live in one mapping */
+        if (reader->cq_ring_size > reader->sq_ring_size)
+        {
+            reader->sq_ring_size = reader->cq_ring_size;
+        }
+        reader->cq_ring_size = 0;
+    }
+    reader->sq_ring = mmap(NULL, reader->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           reader->ring_fd, IORING_OFF_SQ_RING);
+    if (reader->sq_ring == MAP_FAILED)
+    {
+        perror("Could not map the io_uring submission ring");
+        uring_reader_destroy(reader);
+        return -1;
+    }
+    if (reader->cq_ring_size == 0)
+    {
+        reader->cq_ring = reader->sq_ring;
+    }
+    else
+    {
+        reader->cq_ring = mmap(NULL, reader->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                               reader->ring_fd, IORING_OFF_CQ_RING);
+        if (reader->cq_ring == MAP_FAILED)
+        {
+            perror("Could not map the io_uring completion ring");
+            uring_reader_destroy(reader);
+            return -1;
+        }
+    }
+    reader->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    reader->sqes = mmap(NULL, reader->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        reader->ring_fd, IORING_OFF_SQES);
+    if (reader->sqes == MAP_FAILED)
+    {
+        perror("Could not map the io_uring submission entries");
+        uring_reader_destroy(reader);
+        return -1;
+    }
+
+    reader->sq_head = (unsigned int *)((char *)reader->sq_ring + params.sq_off.head);
+    reader->sq_tail = (unsigned int *)((char *)reader->sq_ring + params.sq_off.tail);
+    reader->sq_mask = (unsigned int *)((char *)reader->sq_ring + params.sq_off.ring_mask);
+    reader->sq_array = (unsigned int *)((char *)reader->sq_ring + params.sq_off.array);
+    reader->cq_head = (unsigned int *)((char *)reader->cq_ring + params.cq_off.head);
+    reader->cq_tail = (unsigned int *)((char *)reader->cq_ring + params.cq_off.tail);
+    reader->cq_mask = (unsigned int *)((char *)reader->cq_ring + params.cq_off.ring_mask);
+    reader->cqes = (struct io_uring_cqe *)((char *)reader->cq_ring + params.cq_off.cqes);
+
+    /* the submission array maps slot n to entry n for good, only the tail moves */
+    for (unsigned int i = 0; i < params.sq_entries; i++)
+    {
+        reader->sq_array[i] = i;
+    }
+    return 0;
+}
+
+int uring_reader_queue(uring_reader *reader, int fd, void *buffer, size_t size, uint64_t user_data)
+{
+    unsigned int tail;
+    struct io_uring_sqe *sqe;
+
+    if (reader->nr_queued == reader->entries && uring_reader_submit(reader) != 0)
+    {
+        return -1;
+    }
+    tail = *reader->sq_tail;
+    sqe = &reader->sqes[tail & *reader->sq_mask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    sqe->len = size;
+    /* the current position, counter fds are not seekable */
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = user_data;
+    store_release(reader->sq_tail, tail + 1);
+    reader->nr_queued++;
+    return 0;
+}
+
+/* hands the available completions to the callback, returns how many there were */
+static unsigned int reap_completions(uring_reader *reader)
+{
+    unsigned int head = *reader->cq_head;
+    unsigned int tail = load_acquire(reader->cq_tail);
+    unsigned int nr_reaped = tail - head;
+
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe *cqe = &reader->cqes[head & *reader->cq_mask];
+
+        reader->complete(reader->context, cqe->user_data, cqe->res);
+    }
+    store_release(reader->cq_head, head);
+    return nr_reaped;
+}
+
+int uring_reader_submit(uring_reader *reader)
+{
+    unsigned int to_submit = reader->nr_queued;
+    unsigned int pending = reader->nr_queued;
+
+    reader->nr_queued = 0;
+    while (pending > 0)
+    {
+        int submitted;
+
+        /* usually a single enter submits everything and returns with all completions */
+        submitted = sys_io_uring_enter(reader->ring_fd, to_submit, pending, IORING_ENTER_GETEVENTS);
+        if (submitted < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("io_uring_enter");
+            return -1;
+        }
+        reader->nr_enter_calls++;
+        to_submit -= submitted;
+        pending -= reap_completions(reader);
+    }
+    return 0;
+}
+
+void uring_reader_destroy(uring_reader *reader)
+{
+    if (reader->sqes != MAP_FAILED && reader->sqes != NULL)
+    {
+        munmap(reader->sqes, reader->sqes_size);
+    }
+    if (reader->cq_ring != MAP_FAILED && reader->cq_ring != NULL && reader->cq_ring != reader->sq_ring)
+    {
+        munmap(reader->cq_ring, reader->cq_ring_size);
+    }
+    if (reader->sq_ring != MAP_FAILED && reader->sq_ring != NULL)
+    {
+        munmap(reader->sq_ring, reader->sq_ring_size);
+    }
+    if (reader->ring_fd >= 0)
+    {
+        close(reader->ring_fd);
+    }
+    memset(reader, 0, sizeof(uring_reader));
+    reader->ring_fd = -1;
+}
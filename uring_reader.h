@@ -0,0 +1,61 @@
+#ifndef URING_READER_H
+#define URING_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* reads queued per io_uring_enter() at most, larger batches take several */
+#define URING_READER_MAX_ENTRIES 4096
+
+/**********
+ * Name: uring_reader
+ * Description: batch of read()s issued through one io_uring. Reads are queued
+ * into the submission ring without a syscall, uring_reader_submit() hands all
+ * of them to the kernel and waits for their completions with a single
+ * io_uring_enter(), then reports every result to the complete callback.
+ * Built on the raw syscalls so no liburing is needed.
+ * Functions return 0 on success and -1 after printing the reason.
+ * ********/
+
+/* result is the number of bytes read or -errno */
+typedef void (*uring_read_complete)(void *context, uint64_t user_data, int result);
+
+struct uring_reader
+{
+    int ring_fd;
+    unsigned int entries;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+    /* queued since the last submit */
+    unsigned int nr_queued;
+    uring_read_complete complete;
+    void *context;
+    unsigned long long nr_enter_calls;
+};
+
+typedef struct uring_reader uring_reader;
+
+/* fails when the kernel has no io_uring, the caller then reads one by one */
+int uring_reader_init(uring_reader *reader, unsigned int entries, uring_read_complete complete, void *context);
+
+/* submits the queue first when it is full */
+int uring_reader_queue(uring_reader *reader, int fd, void *buffer, size_t size, uint64_t user_data);
+
+/* submits the queued reads and returns once all of them have completed */
+int uring_reader_submit(uring_reader *reader);
+
+void uring_reader_destroy(uring_reader *reader);
+
+#endif